@@ -4,3 +4,7 @@ SUBDIRS = editor
 
 editor.file = src/editor.pro
 
+bench {
+    SUBDIRS += benchmarks
+    benchmarks.file = src/bench.pro
+}
@@ -0,0 +1,15 @@
+# The engine benchmarks: the editor's sources with a different main().
+# Build with `qmake CONFIG+=bench` from the top level.
+include(editor.pro)
+
+TARGET = ptcollab-bench
+OBJECTS_DIR = ../build/bench-cache
+MOC_DIR = ../build/bench-cache
+
+SOURCES -= main.cpp
+HEADERS += bench/GoldenRender.h
+SOURCES += bench/Benchmark.cpp \
+           bench/GoldenRender.cpp
+DEFINES += PTCOLLAB_RES_DIR=\\\"$$PWD/../res\\\"
+
+INSTALLS =
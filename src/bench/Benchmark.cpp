@@ -0,0 +1,642 @@
+// Times the engine's hot paths on the sample songs and some made-up ones, and
+// prints the results as JSON, so that runs before and after a change can be
+// compared. Each timing is the best of a few repeats.
+//
+// With --golden, instead checks that the sample songs still render exactly as
+// they did when the golden hashes were made. With --streams, checks that the
+// Ogg voices too long to keep decoded play as they would decoded in full.
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+
+#include "bench/GoldenRender.h"
+#include "editor/PxtoneController.h"
+#include "editor/Settings.h"
+#include "pxtone/pxtnResample.h"
+#include "pxtone/pxtnService.h"
+
+static const int EVENT_MAX = 1000000;
+static const int SAMPLE_RATE = 44100;
+
+static int repeat_num = 3;
+static QJsonArray results;
+
+// The shortest time [fn] takes over [repeat_num] tries. [setup] is run before
+// each, untimed.
+static double best_secs(const std::function<void()> &fn,
+                        const std::function<void()> &setup = []() {}) {
+  double best = 0;
+  for (int i = 0; i < repeat_num; ++i) {
+    setup();
+    QElapsedTimer timer;
+    timer.start();
+    fn();
+    double secs = timer.nsecsElapsed() / 1e9;
+    if (i == 0 || secs < best) best = secs;
+  }
+  return best;
+}
+
+static void add_result(const QString &benchmark, const QString &song,
+                       double secs, QJsonObject fields = {}) {
+  fields["benchmark"] = benchmark;
+  fields["song"] = song;
+  fields["secs"] = secs;
+  results.append(fields);
+  std::cerr << benchmark.toStdString() << " " << song.toStdString() << ": "
+            << secs << "s" << std::endl;
+}
+
+static QByteArray read_file(const QString &filename) {
+  QFile f(filename);
+  if (!f.open(QIODevice::ReadOnly))
+    qFatal("Could not open %s", filename.toStdString().c_str());
+  return f.readAll();
+}
+
+static void init(pxtnService &pxtn) {
+  if (pxtn.init_collage(EVENT_MAX) != pxtnOK ||
+      !pxtn.set_destination_quality(2, SAMPLE_RATE))
+    qFatal("Could not initialize pxtone");
+}
+
+static void load(pxtnService &pxtn, const QByteArray &data) {
+  pxtnDescriptor desc;
+  desc.set_memory_r(data.constData(), data.size());
+  if (pxtn.read(&desc) != pxtnOK) qFatal("Could not read song");
+}
+
+static void load_woice(pxtnService &pxtn, int idx, const QString &filename,
+                       pxtnWOICETYPE type) {
+  QByteArray data = read_file(filename);
+  pxtnDescriptor desc;
+  desc.set_memory_r(data.constData(), data.size());
+  if (pxtn.Woice_read(idx, &desc, type) != pxtnOK)
+    qFatal("Could not read %s", filename.toStdString().c_str());
+}
+
+// [unit_num] units, alternating between a sine and a drum, each playing
+// [notes_per_meas] notes a measure with a key change on each.
+static void make_song(pxtnService &pxtn, const QString &instruments,
+                      int unit_num, int notes_per_meas, int meas_num) {
+  pxtn.clear();
+  pxtn.master->Set(4, 120, 480);
+  pxtn.master->set_meas_num(meas_num);
+  load_woice(pxtn, 0, instruments + "/000-sineNormal.ptvoice", pxtnWOICE_PTV);
+  load_woice(pxtn, 1, instruments + "/drum_bass1.ptnoise", pxtnWOICE_PTN);
+  int32_t meas_clock = pxtn.master->get_this_clock(1, 0, 0);
+  int32_t step = meas_clock / notes_per_meas;
+  for (int u = 0; u < unit_num; ++u) {
+    if (!pxtn.Unit_AddNew()) qFatal("Could not add unit");
+    pxtn.evels->Record_Add_i(0, u, EVENTKIND_VOICENO, u % 2);
+    for (int32_t clock = 0; clock < meas_num * meas_clock; clock += step) {
+      int32_t key = EVENTDEFAULT_KEY + ((clock / step + u) % 12) * 0x100;
+      pxtn.evels->Record_Add_i(clock, u, EVENTKIND_KEY, key);
+      pxtn.evels->Record_Add_i(clock, u, EVENTKIND_ON, step * 3 / 4);
+    }
+  }
+}
+
+// Moos [secs] of [pxtn] from the start, on [thread_num] threads.
+static void bench_moo(pxtnService &pxtn, const QString &song, double secs,
+                      int thread_num, QJsonObject fields = {}) {
+  mooState moo_state;
+  if (pxtn.tones_ready(moo_state) != pxtnOK) qFatal("Could not ready tones");
+  pxtnVOMITPREPARATION prep{};
+  prep.flags |= pxtnVOMITPREPFLAG_loop;
+  prep.master_volume = 1;
+  prep.thread_num = thread_num;
+  int32_t frames = int32_t(secs * SAMPLE_RATE);
+  std::vector<char> buf(4096);
+  double elapsed = best_secs(
+      [&]() {
+        for (int32_t done = 0; done < frames * 4; done += buf.size())
+          if (!pxtn.Moo(moo_state, buf.data(),
+                        std::min(int32_t(buf.size()), frames * 4 - done)))
+            qFatal("Moo error");
+      },
+      [&]() {
+        if (!pxtn.moo_preparation(&prep, moo_state))
+          qFatal("Could not prepare moo");
+      });
+  fields["threads"] = thread_num;
+  fields["units"] = pxtn.Unit_Num();
+  fields["events"] = pxtn.evels->get_Count();
+  fields["frames"] = frames;
+  fields["frames_per_sec"] = frames / elapsed;
+  add_result("moo", song, elapsed, fields);
+}
+
+// Times processEvent on every note-on of [data]'s song, which finds the unit's
+// next note to cut the release short. With [key_every], every unit first gets
+// a KEY event that often, like a heavily automated song, so that there are
+// lots of events between notes.
+static void bench_note_on(const QString &song, const QByteArray &data,
+                          int32_t key_every) {
+  pxtnService pxtn;
+  init(pxtn);
+  load(pxtn, data);
+  mooState moo_state;
+  if (pxtn.tones_ready(moo_state) != pxtnOK) qFatal("Could not ready tones");
+  pxtnVOMITPREPARATION prep{};
+  prep.master_volume = 1;
+  if (!pxtn.moo_preparation(&prep, moo_state)) qFatal("Could not prepare moo");
+
+  if (key_every > 0) {
+    int32_t end_clock = pxtn.moo_get_end_clock();
+    for (int u = 0; u < pxtn.Unit_Num(); ++u)
+      for (int32_t clock = 1; clock < end_clock; clock += key_every)
+        pxtn.evels->Record_Add_i(clock, u, EVENTKIND_KEY,
+                                 EVENTDEFAULT_KEY + (clock % 7) * 0x100);
+  }
+  std::vector<const EVERECORD *> ons;
+  for (const EVERECORD *e = pxtn.evels->get_Records(); e; e = e->next)
+    if (e->kind == EVENTKIND_ON) ons.push_back(e);
+  if (ons.empty()) return;
+
+  double secs = best_secs([&]() {
+    for (const EVERECORD *e : ons)
+      moo_state.params.processEvent(&moo_state.units[e->unit_no], e, e->clock,
+                                    -1, &pxtn);
+  });
+  add_result("note_on", song, secs,
+             {{"key_every", key_every},
+              {"events", pxtn.evels->get_Count()},
+              {"note_ons", int(ons.size())},
+              {"ns_per_note_on", secs * 1e9 / ons.size()}});
+}
+
+static void bench_song(const QString &filename, double moo_secs) {
+  QString song = QFileInfo(filename).fileName();
+  QByteArray data = read_file(filename);
+
+  {
+    std::unique_ptr<pxtnService> pxtn;
+    double secs = best_secs([&]() { load(*pxtn, data); },
+                            [&]() {
+                              pxtn = std::make_unique<pxtnService>();
+                              init(*pxtn);
+                            });
+    add_result("read", song, secs, {{"bytes", data.size()}});
+  }
+
+  pxtnService pxtn;
+  init(pxtn);
+  load(pxtn, data);
+  mooState moo_state;
+  for (int thread_num : {1, QThread::idealThreadCount()})
+    add_result("tones_ready", song, best_secs([&]() {
+                 if (pxtn.tones_ready(moo_state, thread_num) != pxtnOK)
+                   qFatal("Could not ready tones");
+               }),
+               {{"threads", thread_num}});
+
+  // Seeking, both from nothing and with checkpoints from an earlier seek.
+  int32_t total = pxtn.moo_get_total_sample();
+  for (int quarter = 0; quarter < 4; ++quarter) {
+    pxtnVOMITPREPARATION prep{};
+    prep.flags |= pxtnVOMITPREPFLAG_loop;
+    prep.master_volume = 1;
+    prep.start_pos_sample = total / 4 * quarter;
+    for (bool checkpointed : {false, true}) {
+      mooCheckpoints checkpoints;
+      if (checkpointed) pxtn.moo_preparation(&prep, moo_state, &checkpoints);
+      double secs = best_secs([&]() {
+        if (!pxtn.moo_preparation(&prep, moo_state,
+                                  checkpointed ? &checkpoints : nullptr))
+          qFatal("Could not prepare moo");
+      });
+      add_result("moo_preparation", song, secs,
+                 {{"start_sample", prep.start_pos_sample},
+                  {"checkpoints", checkpointed}});
+    }
+  }
+
+  bench_moo(pxtn, song, moo_secs, 1);
+  bench_moo(pxtn, song, moo_secs, QThread::idealThreadCount());
+  for (int32_t key_every : {0, 16}) bench_note_on(song, data, key_every);
+
+  {
+    mooState render_moo_state;
+    PxtoneController controller(0, &pxtn, &render_moo_state);
+    double secs = best_secs([&]() {
+      QBuffer buf;
+      buf.open(QIODevice::WriteOnly);
+      controller.render_exn(&buf, moo_secs, 0, 1, RenderFormat::Int16,
+                            std::nullopt);
+    });
+    add_result("render_exn", song, secs,
+               {{"frames", int(moo_secs * SAMPLE_RATE)},
+                {"frames_per_sec", moo_secs * SAMPLE_RATE / secs}});
+  }
+}
+
+// Adds [n] events at random clocks one at a time, then deletes them one at a
+// time, like a lot of small edits.
+static void bench_evelist(const QString &instruments, int n) {
+  pxtnService pxtn;
+  init(pxtn);
+  make_song(pxtn, instruments, 4, 4, 64);
+  int32_t end_clock = pxtn.master->get_clock_num();
+  std::mt19937 rng(n);
+  std::vector<std::pair<int32_t, uint8_t>> places;
+  for (int i = 0; i < n; ++i)
+    places.emplace_back(rng() % end_clock, rng() % pxtn.Unit_Num());
+
+  double add_secs = 0, delete_secs = 0;
+  for (int i = 0; i < repeat_num; ++i) {
+    QElapsedTimer timer;
+    timer.start();
+    for (auto [clock, unit_no] : places)
+      pxtn.evels->Record_Add_i(clock, unit_no, EVENTKIND_VELOCITY, 100);
+    double secs = timer.nsecsElapsed() / 1e9;
+    if (i == 0 || secs < add_secs) add_secs = secs;
+
+    std::shuffle(places.begin(), places.end(), rng);
+    timer.restart();
+    for (auto [clock, unit_no] : places)
+      pxtn.evels->Record_Delete(clock, clock + 1, unit_no, EVENTKIND_VELOCITY);
+    secs = timer.nsecsElapsed() / 1e9;
+    if (i == 0 || secs < delete_secs) delete_secs = secs;
+  }
+  QJsonObject fields{{"records", n},
+                     {"events_before", pxtn.evels->get_Count()}};
+  fields["ns_per_record"] = add_secs * 1e9 / n;
+  add_result("Record_Add_i", "synthetic", add_secs, fields);
+  fields["ns_per_record"] = delete_secs * 1e9 / n;
+  add_result("Record_Delete", "synthetic", delete_secs, fields);
+}
+
+// Loads [n] events the way a project is read, and times walking all of them,
+// which playback, painting and saving all do.
+static void bench_evelist_walk(int n) {
+  pxtnEvelist evels;
+  evels.Allocate(n);
+  evels.Linear_Start();
+  for (int i = 0; i < n; ++i) {
+    if (i / 8 % 2)
+      evels.Linear_Add_i(i / 8 * 10, i % 8, EVENTKIND_VELOCITY, 100);
+    else
+      evels.Linear_Add_i(i / 8 * 10, i % 8, EVENTKIND_ON, 40);
+  }
+  evels.Linear_End(true);
+
+  // Summed and reported so that the walk isn't optimized away.
+  int64_t sum = 0;
+  double secs = best_secs([&]() {
+    for (const EVERECORD *p = evels.get_Records(); p; p = p->next)
+      sum += p->value;
+  });
+  add_result("evelist_walk", "synthetic", secs,
+             {{"records", n},
+              {"ns_per_record", secs * 1e9 / n},
+              {"sum", (double)sum}});
+}
+
+// Renders the golden excerpts of [songs] (named relative to [sample_dir]) and
+// compares them against [golden_file], or rewrites it if [update]. Excerpts
+// missing from [reference_dir] are saved there, and ones that differ are
+// compared against them sample by sample. Returns how many differ.
+static int check_golden(const QString &golden_file, const QStringList &songs,
+                        const QDir &sample_dir, bool update,
+                        const QString &reference_dir) {
+  QMap<QString, QString> golden;
+  QFile f(golden_file);
+  if (f.open(QIODevice::ReadOnly | QIODevice::Text))
+    while (!f.atEnd()) {
+      QString line = QString::fromUtf8(f.readLine()).trimmed();
+      if (line.isEmpty() || line.startsWith("#")) continue;
+      golden[line.section(' ', 1)] = line.section(' ', 0, 0);
+    }
+  else if (!update)
+    qFatal("Could not open %s", golden_file.toStdString().c_str());
+  f.close();
+
+  QStringList lines;
+  int differ_num = 0, excerpt_num = 0;
+  for (const QString &filename : songs) {
+    QString song = sample_dir.relativeFilePath(filename);
+    QByteArray data = read_file(filename);
+    std::vector<GoldenExcerpt> excerpts;
+    if (!golden_render_song(data.constData(), data.size(), &excerpts)) {
+      std::cout << song.toStdString() << ": could not render" << std::endl;
+      ++differ_num;
+      continue;
+    }
+    for (const GoldenExcerpt &e : excerpts) {
+      ++excerpt_num;
+      QString key = QString("%1 %2 %3 %4 %5")
+                        .arg(e.ch_num)
+                        .arg(e.sps)
+                        .arg(e.start_smp)
+                        .arg(e.smp_num)
+                        .arg(song);
+      QString hash = QString("%1").arg(golden_hash(e.pcm), 16, 16, QChar('0'));
+      lines.append(hash + " " + key);
+      if (update) continue;
+
+      QString message;
+      if (!golden.contains(key))
+        message = "no golden hash";
+      else if (golden[key] != hash) {
+        ++differ_num;
+        message = "differs";
+      }
+      if (reference_dir != "") {
+        QString ref_name = QString("%1/%2_%3_%4_%5.raw")
+                               .arg(reference_dir)
+                               .arg(QString(song).replace('/', '_'))
+                               .arg(e.ch_num)
+                               .arg(e.sps)
+                               .arg(e.start_smp);
+        QFile ref(ref_name);
+        QByteArray pcm(reinterpret_cast<const char *>(e.pcm.data()),
+                       e.pcm.size() * sizeof(int16_t));
+        if (!ref.exists()) {
+          if (!ref.open(QIODevice::WriteOnly) || ref.write(pcm) != pcm.size())
+            qFatal("Could not write %s", ref_name.toStdString().c_str());
+        } else if (message == "differs" && ref.open(QIODevice::ReadOnly)) {
+          QByteArray ref_pcm = ref.readAll();
+          const int16_t *r = reinterpret_cast<const int16_t *>(ref_pcm.data());
+          size_t n = std::min(e.pcm.size(), ref_pcm.size() / sizeof(int16_t));
+          int max_error = 0;
+          size_t first = n;
+          for (size_t i = 0; i < n; ++i) {
+            int error = std::abs(e.pcm[i] - r[i]);
+            if (error > 0 && first == n) first = i;
+            max_error = std::max(max_error, error);
+          }
+          message += QString(", max sample error %1 from sample %2")
+                         .arg(max_error)
+                         .arg(first / e.ch_num);
+        }
+      }
+      if (message != "")
+        std::cout << key.toStdString() << ": " << message.toStdString()
+                  << std::endl;
+    }
+  }
+
+  if (update) {
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text))
+      qFatal("Could not write %s", golden_file.toStdString().c_str());
+    QTextStream out(&f);
+    out << "# Hashes of excerpts of the sample songs, from ptcollab-bench "
+           "--update-golden.\n"
+        << "# hash channels sample_rate start_sample sample_num song\n";
+    for (const QString &line : lines) out << line << "\n";
+    std::cout << "Wrote " << lines.size() << " hashes" << std::endl;
+    return 0;
+  }
+  std::cout << excerpt_num << " excerpts, " << differ_num << " differ"
+            << std::endl;
+  return differ_num;
+}
+
+#ifdef pxINCLUDE_OGGVORBIS
+// Waits for a stream decoded on another thread to have what reading [p_vi] at
+// [pos] looks at. Returns false if it takes over a second.
+static bool wait_for_stream(const pxtnVOICEINSTANCE *p_vi,
+                            pxtnVOICESTREAM *p_stream, double pos) {
+  int32_t first = std::max(
+      (int32_t)(pos * p_vi->sps / 44100) - pxtnResample::READ_BEHIND_NUM, 0);
+  int32_t num =
+      std::min(pxtnResample::READ_BEHIND_NUM * 2 + 1, p_vi->smp_num - first);
+  QElapsedTimer timer;
+  timer.start();
+  while (!pxtnResample::Samples(p_vi, p_stream, first, num)) {
+    if (timer.elapsed() > 1000) return false;
+    QThread::usleep(100);
+  }
+  return true;
+}
+
+// Reads [p_vi] from [start] as a note moving [step] a sample would, from a
+// stream opened the way a note opens it, and from [p_full], the same voice
+// decoded in full. With [p_keep], the stream's decoded ahead on another thread
+// as it is on the audio thread, and each read waits for it. Returns where they
+// first differ, or -1 if they don't.
+static double stream_difference(const pxtnVOICEINSTANCE *p_vi,
+                                const pxtnVOICEINSTANCE *p_full,
+                                pxtnRESAMPLE quality, double start,
+                                double step,
+                                std::shared_ptr<const void> p_keep) {
+  pxtnVOICESTREAM stream, full_stream;
+  bool b_prefetch = p_keep != nullptr;
+  pxtnResample::Open(p_vi, &stream, start, std::move(p_keep));
+  for (double pos = start; pos < p_vi->smp_body_w; pos += step) {
+    int32_t smps[2], full_smps[2];
+    if (b_prefetch && !wait_for_stream(p_vi, &stream, pos)) return pos;
+    pxtnResample::Read(p_vi, &stream, pos, step, false, quality, 2, smps);
+    pxtnResample::Read(p_full, &full_stream, pos, step, false, quality, 2,
+                       full_smps);
+    if (smps[0] != full_smps[0] || smps[1] != full_smps[1]) return pos;
+  }
+  return -1;
+}
+
+// How long it takes for a note's stream decoded on another thread to have
+// what's after the resident samples, in milliseconds.
+static double prefetch_msecs(std::shared_ptr<const pxtnWoice> woice,
+                             const pxtnVOICEINSTANCE *p_vi) {
+  QElapsedTimer timer;
+  timer.start();
+  pxtnVOICESTREAM stream;
+  pxtnResample::Open(p_vi, &stream, 0, woice);
+  if (!wait_for_stream(p_vi, &stream,
+                       (double)p_vi->smp_resident * 44100 / p_vi->sps))
+    return -1;
+  return timer.nsecsElapsed() / 1e6;
+}
+#endif
+
+// Plays the streamed voices of [songs] at a few pitches, from the start and
+// from the middle, and compares them against the voices decoded in full.
+// Returns how many differ, or 1 if there weren't any to check.
+static int check_streams(const QStringList &songs, const QDir &sample_dir) {
+#ifdef pxINCLUDE_OGGVORBIS
+  int voice_num = 0, differ_num = 0;
+  for (const QString &filename : songs) {
+    QString song = sample_dir.relativeFilePath(filename);
+    pxtnService pxtn;
+    init(pxtn);
+    load(pxtn, read_file(filename));
+    mooState moo_state;
+    if (pxtn.tones_ready(moo_state) != pxtnOK) qFatal("Could not ready tones");
+    for (int32_t w = 0; w < pxtn.Woice_Num(); ++w) {
+      std::shared_ptr<const pxtnWoice> woice = pxtn.Woice_Get(w);
+      for (int32_t v = 0; v < woice->get_voice_num(); ++v) {
+        const pxtnVOICEINSTANCE *p_vi = woice->get_instance(v);
+        if (p_vi->smp_resident >= p_vi->smp_num) continue;
+        ++voice_num;
+
+        QString message;
+        pxtnPulse_PCM pcm;
+        if (woice->get_voice(v)->p_oggv->Decode(&pcm) != pxtnOK)
+          message = "could not decode";
+        else if (pcm.get_ch() != p_vi->ch_num || pcm.get_bps() != 16 ||
+                 pcm.get_smp_body() != p_vi->smp_num)
+          message = "decodes differently";
+        pxtnVOICEINSTANCE full = *p_vi;
+        full.p_smp_w = (uint8_t *)pcm.get_p_buf();
+        full.smp_resident = full.smp_num;
+        full.p_stream = nullptr;
+        for (bool b_prefetch : {false, true})
+          for (pxtnRESAMPLE quality :
+               {pxtnRESAMPLE_nearest, pxtnRESAMPLE_sinc})
+            for (double step : {0.75, 1.0, 1.5, 3.0})
+              for (double start : {0.0, p_vi->smp_body_w / 2.0}) {
+                if (message != "") break;
+                double pos =
+                    stream_difference(p_vi, &full, quality, start, step,
+                                      b_prefetch ? woice : nullptr);
+                if (pos >= 0)
+                  message =
+                      QString("differs at %1 (resample %2, step %3%4)")
+                          .arg(pos)
+                          .arg(int(quality))
+                          .arg(step)
+                          .arg(b_prefetch ? ", prefetched" : "");
+              }
+        if (message != "") ++differ_num;
+        // The resident samples have to last until the stream's ready, or the
+        // note goes quiet for a bit.
+        std::cout << QString("%1 woice %2 voice %3: %4 samples, prefetched in "
+                             "%5 of %6 ms resident, %7")
+                         .arg(song)
+                         .arg(w)
+                         .arg(v)
+                         .arg(p_vi->smp_num)
+                         .arg(prefetch_msecs(woice, p_vi), 0, 'f', 1)
+                         .arg(1000.0 * p_vi->smp_resident / p_vi->sps, 0,
+                              'f', 1)
+                         .arg(message == "" ? "ok" : message)
+                         .toStdString()
+                  << std::endl;
+      }
+    }
+  }
+  std::cout << voice_num << " streamed voices, " << differ_num << " differ"
+            << std::endl;
+  return voice_num == 0 ? 1 : differ_num;
+#else
+  (void)songs;
+  (void)sample_dir;
+  std::cout << "Built without Ogg Vorbis" << std::endl;
+  return 1;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication a(argc, argv);
+  a.setOrganizationName("ptcollab");
+  a.setOrganizationDomain("ptweb.me");
+  a.setApplicationName("ptcollab");
+  a.setApplicationVersion(Settings::Version::string());
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmarks for the pxtone engine");
+  parser.addHelpOption();
+  QCommandLineOption resOption(
+      "res", "Where the sample songs and instruments are.", "dir",
+      PTCOLLAB_RES_DIR);
+  parser.addOption(resOption);
+  QCommandLineOption repeatOption("repeat", "Time each thing <n> times.", "n",
+                                  "3");
+  parser.addOption(repeatOption);
+  QCommandLineOption secsOption("secs", "How much of each song to moo.",
+                                "secs", "10");
+  parser.addOption(secsOption);
+  QCommandLineOption outputOption("output", "Write the JSON to this file.",
+                                  "file");
+  parser.addOption(outputOption);
+  QCommandLineOption goldenOption(
+      "golden", "Check the songs render as hashed in <file>.", "file");
+  parser.addOption(goldenOption);
+  QCommandLineOption updateGoldenOption(
+      "update-golden", "With --golden, rewrite <file> instead of checking.");
+  parser.addOption(updateGoldenOption);
+  QCommandLineOption referenceOption(
+      "reference",
+      "With --golden, save renders to <dir>, or compare against those saved.",
+      "dir");
+  parser.addOption(referenceOption);
+  QCommandLineOption streamsOption(
+      "streams",
+      "Check the songs' streamed voices play as they do decoded in full.");
+  parser.addOption(streamsOption);
+  parser.addPositionalArgument("songs",
+                               "Songs to benchmark, instead of the samples.",
+                               "[songs...]");
+  parser.process(a);
+
+  repeat_num = std::max(1, parser.value(repeatOption).toInt());
+  double secs = parser.value(secsOption).toDouble();
+  QString res = parser.value(resOption);
+  QString instruments = res + "/sample_instruments/pxtone";
+
+  QStringList songs = parser.positionalArguments();
+  if (parser.isSet(goldenOption) || parser.isSet(streamsOption)) {
+    QDir sample_dir(res + "/sample_songs");
+    if (songs.empty()) {
+      QDirIterator it(sample_dir.path(), {"*.ptcop", "*.pttune"}, QDir::Files,
+                      QDirIterator::Subdirectories);
+      while (it.hasNext()) songs.append(it.next());
+      songs.sort();
+    }
+    if (parser.isSet(streamsOption))
+      return check_streams(songs, sample_dir) > 0;
+    return check_golden(parser.value(goldenOption), songs, sample_dir,
+                        parser.isSet(updateGoldenOption),
+                        parser.value(referenceOption)) > 0;
+  }
+  if (songs.empty()) {
+    QDir dir(res + "/sample_songs");
+    for (const QString &f : dir.entryList({"*.ptcop", "*.pttune"}, QDir::Files))
+      songs.append(dir.filePath(f));
+  }
+  for (const QString &song : songs) bench_song(song, secs);
+
+  for (int unit_num : {1, 8, 32, 64})
+    for (int notes_per_meas : {1, 4, 16}) {
+      pxtnService pxtn;
+      init(pxtn);
+      make_song(pxtn, instruments, unit_num, notes_per_meas, 16);
+      bench_moo(pxtn, "synthetic", secs, 1,
+                {{"notes_per_meas", notes_per_meas}});
+    }
+
+  for (int n : {1000, 4000, 16000}) bench_evelist(instruments, n);
+  for (int n : {100000, EVENT_MAX}) bench_evelist_walk(n);
+
+  QJsonObject json{{"version", Settings::Version::string()},
+                   {"sample_rate", SAMPLE_RATE},
+                   {"ideal_threads", QThread::idealThreadCount()},
+                   {"repeat", repeat_num},
+                   {"results", results}};
+  QByteArray out = QJsonDocument(json).toJson();
+  if (parser.isSet(outputOption)) {
+    QFile f(parser.value(outputOption));
+    if (!f.open(QIODevice::WriteOnly) || f.write(out) != out.size())
+      qFatal("Could not write output");
+  } else
+    std::cout << out.toStdString();
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include "GoldenRender.h"
+
+#include <algorithm>
+
+#include "pxtone/pxtnService.h"
+
+static const int32_t EVENT_MAX = 1000000;
+
+struct Format {
+  int32_t ch_num;
+  int32_t sps;
+};
+static const Format FORMATS[] = {{2, 44100}, {1, 22050}, {2, 48000}};
+
+static bool render(const pxtnService &pxtn, mooState &moo_state,
+                   GoldenExcerpt *excerpt) {
+  pxtnVOMITPREPARATION prep{};
+  prep.flags |= pxtnVOMITPREPFLAG_loop;
+  prep.master_volume = 1;
+  prep.start_pos_sample = excerpt->start_smp;
+  if (!pxtn.moo_preparation(&prep, moo_state)) return false;
+  excerpt->pcm.resize(size_t(excerpt->smp_num) * excerpt->ch_num);
+  return pxtn.Moo(moo_state, excerpt->pcm.data(),
+                  int32_t(excerpt->pcm.size() * sizeof(int16_t)));
+}
+
+bool golden_render_song(const void *data, int32_t size,
+                        std::vector<GoldenExcerpt> *excerpts) {
+  for (const Format &f : FORMATS) {
+    pxtnService pxtn;
+    if (pxtn.init_collage(EVENT_MAX) != pxtnOK) return false;
+    if (!pxtn.set_destination_quality(f.ch_num, f.sps)) return false;
+    pxtnDescriptor desc;
+    if (!desc.set_memory_r(data, size)) return false;
+    if (pxtn.read(&desc) != pxtnOK) return false;
+    mooState moo_state;
+    if (pxtn.tones_ready(moo_state) != pxtnOK) return false;
+
+    int32_t total = pxtn.moo_get_total_sample();
+    const int32_t starts[] = {0, total / 2, std::max(0, total - 2 * f.sps)};
+    const int32_t lengths[] = {10 * f.sps, 5 * f.sps, 5 * f.sps};
+    for (int i = 0; i < 3; ++i) {
+      GoldenExcerpt excerpt{f.ch_num, f.sps, starts[i], lengths[i], {}};
+      if (!render(pxtn, moo_state, &excerpt)) return false;
+      excerpts->push_back(std::move(excerpt));
+    }
+  }
+  return true;
+}
+
+uint64_t golden_hash(const std::vector<int16_t> &pcm) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int16_t s : pcm)
+    for (uint8_t b : {uint8_t(s & 0xff), uint8_t((s >> 8) & 0xff)}) {
+      hash ^= b;
+      hash *= 1099511628211ULL;
+    }
+  return hash;
+}
@@ -0,0 +1,25 @@
+#ifndef GOLDENRENDER_H
+#define GOLDENRENDER_H
+
+#include <cstdint>
+#include <vector>
+
+// A short stretch of a song, rendered for checking that changes to the engine
+// don't change how songs sound.
+struct GoldenExcerpt {
+  int32_t ch_num;
+  int32_t sps;
+  int32_t start_smp;
+  int32_t smp_num;
+  std::vector<int16_t> pcm;
+};
+
+// Renders the song in [data] at a few sample rates and channel counts, from
+// the start, from the middle, and across the loop point. Returns false if the
+// song couldn't be loaded or rendered.
+bool golden_render_song(const void *data, int32_t size,
+                        std::vector<GoldenExcerpt> *excerpts);
+// FNV-1a of the samples, as little-endian bytes.
+uint64_t golden_hash(const std::vector<int16_t> &pcm);
+
+#endif  // GOLDENRENDER_H
@@ -125,6 +125,8 @@ HEADERS += \
            editor/sidemenu/WoiceListModel.h \
            editor/views/Animation.h \
            editor/audio/AudioFormat.h \
+           editor/audio/AudioRingBuffer.h \
+           editor/BatchRender.h \
            editor/Clipboard.h \
            editor/ComboOptions.h \
            editor/DummySyncServer.h \
@@ -141,6 +143,10 @@ HEADERS += \
            editor/PxtoneClient.h \
            editor/PxtoneController.h \
            editor/audio/PxtoneIODevice.h \
+           editor/audio/PxtoneRenderCache.h \
+           editor/audio/PxtoneSegmentRenderer.h \
+           editor/audio/PxtoneToneCache.h \
+           editor/audio/PxtoneWoiceLoader.h \
            editor/sidemenu/PxtoneSideMenu.h \
            editor/audio/PxtoneUnitIODevice.h \
            editor/sidemenu/SelectWoiceDialog.h \
@@ -165,6 +171,7 @@ HEADERS += \
            pxtone/pxtnMaster.h \
            pxtone/pxtnMax.h \
            pxtone/pxtnMem.h \
+           pxtone/pxtnMix.h \
            pxtone/pxtnOverDrive.h \
            pxtone/pxtnPulse_Frequency.h \
            pxtone/pxtnPulse_Noise.h \
@@ -172,8 +179,10 @@ HEADERS += \
            pxtone/pxtnPulse_Oggv.h \
            pxtone/pxtnPulse_Oscillator.h \
            pxtone/pxtnPulse_PCM.h \
+           pxtone/pxtnResample.h \
            pxtone/pxtnService.h \
            pxtone/pxtnText.h \
+           pxtone/pxtnThreadPool.h \
            pxtone/pxtnUnit.h \
            pxtone/pxtnWoice.h \
            pxtone/pxtoneNoise.h \
@@ -218,6 +227,8 @@ SOURCES += main.cpp \
            editor/sidemenu/WoiceListModel.cpp \
            editor/views/Animation.cpp \
            editor/audio/AudioFormat.cpp \
+           editor/audio/AudioRingBuffer.cpp \
+           editor/BatchRender.cpp \
            editor/Clipboard.cpp \
            editor/ComboOptions.cpp \
            editor/DummySyncServer.cpp \
@@ -234,6 +245,10 @@ SOURCES += main.cpp \
            editor/PxtoneClient.cpp \
            editor/PxtoneController.cpp \
            editor/audio/PxtoneIODevice.cpp \
+           editor/audio/PxtoneRenderCache.cpp \
+           editor/audio/PxtoneSegmentRenderer.cpp \
+           editor/audio/PxtoneToneCache.cpp \
+           editor/audio/PxtoneWoiceLoader.cpp \
            editor/sidemenu/PxtoneSideMenu.cpp \
            editor/audio/PxtoneUnitIODevice.cpp \
            editor/sidemenu/SelectWoiceDialog.cpp \
@@ -255,6 +270,7 @@ SOURCES += main.cpp \
            pxtone/pxtnEvelist.cpp \
            pxtone/pxtnMaster.cpp \
            pxtone/pxtnMem.cpp \
+           pxtone/pxtnMix.cpp \
            pxtone/pxtnOverDrive.cpp \
            pxtone/pxtnPulse_Frequency.cpp \
            pxtone/pxtnPulse_Noise.cpp \
@@ -262,9 +278,11 @@ SOURCES += main.cpp \
            pxtone/pxtnPulse_Oggv.cpp \
            pxtone/pxtnPulse_Oscillator.cpp \
            pxtone/pxtnPulse_PCM.cpp \
+           pxtone/pxtnResample.cpp \
            pxtone/pxtnService.cpp \
            pxtone/pxtnService_moo.cpp \
            pxtone/pxtnText.cpp \
+           pxtone/pxtnThreadPool.cpp \
            pxtone/pxtnUnit.cpp \
            pxtone/pxtnWoice.cpp \
            pxtone/pxtnWoice_io.cpp \
@@ -0,0 +1,122 @@
+#include "BatchRender.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "PxtoneController.h"
+#include "pxtone/pxtnThreadPool.h"
+
+static const int EVENT_MAX = 16000000;
+
+static std::mutex print_mutex;
+static void print(const QString &s) {
+  std::lock_guard<std::mutex> lock(print_mutex);
+  std::cout << s.toStdString() << std::endl;
+}
+
+// Throws a QString on errors. Renders straight from a pxtnService, since a
+// controller would start playback machinery like its render cache for nothing.
+static void render_file(const QString &filename,
+                        const BatchRenderOptions &options, int thread_num) {
+  pxtnService pxtn;
+  mooState moo_state;
+  if (pxtn.init_collage(EVENT_MAX) != pxtnOK ||
+      !pxtn.set_destination_quality(2, options.sample_rate))
+    throw QString("Could not initialize pxtone");
+
+  QFile in(filename);
+  if (!in.open(QIODevice::ReadOnly)) throw QString("Could not open file");
+  QByteArray data = in.readAll();
+  pxtnDescriptor desc;
+  if (!desc.set_memory_r(data.constData(), data.size()))
+    throw QString("Could not read file");
+  if (pxtn.read(&desc) != pxtnOK) throw QString("Could not load song");
+  pxtnERR err = pxtn.tones_ready(moo_state, thread_num);
+  if (err != pxtnOK)
+    throw QString("Error getting tones ready: error code %1").arg(err);
+
+  double length;
+  if (options.length.has_value())
+    length = options.length.value();
+  else {
+    const pxtnMaster *m = pxtn.master;
+    double secs_per_meas = m->get_beat_num() / m->get_beat_tempo() * 60;
+    int loop_meas = m->get_play_meas() - m->get_repeat_meas();
+    length =
+        (m->get_play_meas() + (options.loops - 1) * loop_meas) * secs_per_meas;
+  }
+
+  QString basename = QFileInfo(filename).completeBaseName();
+  QDir dest(options.destination);
+  std::vector<QString> filenames;
+  if (options.stems == pxtnSTEM_none)
+    filenames.push_back(dest.filePath(basename + ".wav"));
+  else {
+    if (!dest.mkpath(basename)) throw QString("Could not make directory");
+    filenames = PxtoneController::stemFilenames(&pxtn, options.stems,
+                                                dest.filePath(basename));
+  }
+  std::vector<std::unique_ptr<QSaveFile>> files;
+  std::vector<QIODevice *> devs;
+  for (const QString &f : filenames) {
+    files.push_back(std::make_unique<QSaveFile>(f));
+    if (!files.back()->open(QIODevice::WriteOnly))
+      throw QString("Could not open %1 for writing").arg(f);
+    devs.push_back(files.back().get());
+  }
+
+  // As in PxtoneController::render_exn and render_stems_exn.
+  pxtnVOMITPREPARATION prep{};
+  prep.flags |= pxtnVOMITPREPFLAG_loop;
+  if (options.stems == pxtnSTEM_none) prep.flags |= pxtnVOMITPREPFLAG_unit_mute;
+  prep.master_volume = options.volume;
+  prep.stems = options.stems;
+  prep.thread_num = thread_num;
+  prep.resample = options.resample;
+
+  QElapsedTimer timer;
+  timer.start();
+  PxtoneController::render_devices_exn(&pxtn, moo_state, devs, prep,
+                                       options.format, length,
+                                       options.fadeout);
+  double elapsed = timer.nsecsElapsed() / 1e9;
+  for (auto &file : files)
+    if (!file->commit())
+      throw QString("Could not write %1").arg(file->fileName());
+
+  double secs = length + options.fadeout;
+  double frames = secs * options.sample_rate;
+  print(QString("%1: %2 frames (%3s) in %4s, %5 frames/s, %6x real time")
+            .arg(filename)
+            .arg(qint64(frames))
+            .arg(secs, 0, 'f', 2)
+            .arg(elapsed, 0, 'f', 2)
+            .arg(qint64(frames / elapsed))
+            .arg(secs / elapsed, 0, 'f', 1));
+}
+
+int batchRender(const QStringList &files, const BatchRenderOptions &options) {
+  int jobs = std::max(1, std::min(options.jobs, int(files.size())));
+  // Split the cores between the files being rendered at once.
+  int thread_num = std::max(1, QThread::idealThreadCount() / jobs);
+  std::atomic<int> failed_num(0);
+  pxtnThreadPool pool(jobs);
+  pool.For(files.size(), [&](int32_t i) {
+    try {
+      render_file(files[i], options, thread_num);
+    } catch (const QString &e) {
+      print(QString("%1: %2").arg(files[i]).arg(e));
+      ++failed_num;
+    }
+  });
+  return failed_num;
+}
@@ -0,0 +1,31 @@
+#ifndef BATCHRENDER_H
+#define BATCHRENDER_H
+
+#include <QString>
+#include <QStringList>
+#include <optional>
+
+#include "PxtoneController.h"
+#include "pxtone/pxtnService.h"
+
+struct BatchRenderOptions {
+  QString destination;
+  // Defaults to the song plus [loops] - 1 more times round its loop.
+  std::optional<double> length;
+  int loops = 1;
+  double fadeout = 0;
+  double volume = 1;
+  int sample_rate = 44100;
+  pxtnSTEM stems = pxtnSTEM_none;
+  RenderFormat format = RenderFormat::Int16;
+  pxtnRESAMPLE resample = pxtnRESAMPLE_nearest;
+  // How many files are rendered at once.
+  int jobs = 1;
+};
+
+// Renders each of [files] to a WAV in [options.destination] (or a directory of
+// them for stems) without an editor, printing how fast each went. Returns how
+// many failed.
+int batchRender(const QStringList &files, const BatchRenderOptions &options);
+
+#endif  // BATCHRENDER_H
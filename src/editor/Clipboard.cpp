@@ -65,37 +65,29 @@ CopyState::CopyState(const std::set<int> &unit_nos, const Interval &range,
   uint8_t first_unit_no = (min == unit_nos.end() ? 0 : *min);
   for (const int &i : unit_nos) m_unit_nos.insert(i - first_unit_no);
 
-  for (const EVERECORD *e = pxtn->evels->get_Records();
-       e && e->clock < range.end; e = e->next) {
-    EVENTKIND kind(EVENTKIND(e->kind));
-    bool is_tail = Evelist_Kind_IsTail(e->kind);
-
-    if (e->clock < range.start) {
-      if (!is_tail) continue;
-      // For on events, we don't want to include them if they end at the start
-      // of the selection. Hence the <=. But 0-length tail events that are in
-      // range should still be counted.
-      if (is_tail && e->clock + e->value <= range.start) continue;
-    }
-
-    if (unit_nos.find(e->unit_no) != unit_nos.end() &&
-        kinds_to_copy.find(kind) != kinds_to_copy.end()) {
-      int32_t v = e->value;
-      int32_t clock = e->clock;
-      if (kind == EVENTKIND_VOICENO)
-        v = woiceIdMap.noToId(v);
-      else if (is_tail) {
-        clock = std::max(e->clock, range.start);
-        // the following is range.end - clock so that you only copy the stuff in
-        // your selection. it leads to some weird behaviour if you nudge a note
-        // left / right though.
-        v = std::min(v, range.end - clock);
+  // For on events, the window doesn't include those that end at the start of
+  // the selection. But 0-length tail events that are in range are.
+  for (int unit_no : unit_nos)
+    for (EVENTKIND kind : kinds_to_copy) {
+      bool is_tail = Evelist_Kind_IsTail(kind);
+      for (const EVERECORD *e : pxtn->evels->get_Kind_Window(
+               range.start, range.end, unit_no, kind)) {
+        int32_t v = e->value;
+        int32_t clock = e->clock;
+        if (kind == EVENTKIND_VOICENO)
+          v = woiceIdMap.noToId(v);
+        else if (is_tail) {
+          clock = std::max(e->clock, range.start);
+          // the following is range.end - clock so that you only copy the stuff
+          // in your selection. it leads to some weird behaviour if you nudge a
+          // note left / right though.
+          v = std::min(v, range.end - clock);
+        }
+
+        uint8_t copy_unit_no = unit_no - first_unit_no;
+        m_items.emplace_back(Item{clock - range.start, copy_unit_no, kind, v});
       }
-
-      uint8_t unit_no = e->unit_no - first_unit_no;
-      m_items.emplace_back(Item{clock - range.start, unit_no, kind, v});
     }
-  }
 }
 
 // TODO: Maybe also be able to copy the tails of ONs, the existing state for
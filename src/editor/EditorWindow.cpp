@@ -31,15 +31,16 @@
 #include "views/ParamView.h"
 #include "views/ViewHelper.h"
 
-// TODO: Maybe we could not hard-code this and change the engine to be dynamic
-// w/ smart pointers.
-
+// Events are allocated as they're added, so a high limit costs nothing until
+// it's used, and keeps a runaway edit from eating all memory.
 #undef EVENT_MAX  // winuser.h conflict -- warns without
-static constexpr int EVENT_MAX = 1000000;
+static constexpr int EVENT_MAX = 16000000;
 
 static constexpr int AUTOSAVE_CHECK_INTERVAL_MS = 1 * 1000;
 static constexpr int AUTOSAVE_WRITE_PERIOD = 30;
 
+static constexpr qint64 TONE_CACHE_MAX_SIZE = 512 * 1024 * 1024;
+
 QString autoSaveDir() {
   return QStandardPaths::writableLocation(
              QStandardPaths::AppLocalDataLocation) +
@@ -50,8 +51,14 @@ QString autoSavePath(const QString &filename) {
   return QDir(autoSaveDir()).filePath(filename);
 }
 
+QString toneCacheDir() {
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+         "/voices/";
+}
+
 EditorWindow::EditorWindow(QWidget *parent)
     : QMainWindow(parent),
+      m_tone_cache(toneCacheDir(), TONE_CACHE_MAX_SIZE),
       m_server(nullptr),
       m_filename(std::nullopt),
       m_connection_status(new ConnectionStatusLabel(this)),
@@ -76,6 +83,7 @@ EditorWindow::EditorWindow(QWidget *parent)
   int channel_num = 2;
   int sample_rate = 44100;
   m_pxtn.set_destination_quality(channel_num, sample_rate);
+  m_pxtn.set_tone_cache(&m_tone_cache);
   ui->setupUi(this);
   resize(QDesktopWidget().availableGeometry(this).size() * 0.7);
   setAcceptDrops(true);
@@ -85,6 +93,16 @@ EditorWindow::EditorWindow(QWidget *parent)
 
   m_client = new PxtoneClient(&m_pxtn, m_connection_status, this);
   m_moo_clock = new MooClock(m_client);
+  auto apply_resample = [this]() {
+    m_client->controller()->setResample(Settings::SincResample::get()
+                                            ? pxtnRESAMPLE_sinc
+                                            : pxtnRESAMPLE_nearest);
+  };
+  apply_resample();
+  auto apply_lazy_woices = [this]() {
+    m_client->controller()->setLazyWoices(Settings::LazyWoiceLoading::get());
+  };
+  apply_lazy_woices();
 
   m_copy_options_dialog = new CopyOptionsDialog(m_client->clipboard(), this);
   m_new_woice_dialog = new NewWoiceDialog(true, m_client, this);
@@ -323,6 +341,9 @@ EditorWindow::EditorWindow(QWidget *parent)
           });
   connect(m_settings_dialog, &SettingsDialog::accepted, m_side_menu,
           &SideMenu::refreshVolumeMeterShowText);
+  connect(m_settings_dialog, &SettingsDialog::accepted, this, apply_resample);
+  connect(m_settings_dialog, &SettingsDialog::accepted, this,
+          apply_lazy_woices);
   connect(ui->actionClean, &QAction::triggered, [&]() {
     auto result =
         QMessageBox::question(this, tr("Clean units / voices"),
@@ -1097,10 +1118,10 @@ bool EditorWindow::save(bool forceSelectFilename) {
   return saved;
 }
 
-static QRegularExpression forbidden_filename_character_matcher("[\\/\"]+");
 void EditorWindow::render() {
   double length, fadeout, volume;
-  bool separate_units;
+  RenderFormat format;
+  pxtnSTEM stems;
   double secs_per_meas =
       m_pxtn.master->get_beat_num() / m_pxtn.master->get_beat_tempo() * 60;
   const pxtnMaster *m = m_pxtn.master;
@@ -1114,21 +1135,26 @@ void EditorWindow::render() {
     length = m_render_dialog->renderLength();
     fadeout = m_render_dialog->renderFadeout();
     volume = m_render_dialog->renderVolume();
-    separate_units = m_render_dialog->renderUnitsSeparately();
+    format = m_render_dialog->renderFormat();
+    if (m_render_dialog->renderUnitsSeparately())
+      stems = pxtnSTEM_unit;
+    else if (m_render_dialog->renderGroupsSeparately())
+      stems = pxtnSTEM_group;
+    else
+      stems = pxtnSTEM_none;
   } catch (QString &e) {
     QMessageBox::warning(this, tr("Render settings invalid"), e);
     return;
   }
 
-  std::vector<std::pair<QString, std::optional<int>>> filenames_and_units;
-  if (!separate_units) {
+  std::vector<QString> filenames;
+  if (stems == pxtnSTEM_none) {
     if (QFileInfo(m_render_dialog->renderDestination()).suffix() != "wav") {
       QMessageBox::warning(this, tr("Could not render"),
                            tr("Filename must end with .wav"));
       return;
     }
-    filenames_and_units.push_back(
-        {m_render_dialog->renderDestination(), std::nullopt});
+    filenames.push_back(m_render_dialog->renderDestination());
   } else {
     QFileInfo dir(m_render_dialog->renderDestination());
     if (!dir.isDir()) {
@@ -1136,56 +1162,45 @@ void EditorWindow::render() {
                            tr("Filename must be a directory"));
       return;
     }
-    for (int unit_no = 0; unit_no < m_pxtn.Unit_Num(); ++unit_no) {
-      QString unit_name = shift_jis_codec->toUnicode(
-          m_pxtn.Unit_Get(unit_no)->get_name_buf_jis(nullptr));
-      unit_name.remove(forbidden_filename_character_matcher);
-
-      QString unit = unit_name;
-      static const QString illegal = "\\/<>:\"|?*";
-      for (auto it : unit)
-        if (illegal.contains(it)) unit.replace(it, "_");
-      // mr clean magic eraser
-
-      QString filename = QString("%1/%2_%3.wav")
-                             .arg(dir.absoluteFilePath())
-                             .arg(unit_no)
-                             .arg(unit)
-                             .trimmed();  // smile
-
-      filenames_and_units.push_back({filename, unit_no});
-    }
+    filenames = PxtoneController::stemFilenames(&m_pxtn, stems,
+                                                dir.absoluteFilePath());
   }
-  constexpr int GRANULARITY = 1000;
-  QProgressDialog progress(tr("Rendering"), tr("Abort"), 0, GRANULARITY, this);
-  progress.setWindowModality(Qt::WindowModal);
-
-  uint num_tasks = filenames_and_units.size();
-  for (uint i = 0; i < num_tasks; ++i) {
-    const auto &[filename, solo_unit] = filenames_and_units[i];
-    QSaveFile file(filename);
-    if (!file.open(QIODevice::WriteOnly)) {
+  // Stems are all rendered together, so every file is open at once.
+  std::vector<std::unique_ptr<QSaveFile>> files;
+  std::vector<QIODevice *> devs;
+  for (const QString &filename : filenames) {
+    files.push_back(std::make_unique<QSaveFile>(filename));
+    if (!files.back()->open(QIODevice::WriteOnly)) {
       QMessageBox::warning(this, tr("Could not render"),
                            tr("Could not open file for rendering"));
       return;
     }
-    progress.setLabelText(tr("Rendering") +
-                          QString(" (%1/%2)").arg(i + 1).arg(num_tasks));
+    devs.push_back(files.back().get());
+  }
+
+  constexpr int GRANULARITY = 1000;
+  QProgressDialog progress(tr("Rendering"), tr("Abort"), 0, GRANULARITY, this);
+  progress.setWindowModality(Qt::WindowModal);
+  auto should_continue = [&](double p) {
+    progress.setValue(p * GRANULARITY);
+    return !progress.wasCanceled();
+  };
 
-    bool finished;
-    try {
+  bool finished;
+  try {
+    if (stems == pxtnSTEM_none)
       finished = m_client->controller()->render_exn(
-          &file, length, fadeout, volume, solo_unit, [&](double p) {
-            progress.setValue((p + i) * GRANULARITY / num_tasks);
-            return !progress.wasCanceled();
-          });
-    } catch (const QString &e) {
-      QMessageBox::warning(this, tr("Render error"), e);
-      finished = false;
-    }
-    if (!finished) return;
-    file.commit();
+          devs[0], length, fadeout, volume, format, std::nullopt,
+          should_continue);
+    else
+      finished = m_client->controller()->render_stems_exn(
+          devs, stems, length, fadeout, volume, format, should_continue);
+  } catch (const QString &e) {
+    QMessageBox::warning(this, tr("Render error"), e);
+    finished = false;
   }
+  if (!finished) return;
+  for (auto &file : files) file->commit();
   progress.close();
   QMessageBox::information(this, tr("Rendering done"), tr("Rendering done"));
 }
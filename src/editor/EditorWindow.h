@@ -19,6 +19,7 @@
 #include "ShortcutsDialog.h"
 #include "WelcomeDialog.h"
 #include "audio/PxtoneIODevice.h"
+#include "audio/PxtoneToneCache.h"
 #include "network/BroadcastServer.h"
 #include "network/Client.h"
 #include "pxtone/pxtnService.h"
@@ -57,6 +58,8 @@ class EditorWindow : public QMainWindow {
   void closeEvent(QCloseEvent* event) override;
   KeyboardView* m_keyboard_view;
   MeasureView* m_measure_view;
+  // Voices decoded in earlier sessions.
+  PxtoneToneCache m_tone_cache;
   pxtnService m_pxtn;
   EditorScrollArea *m_scroll_area, *m_param_scroll_area, *m_measure_scroll_area;
   QSplitter* m_splitter;
@@ -30,13 +30,22 @@ PxtoneClient::PxtoneClient(pxtnService *pxtn,
       m_last_seek(0),
       m_clipboard(new Clipboard(this)) {
   QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
-  if (!info.isFormatSupported(pxtoneAudioFormat())) {
+  // Float output isn't clipped until the device, if at all.
+  QAudioFormat format = pxtoneFloatAudioFormat();
+  pxtnSAMPLEFORMAT sample_format = pxtnSAMPLEFORMAT_float32;
+  if (!info.isFormatSupported(format)) {
+    format = pxtoneAudioFormat();
+    sample_format = pxtnSAMPLEFORMAT_int16;
+  }
+  if (!info.isFormatSupported(format)) {
     qWarning()
         << "Raw audio format not supported by backend, cannot play audio.";
     return;
   }
-  m_pxtn_device = new PxtoneIODevice(this, m_controller->pxtn(), &m_moo_state);
-  m_audio = new QAudioOutput(pxtoneAudioFormat(), this);
+  m_pxtn_device = new PxtoneIODevice(
+      this, m_controller->pxtn(), &m_moo_state, m_controller->mooMutex(),
+      sample_format, m_controller->renderCache());
+  m_audio = new QAudioOutput(format, this);
 
   // Apparently this reduces latency in pulseaudio, but also makes
   // some sounds choppier
@@ -44,6 +53,9 @@ PxtoneClient::PxtoneClient(pxtnService *pxtn,
   m_audio->setVolume(1.0);
   connect(m_pxtn_device, &PxtoneIODevice::playingChanged, this,
           &PxtoneClient::playStateChanged);
+  // Direct, so that it happens while the seek still holds the moo mutex.
+  connect(m_controller, &PxtoneController::seeked, m_pxtn_device,
+          &PxtoneIODevice::flush, Qt::DirectConnection);
 
   connect(m_ping_timer, &QTimer::timeout, [this]() {
     sendPlayState(false);
@@ -91,6 +103,8 @@ PxtoneClient::PxtoneClient(pxtnService *pxtn,
 PxtoneClient::~PxtoneClient() {
   m_audio->stop();
   m_pxtn_device->setPlaying(false);
+  // Stops the render thread before [m_moo_state] goes.
+  delete m_pxtn_device;
 }
 
 void PxtoneClient::loadDescriptor(pxtnDescriptor &desc) {
@@ -127,7 +141,7 @@ void PxtoneClient::loadDescriptor(pxtnDescriptor &desc) {
 void PxtoneClient::setBufferSize(double secs) {
   bool started = (m_audio->state() != QAudio::StoppedState &&
                   m_audio->state() != QAudio::IdleState);
-  QAudioFormat fmt = pxtoneAudioFormat();
+  QAudioFormat fmt = m_audio->format();
 
   if (started) {
     m_audio->stop();
@@ -143,6 +157,12 @@ void PxtoneClient::setBufferSize(double secs) {
 
 bool PxtoneClient::isPlaying() { return m_pxtn_device->playing(); }
 
+int32_t PxtoneClient::mooNowClock() const {
+  return m_pxtn_device->mooNowClock();
+}
+
+int PxtoneClient::mooNumLoop() const { return m_pxtn_device->mooNumLoop(); }
+
 // TODO: Factor this out into a PxtoneAudioPlayer class. Setting play state,
 // seeking. Unfortunately start / stop don't even fix this because stopping
 // still waits for the buffer to drain (instead of flushing and throwing away)
@@ -156,13 +176,13 @@ void PxtoneClient::togglePlayState() {
 }
 
 void PxtoneClient::sendPlayState(bool from_action) {
-  sendAction(PlayState{pxtn()->moo_get_now_clock(*moo()),
-                       m_pxtn_device->playing(), from_action});
+  sendAction(
+      PlayState{mooNowClock(), m_pxtn_device->playing(), from_action});
 }
 
 void PxtoneClient::resetAndSuspendAudio() {
   m_pxtn_device->setPlaying(false);
-  if (pxtn()->moo_get_now_clock(*moo()) > m_last_seek)
+  if (mooNowClock() > m_last_seek)
     seekMoo(m_last_seek);
   else
     seekMoo(0);
@@ -77,7 +77,11 @@ class PxtoneClient : public QObject {
   std::set<int> selectedUnitIds();
   const pxtnService *pxtn() const { return m_controller->pxtn(); }
   const EditState &editState() const { return m_edit_state; }
+  // Only for reading [params]. The rest changes on the render thread, so use
+  // mooNowClock / mooNumLoop instead.
   const mooState *moo() const { return m_controller->moo(); }
+  int32_t mooNowClock() const;
+  int mooNumLoop() const;
   const QAudioOutput *audioState() const { return m_audio; }
 
   const NoIdMap &unitIdMap() const { return m_controller->unitIdMap(); }
@@ -2,7 +2,16 @@
 
 #include <QDebug>
 #include <QDialog>
+#include <QRegularExpression>
 #include <QTextCodec>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "Settings.h"
+#include "audio/PxtoneSegmentRenderer.h"
 
 const QTextCodec *shift_jis_codec = QTextCodec::codecForName("Shift-JIS");
 
@@ -12,12 +21,34 @@ PxtoneController::PxtoneController(int uid, pxtnService *pxtn,
       m_uid(uid),
       m_pxtn(pxtn),
       m_moo_state(moo_state),
+      m_render_cache(std::make_unique<PxtoneRenderCache>(
+          pxtn, m_moo_mutex, &m_moo_checkpoints)),
       m_unit_id_map(pxtn->Unit_Num()),
       m_woice_id_map(pxtn->Woice_Num()),
-      m_remote_index(0) {}
+      m_remote_index(0),
+      m_moo_repeat_pending(false),
+      m_render_thread_num(QThread::idealThreadCount()),
+      m_resample(pxtnRESAMPLE_nearest),
+      m_lazy_woices(false) {
+  // Remake the state playback loops back to once a batch of edits is done,
+  // instead of in the audio callback at the loop point.
+  connect(this, &PxtoneController::edited, this,
+          &PxtoneController::prepareMooRepeat);
+}
+
+void PxtoneController::prepareMooRepeat() {
+  if (m_moo_repeat_pending) return;
+  m_moo_repeat_pending = true;
+  QTimer::singleShot(0, this, [this]() {
+    std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+    m_moo_repeat_pending = false;
+    m_pxtn->moo_prepare_repeat(*m_moo_state, &m_moo_checkpoints);
+  });
+}
 
 EditAction PxtoneController::applyLocalAction(
     const std::list<Action::Primitive> &action) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   bool widthChanged = false;
   m_uncommitted.push_back(Action::apply_and_get_undo(
       action, m_pxtn, &widthChanged, m_unit_id_map, m_woice_id_map));
@@ -32,6 +63,7 @@ void PxtoneController::setUid(qint64 uid) { m_uid = uid; }
 qint64 PxtoneController::uid() { return m_uid; }
 
 void PxtoneController::applyRemoteAction(const EditAction &action, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   // qDebug() << "Remote" << m_remote_index << "Local" << m_local_index;
   // qDebug() << "Received action" << action.idx << "from user" << uid;
   bool widthChanged = false;
@@ -130,6 +162,7 @@ exit_loop:
 }
 
 void PxtoneController::applyUndoRedo(const UndoRedo &r, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   qDebug() << "Applying undo / redo";
   if (m_log.size() == 0) {
     qDebug() << "No actions in the log. Doing nothing.";
@@ -212,6 +245,7 @@ bool auxSetUnitName(pxtnUnit *unit, QString name) {
 // thing is they'd have to be added to the log. And a record of a delete needs
 // to include the notes that were deleted with it.
 bool PxtoneController::applyAddUnit(const AddUnit &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   if (m_pxtn->Woice_Num() <= a.woice_no || a.woice_no < 0) {
     qWarning("Voice doesn't exist. (ID out of bounds)");
@@ -233,11 +267,10 @@ bool PxtoneController::applyAddUnit(const AddUnit &a, qint64 uid) {
   m_unit_id_map.add();
   int unit_no = m_pxtn->Unit_Num() - 1;
   auxSetUnitName(m_pxtn->Unit_Get_variable(unit_no), a.unit_name);
-  m_pxtn->evels->Record_Add_i(0, unit_no, EVENTKIND_VOICENO, a.woice_no,
-                              nullptr);
+  m_pxtn->evels->Record_Add_i(0, unit_no, EVENTKIND_VOICENO, a.woice_no);
   if (a.starting_volume != EVENTDEFAULT_VOLUME)
-    m_pxtn->evels->Record_Add_i(0, unit_no, EVENTKIND_VOLUME, a.starting_volume,
-                                nullptr);
+    m_pxtn->evels->Record_Add_i(0, unit_no, EVENTKIND_VOLUME,
+                                a.starting_volume);
   emit endAddUnit();
 
   emit edited();
@@ -245,6 +278,7 @@ bool PxtoneController::applyAddUnit(const AddUnit &a, qint64 uid) {
 }
 
 void PxtoneController::applyRemoveUnit(const RemoveUnit &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   auto unit_no_maybe = m_unit_id_map.idToNo(a.unit_id);
   if (unit_no_maybe == std::nullopt) {
@@ -261,6 +295,7 @@ void PxtoneController::applyRemoveUnit(const RemoveUnit &a, qint64 uid) {
   m_unit_id_map.remove(unit_no);
   if (m_moo_state->units.size() > size_t(unit_no))
     m_moo_state->units.erase(m_moo_state->units.begin() + unit_no);
+  m_moo_state->resetActiveUnits();
   emit endRemoveUnit();
 
   emit edited();
@@ -279,6 +314,7 @@ void PxtoneController::applySetUnitName(const SetUnitName &a, qint64 uid) {
 }
 
 void PxtoneController::applyMoveUnit(const MoveUnit &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   auto unit_no_maybe = m_unit_id_map.idToNo(a.unit_id);
   if (unit_no_maybe == std::nullopt) {
@@ -296,33 +332,39 @@ void PxtoneController::applyMoveUnit(const MoveUnit &a, qint64 uid) {
   m_pxtn->evels->Record_UnitNo_Replace(unit_no, new_unit_no);
   m_pxtn->Unit_Replace(unit_no, new_unit_no, *m_moo_state);
   m_unit_id_map.swapAdjacent(unit_no, new_unit_no);
+  m_render_cache->invalidate();
   emit endMoveUnit();
   emit edited();
 }
 
 bool PxtoneController::applyTempoChange(const TempoChange &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   if (a.tempo < 20 || a.tempo > 600) return false;
   m_pxtn->adjustTempo(a.tempo, *m_moo_state);
   for (int i = 0; i < m_pxtn->Delay_Num(); ++i)
     m_pxtn->Delay_ReadyTone(i, *m_moo_state);
+  m_render_cache->invalidate();
   emit tempoBeatChanged();
   emit edited();
   return true;
 }
 
 bool PxtoneController::applyBeatChange(const BeatChange &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   if (a.beat < 1 || a.beat > 16) return false;
   m_pxtn->adjustBeatNum(a.beat, *m_moo_state);
   for (int i = 0; i < m_pxtn->Delay_Num(); ++i)
     m_pxtn->Delay_ReadyTone(i, *m_moo_state);
+  m_render_cache->invalidate();
   emit tempoBeatChanged();
   emit edited();
   return true;
 }
 
 void PxtoneController::applySetRepeatMeas(const SetRepeatMeas &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   int m = a.meas.value_or(0);
   if (m >= m_pxtn->master->get_play_meas())
@@ -332,6 +374,7 @@ void PxtoneController::applySetRepeatMeas(const SetRepeatMeas &a, qint64 uid) {
 }
 
 void PxtoneController::applySetLastMeas(const SetLastMeas &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   int m = a.meas.value_or(0);
   if (m != 0 && m <= m_pxtn->master->get_repeat_meas())
@@ -341,14 +384,19 @@ void PxtoneController::applySetLastMeas(const SetLastMeas &a, qint64 uid) {
 }
 
 void PxtoneController::applyAddOverdrive(const OverdriveEffect::Add &, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   if (m_pxtn->OverDrive_Num() >= m_pxtn->OverDrive_Max()) return;
   emit beginAddOverdrive();
-  if (m_pxtn->OverDrive_Add(50, 2, 0)) emit edited();
+  if (m_pxtn->OverDrive_Add(50, 2, 0)) {
+    m_render_cache->invalidate();
+    emit edited();
+  }
   emit endAddOverdrive();
 }
 
 void PxtoneController::applySetOverdrive(const OverdriveEffect::Set &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
 
   // cut and amp are checked in OverDrive_Set so not checked here
@@ -356,20 +404,26 @@ void PxtoneController::applySetOverdrive(const OverdriveEffect::Set &a, qint64 u
       a.group >= m_pxtn->Group_Num() || a.group < 0)
     return;
   if (!m_pxtn->OverDrive_Set(a.ovdrv_no, a.cut, a.amp, a.group)) return;
+  m_render_cache->invalidate();
   emit overdriveChanged(a.ovdrv_no);
   emit edited();
 }
 
 void PxtoneController::applyRemoveOverdrive(const OverdriveEffect::Remove &a,
                                             qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   if (m_pxtn->OverDrive_Num() <= a.ovdrv_no) return;
   emit beginRemoveOverdrive(a.ovdrv_no);
-  if (m_pxtn->OverDrive_Remove(a.ovdrv_no)) emit edited();
+  if (m_pxtn->OverDrive_Remove(a.ovdrv_no)) {
+    m_render_cache->invalidate();
+    emit edited();
+  }
   emit endRemoveOverdrive();
 }
 
 void PxtoneController::applySetDelay(const DelayEffect::Set &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   if (a.freq > 1000 || a.freq <= 0.001 || a.rate > 100 || a.rate < 0 ||
       a.group >= m_pxtn->Group_Num() || a.group < 0 || a.unit > DELAYUNIT_max ||
@@ -377,34 +431,48 @@ void PxtoneController::applySetDelay(const DelayEffect::Set &a, qint64 uid) {
     return;
   if (!m_pxtn->Delay_Set(a.delay_no, a.unit, a.freq, a.rate, a.group)) return;
   m_pxtn->Delay_ReadyTone(a.delay_no, *m_moo_state);
+  m_render_cache->invalidate();
   emit delayChanged(a.delay_no);
   emit edited();
 }
 
 void PxtoneController::seekMoo(int64_t clock) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   pxtnVOMITPREPARATION prep{};
-  prep.flags |= pxtnVOMITPREPFLAG_loop | pxtnVOMITPREPFLAG_unit_mute;
+  prep.flags |= pxtnVOMITPREPFLAG_loop | pxtnVOMITPREPFLAG_unit_mute |
+                pxtnVOMITPREPFLAG_realtime;
   prep.start_pos_sample = clock * 60 * 44100 /
                           m_pxtn->master->get_beat_clock() /
                           m_pxtn->master->get_beat_tempo();
   prep.master_volume = m_moo_state->params.master_vol;
-  bool success = m_pxtn->moo_preparation(&prep, *m_moo_state);
+  prep.format = m_moo_state->params.format;
+  prep.resample = m_resample;
+  bool success =
+      m_pxtn->moo_preparation(&prep, *m_moo_state, &m_moo_checkpoints);
   if (!success) qWarning() << "Moo preparation error";
 
   emit seeked(clock);
 }
 
 void PxtoneController::refreshMoo() {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   seekMoo(m_pxtn->moo_get_now_clock(*m_moo_state));
 }
 
 void PxtoneController::setVolume(int volume) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   double v = volume / 100.0;
   double ampl = pow(25, v - 1);
   if (v < 0.1) ampl *= v / 0.1;
   m_moo_state->params.master_vol = ampl;
 }
 
+void PxtoneController::setResample(pxtnRESAMPLE resample) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+  m_resample = resample;
+  m_moo_state->params.resample = resample;
+}
+
 void PxtoneController::setSongTitle(const QString &title) {
   QByteArray str = shift_jis_codec->fromUnicode(title);
   m_pxtn->text->set_name_buf(str.data(), str.length());
@@ -416,6 +484,9 @@ void PxtoneController::setSongComment(const QString &comment) {
 }
 
 bool PxtoneController::loadDescriptor(pxtnDescriptor &desc) {
+  // Before locking, since it waits on a woice that takes the lock when done.
+  m_woice_loader.reset();
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   emit beginRefresh();
   if (desc.get_size_bytes() > 0) {
     if (m_pxtn->read(&desc) != pxtnOK) {
@@ -431,10 +502,23 @@ bool PxtoneController::loadDescriptor(pxtnDescriptor &desc) {
   }
   m_unit_id_map = NoIdMap(m_pxtn->Unit_Num());
   m_woice_id_map = NoIdMap(m_pxtn->Woice_Num());
-  if (m_pxtn->tones_ready(*m_moo_state) != pxtnOK) {
+  m_moo_checkpoints.clear();
+  m_moo_state->repeat_edits.reset();
+  m_render_cache->invalidate();
+  if (m_pxtn->tones_ready(*m_moo_state, m_render_thread_num, m_lazy_woices) !=
+      pxtnOK) {
     qWarning() << "Error getting tones ready";
     return false;
   }
+  if (m_lazy_woices)
+    m_woice_loader = std::make_unique<PxtoneWoiceLoader>(
+        m_pxtn, m_moo_state, m_moo_mutex, [this]() {
+          // Playback from before the woice was ready was silent.
+          m_moo_checkpoints.clear();
+          m_moo_state->repeat_edits.reset();
+          m_render_cache->invalidate();
+          QMetaObject::invokeMethod(this, [this]() { prepareMooRepeat(); });
+        });
 
   // Fill delay eagerly so it's simpler to edit
   // You can't add a 'noop' overdrive unfortunately
@@ -449,6 +533,7 @@ bool PxtoneController::loadDescriptor(pxtnDescriptor &desc) {
 }
 
 bool PxtoneController::applyAddWoice(const AddWoice &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   pxtnDescriptor d;
   d.set_memory_r(a.data.constData(), a.data.size());
@@ -474,6 +559,7 @@ bool PxtoneController::applyAddWoice(const AddWoice &a, qint64 uid) {
 }
 
 bool PxtoneController::applyRemoveWoice(const RemoveWoice &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   auto woice_no_maybe = m_woice_id_map.idToNo(a.woice_id);
   if (woice_no_maybe == std::nullopt) {
@@ -501,6 +587,7 @@ bool PxtoneController::applyRemoveWoice(const RemoveWoice &a, qint64 uid) {
 }
 
 bool PxtoneController::applyChangeWoice(const ChangeWoice &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   auto woice_no_maybe = m_woice_id_map.idToNo(a.remove.woice_id);
   if (woice_no_maybe == std::nullopt) {
@@ -524,12 +611,16 @@ bool PxtoneController::applyChangeWoice(const ChangeWoice &a, qint64 uid) {
       name_str.data(),
       std::min(pxtnMAX_TUNEWOICENAME, int32_t(name_str.length())));
   m_pxtn->Woice_ReadyTone(woice);
+  m_moo_checkpoints.clear();
+  m_moo_state->repeat_edits.reset();
+  m_render_cache->invalidate();
   emit woiceEdited(woice_no);
   emit edited();
   return true;
 }
 
 bool PxtoneController::applyWoiceSet(const Woice::Set &a, qint64 uid) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   (void)uid;
   std::shared_ptr<pxtnWoice> woice = m_pxtn->Woice_Get_variable(a.id);
   if (woice == nullptr) return false;
@@ -569,15 +660,20 @@ bool PxtoneController::applyWoiceSet(const Woice::Set &a, qint64 uid) {
                           }},
                a.setting);
   }
+  m_moo_checkpoints.clear();
+  m_moo_state->repeat_edits.reset();
+  m_render_cache->invalidate();
   emit woiceEdited(a.id);
   emit edited();
   return true;
 }
 
 void PxtoneController::setUnitPlayed(int unit_no, bool played) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   pxtnUnit *u = m_pxtn->Unit_Get_variable(unit_no);
   if (!u) return;
   u->set_played(played);
+  m_render_cache->invalidate();
   emit playedToggled(unit_no);
 }
 void PxtoneController::setUnitVisible(int unit_no, bool visible) {
@@ -596,6 +692,7 @@ void PxtoneController::setUnitOperated(int unit_no, bool operated) {
 // selected units are playing, unmute everything. Else mute everything but
 // this unit.
 void PxtoneController::cycleSolo(int solo_unit_no) {
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
   pxtnUnit *solo_u = m_pxtn->Unit_Get_variable(solo_unit_no);
   if (!solo_u) return;
 
@@ -622,6 +719,7 @@ void PxtoneController::cycleSolo(int solo_unit_no) {
       m_pxtn->Unit_Get_variable(i)->set_played(u == solo_u);
     }
   }
+  m_render_cache->invalidate();
   emit soloToggled();
 }
 
@@ -631,7 +729,10 @@ struct WavHdr {
   constexpr static quint32 k_riff_id = 0x46464952;
   constexpr static quint32 k_wave_format = 0x45564157;
   constexpr static quint32 k_fmt_id = 0x20746d66;
+  constexpr static quint32 k_fact_id = 0x74636166;
   constexpr static quint32 k_data_id = 0x61746164;
+  constexpr static quint16 k_format_pcm = 1;
+  constexpr static quint16 k_format_float = 3;
   // RIFF
   quint32 chunk_id = k_riff_id;
   quint32 chunk_size;
@@ -645,6 +746,11 @@ struct WavHdr {
   quint32 byte_rate;
   quint16 block_align;
   quint16 bits_per_sample;
+  quint16 ext_size = 0;  // Only for formats other than PCM.
+  // fact, only for formats other than PCM
+  quint32 fact_id = k_fact_id;
+  quint32 fact_size = 4;
+  quint32 frame_num;
   // data
   quint32 data_id = k_data_id;
   quint32 data_size;
@@ -656,77 +762,225 @@ bool write(QIODevice *dev, const WavHdr &h) {
   s << h.chunk_id << h.chunk_size << h.chunk_format;
   s << h.fmt_id << h.fmt_size << h.audio_format << h.num_channels
     << h.sample_rate << h.byte_rate << h.block_align << h.bits_per_sample;
+  if (h.audio_format != WavHdr::k_format_pcm) {
+    s << h.ext_size;
+    s << h.fact_id << h.fact_size << h.frame_num;
+  }
   s << h.data_id << h.data_size;
   return s.status() == QDataStream::Ok;
 }
 
-// TODO: This kind of file-writing is duplicated a bunch.
+static QRegularExpression forbidden_filename_character_matcher("[\\/\"]+");
+std::vector<QString> PxtoneController::stemFilenames(const pxtnService *pxtn,
+                                                     pxtnSTEM stems,
+                                                     const QString &dir) {
+  std::vector<QString> filenames;
+  if (stems == pxtnSTEM_group) {
+    for (int group_no = 0; group_no < pxtn->Group_Num(); ++group_no)
+      filenames.push_back(QString("%1/group_%2.wav").arg(dir).arg(group_no));
+    return filenames;
+  }
+  for (int unit_no = 0; unit_no < pxtn->Unit_Num(); ++unit_no) {
+    QString unit_name = shift_jis_codec->toUnicode(
+        pxtn->Unit_Get(unit_no)->get_name_buf_jis(nullptr));
+    unit_name.remove(forbidden_filename_character_matcher);
+
+    QString unit = unit_name;
+    static const QString illegal = "\\/<>:\"|?*";
+    for (auto it : unit)
+      if (illegal.contains(it)) unit.replace(it, "_");
+    // mr clean magic eraser
+
+    QString filename = QString("%1/%2_%3.wav")
+                           .arg(dir)
+                           .arg(unit_no)
+                           .arg(unit)
+                           .trimmed();  // smile
+
+    filenames.push_back(filename);
+  }
+  return filenames;
+}
+
 bool PxtoneController::render_exn(
     QIODevice *dev, double secs, double fadeout, double volume,
-    std::optional<size_t> solo_unit,
+    RenderFormat format, std::optional<size_t> solo_unit,
+    std::function<bool(double progress)> should_continue) const {
+  pxtnVOMITPREPARATION prep{};
+  prep.flags |= pxtnVOMITPREPFLAG_loop | pxtnVOMITPREPFLAG_unit_mute;
+  prep.master_volume = volume;
+  prep.solo_unit = solo_unit;
+  return render_devices_exn({dev}, prep, format, secs, fadeout,
+                            should_continue);
+}
+
+bool PxtoneController::render_stems_exn(
+    const std::vector<QIODevice *> &devs, pxtnSTEM stems, double secs,
+    double fadeout, double volume, RenderFormat format,
+    std::function<bool(double progress)> should_continue) const {
+  // Units are soloed regardless of being muted, as with solo_unit.
+  pxtnVOMITPREPARATION prep{};
+  prep.flags |= pxtnVOMITPREPFLAG_loop;
+  prep.master_volume = volume;
+  prep.stems = stems;
+  return render_devices_exn(devs, prep, format, secs, fadeout,
+                            should_continue);
+}
+
+// How long each segment of a parallel render is.
+constexpr double RENDER_SEGMENT_SECS = 20;
+
+// Packs [num] float samples (see pxtnSAMPLEFORMAT_float32) into 24-bit little
+// endian PCM, clipping.
+static void pack_int24(const float *src, int num, char *dst) {
+  for (int i = 0; i < num; ++i) {
+    float v = std::round(src[i] * 8388608.f);
+    int32_t s = int32_t(std::clamp(v, -8388608.f, 8388607.f));
+    *dst++ = char(s);
+    *dst++ = char(s >> 8);
+    *dst++ = char(s >> 16);
+  }
+}
+
+bool PxtoneController::render_devices_exn(
+    const std::vector<QIODevice *> &devs, pxtnVOMITPREPARATION prep,
+    RenderFormat format, double secs, double fadeout,
     std::function<bool(double progress)> should_continue) const {
-  qDebug() << "Rendering" << secs << fadeout;
+  mooState moo_state;
+  pxtnERR err;
+  {
+    // Readies the woices a background load hasn't got to yet too.
+    std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+    err = m_pxtn->tones_ready(moo_state, m_render_thread_num);
+  }
+  if (err != pxtnOK)
+    throw QString("Error getting tones ready: error code %1").arg(err);
+  prep.thread_num = m_render_thread_num;
+  prep.resample = m_resample;
+  return render_devices_exn(m_pxtn, moo_state, devs, prep, format, secs,
+                            fadeout, should_continue);
+}
+
+// TODO: This kind of file-writing is duplicated a bunch.
+bool PxtoneController::render_devices_exn(
+    const pxtnService *pxtn, mooState &moo_state,
+    const std::vector<QIODevice *> &devs, pxtnVOMITPREPARATION prep,
+    RenderFormat format, double secs, double fadeout,
+    std::function<bool(double progress)> should_continue) {
+  qDebug() << "Rendering" << secs << fadeout << devs.size();
   WavHdr h;
-  h.fmt_size = 16;
-  h.audio_format = 1;
+  h.audio_format = (format == RenderFormat::Float32 ? WavHdr::k_format_float
+                                                    : WavHdr::k_format_pcm);
+  h.fmt_size = (h.audio_format == WavHdr::k_format_pcm ? 16 : 18);
   int num_channels, sample_rate;
-  m_pxtn->get_destination_quality(&num_channels, &sample_rate);
+  pxtn->get_destination_quality(&num_channels, &sample_rate);
   h.num_channels = num_channels;
   h.sample_rate = sample_rate;
-  h.bits_per_sample = 16;
+  switch (format) {
+    case RenderFormat::Int16:
+      h.bits_per_sample = 16;
+      break;
+    case RenderFormat::Int24:
+      h.bits_per_sample = 24;
+      break;
+    case RenderFormat::Float32:
+      h.bits_per_sample = 32;
+      break;
+  }
   h.block_align = h.num_channels * h.bits_per_sample / 8;
   h.byte_rate = h.sample_rate * h.num_channels * h.bits_per_sample / 8;
 
   int num_samples = int(h.sample_rate * secs);
   if (fadeout > 0) num_samples += int(h.sample_rate * fadeout) + 10;
   h.data_size = num_samples * h.num_channels * h.bits_per_sample / 8;
-  h.chunk_size = h.data_size + 36;
+  h.frame_num = num_samples;
+  h.chunk_size = 4 + 8 + h.fmt_size + 8 + h.data_size;
+  if (h.audio_format != WavHdr::k_format_pcm) h.chunk_size += 8 + h.fact_size;
 
-  mooState moo_state;
-  pxtnERR err;
-  err = m_pxtn->tones_ready(moo_state);
-  if (err != pxtnOK)
-    throw QString("Error getting tones ready: error code %1").arg(err);
-
-  pxtnVOMITPREPARATION prep{};
-  prep.flags |= pxtnVOMITPREPFLAG_loop | pxtnVOMITPREPFLAG_unit_mute;
   prep.start_pos_sample = 0;
-  prep.master_volume = volume;
-  prep.solo_unit = solo_unit;
-  bool success = m_pxtn->moo_preparation(&prep, moo_state);
+  // 24-bit is packed from the float mix, so only clipped once.
+  prep.format = (format == RenderFormat::Int16 ? pxtnSAMPLEFORMAT_int16
+                                               : pxtnSAMPLEFORMAT_float32);
+  const int moo_byte_per_smp = pxtn->get_byte_per_smp(prep.format);
+  bool success = pxtn->moo_preparation(&prep, moo_state);
   if (!success) throw QString("Error preparing moo");
-
-  write(dev, h);
+  if (prep.stems != pxtnSTEM_none &&
+      size_t(pxtn->moo_get_stem_num(moo_state)) != devs.size())
+    throw QString("Expected %1 files to render into, got %2")
+        .arg(pxtn->moo_get_stem_num(moo_state))
+        .arg(devs.size());
+
+  for (QIODevice *dev : devs) write(dev, h);
+  // In bytes of the file, which aren't the same as mooed bytes for 24-bit.
   int written = 0;
+  std::vector<char> packed;
+  auto write_dev = [&](QIODevice *dev, const char *buf, int len) {
+    if (format == RenderFormat::Int24) {
+      int num = len / int(sizeof(float));
+      packed.resize(num * 3);
+      pack_int24(reinterpret_cast<const float *>(buf), num, packed.data());
+      buf = packed.data();
+      len = int(packed.size());
+    }
+    qint64 written_this_time = dev->write(buf, len);
+    if (written_this_time < len) {
+      throw QString(
+          "Could not write all bytes into device this cycle (wrote %1 / %2). "
+          "Total bytes written so far: %3")
+          .arg(written_this_time)
+          .arg(len)
+          .arg(written);
+    }
+  };
+  // Stems are all rendered in one pass, a buffer each.
+  constexpr int SIZE = 4096;
+  std::vector<std::array<char, SIZE>> bufs(devs.size());
+  std::vector<void *> p_bufs;
+  for (auto &buf : bufs) p_bufs.push_back(buf.data());
   auto render = [&](int len) {
-    constexpr int SIZE = 4096;
-    char buf[SIZE];
     while (written < len) {
-      int mooed_len;
-      if (!m_pxtn->Moo(moo_state, buf, int32_t(std::min(len - written, SIZE)),
-                       &mooed_len))
+      int mooed_len = std::min((len - written) / h.block_align,
+                               SIZE / moo_byte_per_smp) *
+                      moo_byte_per_smp;
+      bool mooed;
+      if (prep.stems == pxtnSTEM_none)
+        mooed = pxtn->Moo(moo_state, p_bufs[0], mooed_len, &mooed_len);
+      else
+        mooed = pxtn->Moo_Stems(moo_state, p_bufs.data(), mooed_len);
+      if (!mooed)
         throw QString("Moo error during rendering. Bytes written so far: %1")
             .arg(written);
-      qint64 written_this_time = dev->write(buf, mooed_len);
-      if (written_this_time < mooed_len) {
-        throw QString(
-            "Could not write all bytes into device this cycle (wrote %1 / %2). "
-            "Total bytes written so far: ")
-            .arg(written_this_time)
-            .arg(mooed_len)
-            .arg(written);
-      }
+      for (size_t i = 0; i < devs.size(); ++i)
+        write_dev(devs[i], bufs[i].data(), mooed_len);
       if (!should_continue((0.0 + written) / h.data_size)) return false;
 
-      written += mooed_len;
+      written += mooed_len / moo_byte_per_smp * h.block_align;
     }
     return true;
   };
 
-  if (!render(int(h.sample_rate * secs) * h.num_channels * h.bits_per_sample /
-              8))
+  // Long renders are split into segments rendered side by side. Stems are
+  // already rendered a unit per thread.
+  int32_t body_smp_num = int32_t(h.sample_rate * secs);
+  int32_t segment_smp_num = int32_t(h.sample_rate * RENDER_SEGMENT_SECS);
+  if (prep.stems == pxtnSTEM_none && prep.thread_num > 1 &&
+      body_smp_num >= 2 * segment_smp_num) {
+    PxtoneSegmentRenderer segments(
+        pxtn, prep.thread_num, segment_smp_num,
+        int32_t(h.sample_rate * Settings::RenderPrerollSecs::get()));
+    if (!segments.render(moo_state, prep, body_smp_num,
+                         [&](const char *buf, int32_t len) {
+                           write_dev(devs[0], buf, len);
+                           written += len / moo_byte_per_smp * h.block_align;
+                           return should_continue((0.0 + written) /
+                                                  h.data_size);
+                         }))
+      return false;
+    qDebug() << "Segments rendered again:" << segments.rerenderedNum() << "of"
+             << segments.seekedNum();
+  } else if (!render(body_smp_num * h.block_align))
     return false;
-  m_pxtn->moo_set_fade(-1, fadeout, moo_state);
+  pxtn->moo_set_fade(-1, fadeout, moo_state);
   if (!render(h.data_size)) return false;
 
   return true;
@@ -3,8 +3,11 @@
 #include <QObject>
 #include <QTextCodec>
 #include <list>
+#include <mutex>
 
 #include "audio/PxtoneIODevice.h"
+#include "audio/PxtoneRenderCache.h"
+#include "audio/PxtoneWoiceLoader.h"
 #include "protocol/PxtoneEditAction.h"
 #include "protocol/RemoteAction.h"
 
@@ -23,6 +26,9 @@ struct LoggedAction {
       : state(DONE), uid(uid), idx(idx), reverse(reverse) {}
 };
 
+// What renders are written as. 24-bit is packed from the float mix.
+enum class RenderFormat { Int16, Int24, Float32 };
+
 class PxtoneController : public QObject {
   Q_OBJECT
  public:
@@ -46,8 +52,13 @@ class PxtoneController : public QObject {
   void seekMoo(int64_t clock);
   void refreshMoo();
   const mooState *moo() { return m_moo_state; }
+  // Held while changing anything moo reads. See PxtoneIODevice.
+  std::recursive_mutex &mooMutex() { return m_moo_mutex; }
+  PxtoneRenderCache *renderCache() { return m_render_cache.get(); }
   const pxtnService *pxtn() { return m_pxtn; };
   void setVolume(int volume);
+  // How voices are read between samples, in playback and renders.
+  void setResample(pxtnRESAMPLE resample);
   void setSongTitle(const QString &);
   void setSongComment(const QString &);
 
@@ -57,10 +68,35 @@ class PxtoneController : public QObject {
   void cycleSolo(int unit_no);
   bool render_exn(
       QIODevice *file, double secs, double fadeout, double volume,
-      std::optional<size_t> solo_unit,
+      RenderFormat format, std::optional<size_t> solo_unit,
+      std::function<bool(double progress)> should_continue = [](double) {
+        return true;
+      }) const;
+  // Where to render each stem to in [dir].
+  static std::vector<QString> stemFilenames(const pxtnService *pxtn,
+                                            pxtnSTEM stems, const QString &dir);
+  // How many threads renders use. Defaults to one per core.
+  void setRenderThreadNum(int thread_num) { m_render_thread_num = thread_num; }
+  // Whether loaded songs play before their woices are all ready, with the
+  // rest readied in the background. Renders always wait for every woice.
+  void setLazyWoices(bool lazy) { m_lazy_woices = lazy; }
+  // Renders each stem into its own device in [devs], in one pass over the
+  // song. There should be as many devices as units or groups.
+  bool render_stems_exn(
+      const std::vector<QIODevice *> &devs, pxtnSTEM stems, double secs,
+      double fadeout, double volume, RenderFormat format,
       std::function<bool(double progress)> should_continue = [](double) {
         return true;
       }) const;
+  // Renders [pxtn] into [devs] as [prep] says, from [moo_state] with its tones
+  // ready. For renders without a controller, e.g., batch renders.
+  static bool render_devices_exn(
+      const pxtnService *pxtn, mooState &moo_state,
+      const std::vector<QIODevice *> &devs, pxtnVOMITPREPARATION prep,
+      RenderFormat format, double secs, double fadeout,
+      std::function<bool(double progress)> should_continue = [](double) {
+        return true;
+      });
 
  public slots:
   // Maybe these types could be grouped.
@@ -114,15 +150,34 @@ class PxtoneController : public QObject {
   void endMoveUnit();
 
  private:
+  bool render_devices_exn(
+      const std::vector<QIODevice *> &devs, pxtnVOMITPREPARATION prep,
+      RenderFormat format, double secs, double fadeout,
+      std::function<bool(double progress)> should_continue) const;
+  void prepareMooRepeat();
+
   qint64 m_uid;
   pxtnService *m_pxtn;
   mooState *m_moo_state;
+  mutable std::recursive_mutex m_moo_mutex;
+  // Makes seeking in long songs quick. Needs a clear() after edits that change
+  // how events play other than edits to the events themselves.
+  mooCheckpoints m_moo_checkpoints;
+  // Needs an invalidate() after edits that change how the song sounds other
+  // than edits to the events.
+  std::unique_ptr<PxtoneRenderCache> m_render_cache;
+  // Only while a lazily loaded song has woices left to ready.
+  std::unique_ptr<PxtoneWoiceLoader> m_woice_loader;
   PxtoneIODevice *m_moo_io_device;
 
   std::vector<LoggedAction> m_log;
   std::list<std::list<Action::Primitive>> m_uncommitted;
   NoIdMap m_unit_id_map, m_woice_id_map;
   int m_remote_index;
+  bool m_moo_repeat_pending;
+  int m_render_thread_num;
+  pxtnRESAMPLE m_resample;
+  bool m_lazy_woices;
 };
 
 const extern QTextCodec *shift_jis_codec;
@@ -3,6 +3,7 @@
 #include <QDoubleValidator>
 #include <QFileDialog>
 
+#include "PxtoneController.h"
 #include "Settings.h"
 #include "ui_RenderDialog.h"
 
@@ -16,7 +17,7 @@ RenderDialog::RenderDialog(QWidget *parent)
   ui->saveToEdit->setText(Settings::RenderFileDestination::get());
 
   connect(ui->saveToBtn, &QPushButton::pressed, this, [this]() {
-    if (!renderUnitsSeparately()) {
+    if (ui->renderSingleFileRadio->isChecked()) {
       QString filename = QFileDialog::getSaveFileName(
           this, "Render to file", Settings::RenderFileDestination::get(),
           tr("WAV file (*.wav)"));
@@ -25,25 +26,27 @@ RenderDialog::RenderDialog(QWidget *parent)
       ui->saveToEdit->setText(filename);
     } else {
       QString filename = QFileDialog::getExistingDirectory(
-          this, "Render units to directory",
+          this,
+          renderGroupsSeparately() ? "Render groups to directory"
+                                   : "Render units to directory",
           Settings::RenderDirectoryDestination::get());
       ui->saveToEdit->setText(QFileInfo(filename).absoluteFilePath());
     }
   });
 
-  connect(ui->renderSeparateUnitsRadio, &QRadioButton::toggled, this,
-          [this](bool separate_units) {
+  connect(ui->renderSingleFileRadio, &QRadioButton::toggled, this,
+          [this](bool single_file) {
             ui->saveToEdit->setText(
-                separate_units ? Settings::RenderDirectoryDestination::get()
-                               : Settings::RenderFileDestination::get());
+                single_file ? Settings::RenderFileDestination::get()
+                            : Settings::RenderDirectoryDestination::get());
           });
 
   connect(this, &QDialog::accepted, [this]() {
     const QString &text = ui->saveToEdit->text();
-    if (renderUnitsSeparately())
-      Settings::RenderDirectoryDestination::set(text);
-    else
+    if (ui->renderSingleFileRadio->isChecked())
       Settings::RenderFileDestination::set(text);
+    else
+      Settings::RenderDirectoryDestination::set(text);
   });
 }
 
@@ -87,8 +90,23 @@ double RenderDialog::renderVolume() {
   return v;
 }
 
+RenderFormat RenderDialog::renderFormat() {
+  switch (ui->formatCombo->currentIndex()) {
+    case 1:
+      return RenderFormat::Int24;
+    case 2:
+      return RenderFormat::Float32;
+    default:
+      return RenderFormat::Int16;
+  }
+}
+
 bool RenderDialog::renderUnitsSeparately() {
   return ui->renderSeparateUnitsRadio->isChecked();
 }
 
+bool RenderDialog::renderGroupsSeparately() {
+  return ui->renderSeparateGroupsRadio->isChecked();
+}
+
 QString RenderDialog::renderDestination() { return ui->saveToEdit->text(); }
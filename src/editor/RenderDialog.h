@@ -6,6 +6,7 @@
 namespace Ui {
 class RenderDialog;
 }
+enum class RenderFormat;
 
 class RenderDialog : public QDialog {
   Q_OBJECT
@@ -20,7 +21,9 @@ class RenderDialog : public QDialog {
   double renderLength();
   double renderFadeout();
   double renderVolume();
+  RenderFormat renderFormat();
   bool renderUnitsSeparately();
+  bool renderGroupsSeparately();
   QString renderDestination();
 
  private:
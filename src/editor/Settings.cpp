@@ -167,6 +167,12 @@ QString get() { return value(KEY, "").toString(); }
 void set(QString value) { setValue(KEY, value); }
 }  // namespace RenderDirectoryDestination
 
+namespace RenderPrerollSecs {
+const char *KEY = "render_preroll_secs";
+double get() { return value(KEY, 4.0).toDouble(); }
+void set(double value) { setValue(KEY, value); }
+}  // namespace RenderPrerollSecs
+
 namespace StyleName {
 const char *KEY = "style_name";
 const char *default_included_with_distribution = "ptCollage";
@@ -341,6 +347,18 @@ bool get() { return value(KEY, true).toBool(); }
 void set(bool value) { return setValue(KEY, value); }
 }  // namespace VelocitySensitivity
 
+namespace SincResample {
+const char *KEY = "sinc_resample";
+bool get() { return value(KEY, false).toBool(); }
+void set(bool value) { return setValue(KEY, value); }
+}  // namespace SincResample
+
+namespace LazyWoiceLoading {
+const char *KEY = "lazy_voice_loading";
+bool get() { return value(KEY, false).toBool(); }
+void set(bool value) { return setValue(KEY, value); }
+}  // namespace LazyWoiceLoading
+
 namespace DisplayScale {
 const char *KEY = "display_scale";
 int get() { return std::max(1, value(KEY, 1).toInt()); }
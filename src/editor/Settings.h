@@ -99,6 +99,13 @@ QString get();
 void set(QString);
 }  // namespace RenderDirectoryDestination
 
+// How far before each segment of a parallel render to start from, so that
+// delays and note releases have settled.
+namespace RenderPrerollSecs {
+double get();
+void set(double);
+}  // namespace RenderPrerollSecs
+
 namespace StyleName {
 extern const char *default_included_with_distribution;
 QString get();
@@ -214,6 +221,18 @@ bool get();
 void set(bool);
 }  // namespace VelocitySensitivity
 
+// Read voices with sinc interpolation instead of pxtone's nearest sample.
+namespace SincResample {
+bool get();
+void set(bool);
+}  // namespace SincResample
+
+// Play songs as soon as they're opened, readying voices in the background.
+namespace LazyWoiceLoading {
+bool get();
+void set(bool);
+}  // namespace LazyWoiceLoading
+
 namespace DisplayScale {
 int get();
 void set(int);
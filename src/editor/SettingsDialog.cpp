@@ -48,6 +48,8 @@ void SettingsDialog::apply() {
       ui->selectPinnedUnitOnClickCheck->isChecked());
   Settings::StrictFollowSeek::set(ui->followSeekStrictCheck->isChecked());
   Settings::VelocitySensitivity::set(ui->velocitySensitivityCheck->isChecked());
+  Settings::SincResample::set(ui->sincResampleCheck->isChecked());
+  Settings::LazyWoiceLoading::set(ui->lazyWoiceLoadingCheck->isChecked());
   Settings::DisplayScale::set(ui->displayScaleSpin->value());
   Settings::LeftPianoWidth::set(ui->leftPianoWidthSpin->value());
   if (ui->alternateTuningCheck->isChecked()) {
@@ -102,6 +104,8 @@ void SettingsDialog::showEvent(QShowEvent *) {
   ui->leftPianoWidthSpin->setValue(Settings::LeftPianoWidth::get());
   ui->recordMidiCheck->setChecked(Settings::RecordMidi::get());
   ui->followSeekStrictCheck->setChecked(Settings::StrictFollowSeek::get());
+  ui->sincResampleCheck->setChecked(Settings::SincResample::get());
+  ui->lazyWoiceLoadingCheck->setChecked(Settings::LazyWoiceLoading::get());
   ui->velocitySensitivityCheck->setChecked(
       Settings::VelocitySensitivity::get());
 
@@ -1,19 +1,25 @@
 #include "AudioFormat.h"
 
-static QAudioFormat make() {
+static QAudioFormat make(bool is_float) {
   QAudioFormat format;
   int channel_num = 2;
   int sample_rate = 44100;
   format.setSampleRate(sample_rate);
   format.setChannelCount(channel_num);
-  format.setSampleSize(16);  // Fixed in pxtone
+  format.setSampleSize(is_float ? 32 : 16);
   format.setCodec("audio/pcm");
   format.setByteOrder(QAudioFormat::LittleEndian);
-  format.setSampleType(QAudioFormat::SignedInt);
+  format.setSampleType(is_float ? QAudioFormat::Float
+                                : QAudioFormat::SignedInt);
   return format;
 }
 
 QAudioFormat pxtoneAudioFormat() {
-  static QAudioFormat format = make();
+  static QAudioFormat format = make(false);
+  return format;
+}
+
+QAudioFormat pxtoneFloatAudioFormat() {
+  static QAudioFormat format = make(true);
   return format;
 }
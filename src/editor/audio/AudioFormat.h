@@ -3,5 +3,7 @@
 #include <QAudioFormat>
 
 extern QAudioFormat pxtoneAudioFormat();
+// The same, as pxtnSAMPLEFORMAT_float32.
+extern QAudioFormat pxtoneFloatAudioFormat();
 
 #endif  // AUDIOFORMAT_H
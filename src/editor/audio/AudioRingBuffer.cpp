@@ -0,0 +1,44 @@
+#include "AudioRingBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+AudioRingBuffer::AudioRingBuffer(size_t size)
+    : m_data(size), m_written(0), m_read(0) {}
+
+size_t AudioRingBuffer::writable() const {
+  return m_data.size() - (m_written.load(std::memory_order_relaxed) -
+                          m_read.load(std::memory_order_acquire));
+}
+
+size_t AudioRingBuffer::write(const char *data, size_t len) {
+  size_t written = m_written.load(std::memory_order_relaxed);
+  len = std::min(len, writable());
+  size_t start = written % m_data.size();
+  size_t first = std::min(len, m_data.size() - start);
+  memcpy(m_data.data() + start, data, first);
+  memcpy(m_data.data(), data + first, len - first);
+  m_written.store(written + len, std::memory_order_release);
+  return len;
+}
+
+size_t AudioRingBuffer::readable() const {
+  return m_written.load(std::memory_order_acquire) -
+         m_read.load(std::memory_order_relaxed);
+}
+
+size_t AudioRingBuffer::read(char *data, size_t len) {
+  size_t read = m_read.load(std::memory_order_relaxed);
+  len = std::min(len, readable());
+  size_t start = read % m_data.size();
+  size_t first = std::min(len, m_data.size() - start);
+  memcpy(data, m_data.data() + start, first);
+  memcpy(data + first, m_data.data(), len - first);
+  m_read.store(read + len, std::memory_order_release);
+  return len;
+}
+
+void AudioRingBuffer::clear() {
+  m_read.store(m_written.load(std::memory_order_acquire),
+               std::memory_order_release);
+}
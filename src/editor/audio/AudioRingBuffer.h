@@ -0,0 +1,29 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// A lock-free byte queue between one writer thread and one reader thread.
+class AudioRingBuffer {
+  std::vector<char> m_data;
+  // Total bytes written / read so far. Only the writer changes [m_written] and
+  // only the reader changes [m_read].
+  std::atomic<size_t> m_written, m_read;
+
+ public:
+  AudioRingBuffer(size_t size);
+
+  // Writer side.
+  size_t writable() const;
+  size_t write(const char *data, size_t len);
+
+  // Reader side.
+  size_t readable() const;
+  size_t read(char *data, size_t len);
+  // Drops everything written so far.
+  void clear();
+};
+
+#endif  // AUDIORINGBUFFER_H
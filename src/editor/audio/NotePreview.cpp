@@ -42,7 +42,8 @@ NotePreview::NotePreview(const pxtnService *pxtn, const mooParams *moo_params,
   } else {
     m_moo_state = std::make_unique<mooState>();
     pxtnVOMITPREPARATION prep{};
-    prep.flags |= pxtnVOMITPREPFLAG_loop | pxtnVOMITPREPFLAG_unit_mute;
+    prep.flags |= pxtnVOMITPREPFLAG_loop | pxtnVOMITPREPFLAG_unit_mute |
+                  pxtnVOMITPREPFLAG_realtime;
     prep.start_pos_sample = clock * 60 * 44100 /
                             m_pxtn->master->get_beat_clock() /
                             m_pxtn->master->get_beat_tempo();
@@ -75,6 +76,8 @@ NotePreview::NotePreview(const pxtnService *pxtn, const mooParams *moo_params,
           tone->life_count = duration + woice->get_instance(i)->env_release;
         }
       }
+      // Played on the audio thread, so decoded ahead on another.
+      u->Tone_Open_Streams(true);
     }
   }
 
@@ -111,6 +114,7 @@ void NotePreview::resetOn(int duration) {
     tone->on_count = duration;
     tone->life_count = duration + woice->get_instance(i)->env_release;
   }
+  m_this_unit->Tone_Open_Streams(true);
 }
 
 static EVERECORD ev(int32_t clock, EVENTKIND kind, int32_t value) {
@@ -1,19 +1,78 @@
 #include "PxtoneIODevice.h"
 
 #include <QDebug>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// How far ahead the render thread renders, and how much at a time in samples.
+// Edits are heard this much later than before. It covers the render thread
+// being kept from the moo mutex by the render cache, which was up to 60 ms
+// playing the sample songs with an edit every few seconds.
+constexpr int32_t RENDER_AHEAD_MSEC = 100;
+constexpr int32_t RENDER_BLOCK_SMP_NUM = 256;
+
+static int32_t byte_per_smp(const pxtnService *pxtn,
+                            pxtnSAMPLEFORMAT format) {
+  int32_t byte_per_smp = pxtn->get_byte_per_smp(format);
+  return byte_per_smp > 0 ? byte_per_smp : 4;
+}
+
+static int32_t render_ahead_smp_num(const pxtnService *pxtn) {
+  int32_t ch_num, sps;
+  if (!pxtn->get_destination_quality(&ch_num, &sps)) sps = 44100;
+  return std::max(sps * RENDER_AHEAD_MSEC / 1000, 2 * RENDER_BLOCK_SMP_NUM);
+}
 
 PxtoneIODevice::PxtoneIODevice(QObject *parent, const pxtnService *pxtn,
-                               mooState *moo_state)
-    : QIODevice(parent), pxtn(pxtn), moo_state(moo_state), m_playing(false) {
+                               mooState *moo_state,
+                               std::recursive_mutex &moo_mutex,
+                               pxtnSAMPLEFORMAT format,
+                               PxtoneRenderCache *render_cache)
+    : QIODevice(parent),
+      pxtn(pxtn),
+      moo_state(moo_state),
+      m_moo_mutex(moo_mutex),
+      m_render_cache(render_cache),
+      m_moo_from_cache(false),
+      m_playing(false),
+      m_format(format),
+      m_byte_per_smp(byte_per_smp(pxtn, format)),
+      m_ring(render_ahead_smp_num(pxtn) * m_byte_per_smp),
+      m_quit(false),
+      m_moo_error(false),
+      m_now_clock(0),
+      m_num_loop(0) {
   int32_t ch_num, sps;
   if (pxtn->get_destination_quality(&ch_num, &sps))
     m_volume_meters = std::vector<InterpolatedVolumeMeter>(
         ch_num, InterpolatedVolumeMeter(sps / 25, sps));
+  {
+    std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+    moo_state->params.format = format;
+  }
+
+  m_render_thread = QThread::create([this]() { render(); });
+  m_render_thread->setParent(this);
+  m_render_thread->start(QThread::TimeCriticalPriority);
+}
+
+PxtoneIODevice::~PxtoneIODevice() {
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_render_thread->wait();
 }
 
 void PxtoneIODevice::setPlaying(bool playing) {
   bool changed = playing != m_playing;
-  m_playing = playing;
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_playing = playing;
+  }
+  m_wake.notify_one();
   if (changed) emit playingChanged(playing);
 }
 
@@ -24,20 +83,106 @@ const std::vector<InterpolatedVolumeMeter> &PxtoneIODevice::volumeLevels()
   return m_volume_meters;
 }
 
+void PxtoneIODevice::flush() {
+  m_ring.clear();
+  m_moo_from_cache = false;
+  if (m_render_cache) m_render_cache->follow(*moo_state);
+  updateNow();
+  m_wake.notify_one();
+}
+
+int32_t PxtoneIODevice::mooNowClock() const { return m_now_clock; }
+int PxtoneIODevice::mooNumLoop() const { return m_num_loop; }
+
+void PxtoneIODevice::updateNow() {
+  m_now_clock = pxtn->moo_get_now_clock(*moo_state);
+  m_num_loop = moo_state->num_loop;
+}
+
+// Keeps the ring buffer topped up while playing. Sleeps until readData takes
+// something out (or a time limit, in case the wake-up is missed).
+void PxtoneIODevice::render() {
+  const int32_t block_size = RENDER_BLOCK_SMP_NUM * m_byte_per_smp;
+  std::vector<char> block(block_size);
+  while (!m_quit) {
+    if (m_playing && !m_moo_error && m_ring.writable() >= size_t(block_size)) {
+      // Rather than block on an edit or the cache holding the mutex, check
+      // back shortly. If the ring buffer runs dry meanwhile, readData plays
+      // silence.
+      std::unique_lock<std::recursive_mutex> lock(m_moo_mutex,
+                                                  std::try_to_lock);
+      if (!lock.owns_lock()) {
+        std::unique_lock<std::mutex> wake_lock(m_wake_mutex);
+        if (m_quit) break;
+        m_wake.wait_for(wake_lock, std::chrono::milliseconds(1));
+        continue;
+      }
+      int32_t filled_len = 0;
+      if (m_render_cache) {
+        filled_len = m_render_cache->moo(*moo_state, block.data(), block_size);
+        if (filled_len > 0) m_moo_from_cache = true;
+        if (filled_len < block_size && m_moo_from_cache) {
+          if (!m_render_cache->resume(*moo_state)) {
+            // Wait for the cache to get the units ready to carry on with,
+            // the same as for the mutex.
+            m_ring.write(block.data(), filled_len);
+            updateNow();
+            lock.unlock();
+            std::unique_lock<std::mutex> wake_lock(m_wake_mutex);
+            if (m_quit) break;
+            m_wake.wait_for(wake_lock, std::chrono::milliseconds(1));
+            continue;
+          }
+          m_moo_from_cache = false;
+        }
+      }
+      if (filled_len < block_size) {
+        int32_t moo_len = 0;
+        if (!pxtn->Moo(*moo_state, block.data() + filled_len,
+                       block_size - filled_len, &moo_len))
+          m_moo_error = true;
+        filled_len += moo_len;
+      }
+      m_ring.write(block.data(), filled_len);
+      updateNow();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_wake_mutex);
+    if (m_quit) break;
+    m_wake.wait_for(lock, std::chrono::milliseconds(5));
+  }
+}
+
 qint64 PxtoneIODevice::readData(char *data, qint64 maxlen) {
   int32_t filled_len = 0;
 
   for (auto &m : m_volume_meters) m.new_batch();
   if (m_playing) {
-    auto *meters = m_volume_meters.size() > 0 ? &m_volume_meters : nullptr;
-    if (!pxtn->Moo(*moo_state, data, int32_t(maxlen), &filled_len, meters))
-      emit MooError();
+    maxlen -= maxlen % m_byte_per_smp;
+    filled_len = int32_t(m_ring.read(data, maxlen));
+    m_wake.notify_one();
+    if (m_moo_error.exchange(false)) emit MooError();
+    // Keep the output going through an underrun.
+    if (filled_len == 0) {
+      filled_len = int32_t(
+          std::min(maxlen, qint64(RENDER_BLOCK_SMP_NUM * m_byte_per_smp)));
+      memset(data, 0, filled_len);
+    }
+    size_t ch_num = m_volume_meters.size();
+    if (m_format == pxtnSAMPLEFORMAT_float32) {
+      const float *pf = reinterpret_cast<const float *>(data);
+      for (int32_t i = 0; ch_num > 0 && i < filled_len / 4; i++)
+        m_volume_meters[i % ch_num].insert(int64_t(pf[i] * 32768));
+    } else {
+      const int16_t *p16 = reinterpret_cast<const int16_t *>(data);
+      for (int32_t i = 0; ch_num > 0 && i < filled_len / 2; i++)
+        m_volume_meters[i % ch_num].insert(p16[i]);
+    }
   } else {
     memset(data, 0, maxlen);
 
-    int byte_per_smp;
-    if (pxtn->get_byte_per_smp(&byte_per_smp)) {
-      int smp_num = maxlen / byte_per_smp / m_volume_meters.size();
+    if (!m_volume_meters.empty()) {
+      int smp_num = maxlen / m_byte_per_smp / m_volume_meters.size();
       for (auto &m : m_volume_meters)
         for (int i = 0; i < smp_num; ++i) m.insert(0);
     }
@@ -2,21 +2,47 @@
 #define PXTONEIODEVICE_H
 
 #include <QIODevice>
+#include <QThread>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
+#include "AudioRingBuffer.h"
+#include "PxtoneRenderCache.h"
 #include "VolumeMeter.h"
 #include "pxtone/pxtnService.h"
 /**
  * @brief A pxtnService wrapper for QTAudioOutput.
+ *
+ * Moo is rendered a little ahead on a separate high-priority thread into a
+ * ring buffer, and readData only copies out of it, so a busy GUI thread doesn't
+ * hold up rendering and rendering doesn't take GUI thread time. The render
+ * thread holds [moo_mutex] while it renders, so anything changing [pxtn] or
+ * [moo_state] from another thread has to hold it too, and only briefly: the
+ * render thread doesn't block on it, so once what's rendered ahead runs out,
+ * the audio cuts out until it's let go.
+ *
+ * Where [render_cache] has the audio already, it's copied from there instead.
+ * The audio is in [format], which is set on [moo_state].
  */
 class PxtoneIODevice : public QIODevice {
   Q_OBJECT
  public:
-  PxtoneIODevice(QObject *parent, const pxtnService *pxtn, mooState *moo_state);
-  virtual ~PxtoneIODevice(){};
+  PxtoneIODevice(QObject *parent, const pxtnService *pxtn, mooState *moo_state,
+                 std::recursive_mutex &moo_mutex,
+                 pxtnSAMPLEFORMAT format = pxtnSAMPLEFORMAT_int16,
+                 PxtoneRenderCache *render_cache = nullptr);
+  virtual ~PxtoneIODevice();
   void setPlaying(bool playing);
   bool playing();
   double current_volume_dbfs();
   const std::vector<InterpolatedVolumeMeter> &volumeLevels() const;
+  // Throws away audio rendered ahead, e.g., after a seek. Call with
+  // [moo_mutex] held.
+  void flush();
+  // Where the render thread is. Safe to call without [moo_mutex].
+  int32_t mooNowClock() const;
+  int mooNumLoop() const;
 
  signals:
   void MooError();
@@ -25,9 +51,26 @@ class PxtoneIODevice : public QIODevice {
  private:
   const pxtnService *pxtn;
   mooState *moo_state;
-  bool m_playing;
+  std::recursive_mutex &m_moo_mutex;
+  PxtoneRenderCache *m_render_cache;
+  // Whether [moo_state] was last moved along by [m_render_cache].
+  bool m_moo_from_cache;
+  std::atomic<bool> m_playing;
   std::vector<InterpolatedVolumeMeter> m_volume_meters;
 
+  pxtnSAMPLEFORMAT m_format;
+  int32_t m_byte_per_smp;
+  AudioRingBuffer m_ring;
+  QThread *m_render_thread;
+  std::atomic<bool> m_quit;
+  std::atomic<bool> m_moo_error;
+  std::atomic<int32_t> m_now_clock;
+  std::atomic<int> m_num_loop;
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+
+  void render();
+  void updateNow();
   qint64 readData(char *data, qint64 maxlen);
   qint64 writeData(const char *data, qint64 len);
 };
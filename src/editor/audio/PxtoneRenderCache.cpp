@@ -0,0 +1,365 @@
+#include "PxtoneRenderCache.h"
+
+#include <chrono>
+#include <cstring>
+
+// Sizes in samples. The moo mutex is held for a render at a time, which is
+// short enough not to hold up playback.
+constexpr int32_t BLOCK_SMP_NUM = 16384;
+constexpr int32_t RENDER_SMP_NUM = 512;
+// The moo state is kept after every few blocks, for renders to start from, and
+// before a dirty block, for playback to carry on from. It includes the delay
+// buffers, so there's a cap on how much memory it can all take.
+constexpr int32_t STATE_BLOCK_NUM = 8;
+constexpr size_t MAX_STATE_BYTES = size_t(64) << 20;
+// How far ahead of the playhead to render, and how much of a song to keep.
+constexpr int32_t AHEAD_SEC = 30;
+constexpr int32_t MAX_CACHED_SEC = 600;
+
+static pxtnVOMITPREPARATION preparation(const mooParams &params, int32_t smp) {
+  pxtnVOMITPREPARATION prep{};
+  if (params.b_loop) prep.flags |= pxtnVOMITPREPFLAG_loop;
+  if (params.b_mute_by_unit) prep.flags |= pxtnVOMITPREPFLAG_unit_mute;
+  if (params.b_realtime) prep.flags |= pxtnVOMITPREPFLAG_realtime;
+  prep.start_pos_sample = smp;
+  prep.master_volume = params.master_vol;
+  prep.solo_unit = params.solo_unit;
+  prep.format = params.format;
+  prep.resample = params.resample;
+  return prep;
+}
+
+bool PxtoneRenderCache::Key::operator!=(const Key &other) const {
+  return clock_rate != other.clock_rate || master_vol != other.master_vol ||
+         b_mute_by_unit != other.b_mute_by_unit || smp_end != other.smp_end ||
+         unit_num != other.unit_num || delay_num != other.delay_num ||
+         format != other.format || resample != other.resample;
+}
+
+PxtoneRenderCache::PxtoneRenderCache(const pxtnService *pxtn,
+                                     std::recursive_mutex &moo_mutex,
+                                     mooCheckpoints *moo_checkpoints)
+    : m_pxtn(pxtn),
+      m_moo_mutex(moo_mutex),
+      m_moo_checkpoints(moo_checkpoints),
+      m_byte_per_smp(0),
+      m_playhead(0),
+      m_num_loop(0),
+      m_valid(false),
+      m_key{},
+      m_state_bytes(0),
+      m_render_block(-1),
+      m_render_smp(0),
+      m_render_target(-1),
+      m_resume_smp(-1),
+      m_resume_wanted(-1),
+      m_quit(false) {
+  m_params.clock_rate = 0;  // Nothing to render until following a moo.
+  m_thread = QThread::create([this]() { run(); });
+  m_thread->start(QThread::LowPriority);
+}
+
+PxtoneRenderCache::~PxtoneRenderCache() {
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread->wait();
+  delete m_thread;
+}
+
+void PxtoneRenderCache::invalidate() {
+  m_valid = false;
+  m_render_block = -1;
+  m_wake.notify_one();
+}
+
+void PxtoneRenderCache::follow(const mooState &moo_state) {
+  m_params = moo_state.params;
+  m_playhead = moo_state.smp_count;
+  m_num_loop = moo_state.num_loop;
+}
+
+int32_t PxtoneRenderCache::moo(mooState &moo_state, char *p_buf,
+                               int32_t size) {
+  follow(moo_state);
+  // Once looped, units and delays carry over from the end of the song, so it
+  // doesn't sound like the first time through, which is all that's cached.
+  if (!update() || moo_state.num_loop > 0 || moo_state.end_vomit ||
+      moo_state.fade_fade)
+    return 0;
+
+  int32_t smp_num = size / m_byte_per_smp;
+  int32_t smp_w = 0;
+  while (smp_w < smp_num) {
+    int32_t smp = moo_state.smp_count;
+    size_t b = smp / BLOCK_SMP_NUM;
+    if (b >= m_blocks.size() || !m_blocks[b].clean) break;
+    int32_t len =
+        std::min(smp_num - smp_w, int32_t(b + 1) * BLOCK_SMP_NUM - smp);
+    memcpy(p_buf + smp_w * m_byte_per_smp,
+           &m_blocks[b].pcm[(smp - b * BLOCK_SMP_NUM) * m_byte_per_smp],
+           len * m_byte_per_smp);
+    smp_w += len;
+    moo_state.smp_count += len;
+  }
+  m_playhead = moo_state.smp_count;
+  if (smp_w > 0) m_resume_wanted = -1;
+  return smp_w * m_byte_per_smp;
+}
+
+bool PxtoneRenderCache::resume(mooState &moo_state) {
+  follow(moo_state);
+  update();
+  if (m_resume_smp != moo_state.smp_count) {
+    m_resume_wanted = moo_state.smp_count;
+    m_wake.notify_one();
+    return false;
+  }
+  // What's swapped out is freed on the background thread when it's reused.
+  std::swap(moo_state.units, m_resume_state.units);
+  std::swap(moo_state.active_units, m_resume_state.active_units);
+  std::swap(moo_state.delays, m_resume_state.delays);
+  std::swap(moo_state.seek_replays, m_resume_state.seek_replays);
+  moo_state.p_eve = m_resume_state.p_eve;
+  moo_state.time_pan_index = m_resume_state.time_pan_index;
+  moo_state.end_vomit = false;
+  m_resume_smp = -1;
+  m_resume_wanted = -1;
+  return true;
+}
+
+// Renders a bit at a time, letting go of the moo mutex in between, and gets
+// states ready for playback to resume from first. Sleeps while there's nothing
+// to do.
+void PxtoneRenderCache::run() {
+  while (!m_quit) {
+    bool busy;
+    {
+      std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+      busy = prepareResume() || renderSome();
+    }
+    if (busy) {
+      QThread::yieldCurrentThread();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_wake_mutex);
+    if (m_quit) break;
+    m_wake.wait_for(lock, std::chrono::milliseconds(20));
+  }
+}
+
+bool PxtoneRenderCache::renderSome() {
+  if (!update()) return false;
+  if (m_render_block < 0) {
+    int32_t b = nextDirtyBlock();
+    if (b < 0) return false;
+    startRender(b);
+  }
+
+  Block &block = m_blocks[m_render_block];
+  int32_t start = m_render_block * BLOCK_SMP_NUM;
+  int32_t end = start + BLOCK_SMP_NUM;
+  block.pcm.resize(BLOCK_SMP_NUM * m_byte_per_smp);
+  int32_t smp_num = std::min(RENDER_SMP_NUM, end - m_render_smp);
+  if (!m_pxtn->Moo(m_render_state,
+                   &block.pcm[(m_render_smp - start) * m_byte_per_smp],
+                   smp_num * m_byte_per_smp)) {
+    m_render_block = -1;
+    return false;
+  }
+  m_render_smp += smp_num;
+  if (m_render_smp < end) return true;
+
+  block.clean = true;
+  block.end_clock = int32_t(end / m_key.clock_rate);
+  int32_t next = m_render_block + 1;
+  bool last = size_t(next) >= m_blocks.size();
+  if (last || next % STATE_BLOCK_NUM == 0 || !m_blocks[next].clean)
+    keepState(block, m_render_state);
+  // A run can start a few clean blocks back, where there's a state to start
+  // from, and it goes through them to the dirty ones.
+  if (!last && (next <= m_render_target ||
+                (!m_blocks[next].clean && blocksAhead(next) >= 0)))
+    m_render_block = next;
+  else
+    m_render_block = -1;
+  return true;
+}
+
+// Starts over if the song changed, and marks edited blocks dirty. Returns
+// whether there's anything to cache.
+bool PxtoneRenderCache::update() {
+  Key k = key();
+  if (!m_valid || k != m_key) {
+    m_valid = true;
+    m_key = k;
+    m_byte_per_smp = m_pxtn->get_byte_per_smp(k.format);
+    m_blocks.clear();
+    m_state_bytes = 0;
+    int32_t ch_num, sps;
+    // Only whole blocks that end before the song does, which leaves the end
+    // and what comes after it to Moo.
+    if (k.smp_end > 0 && m_pxtn->get_destination_quality(&ch_num, &sps)) {
+      int32_t smp_num = std::min(k.smp_end - 1, MAX_CACHED_SEC * sps);
+      m_blocks.resize(smp_num / BLOCK_SMP_NUM);
+    }
+    m_render_block = -1;
+    m_resume_smp = -1;
+    m_edits = m_pxtn->evels->Watch_Edits();
+  }
+
+  int32_t edit_clock = m_edits->exchange(INT32_MAX);
+  if (edit_clock != INT32_MAX) {
+    for (Block &block : m_blocks)
+      if (block.end_clock >= edit_clock) {
+        block.clean = false;
+        dropState(block);
+      }
+    if (m_render_block >= 0 &&
+        int32_t(m_render_smp / m_key.clock_rate) >= edit_clock)
+      m_render_block = -1;
+    if (m_resume_smp >= 0 &&
+        int32_t(m_resume_smp / m_key.clock_rate) >= edit_clock)
+      m_resume_smp = -1;
+  }
+  return !m_blocks.empty();
+}
+
+// Gets a state ready for where playback next needs to resume: where it's
+// waiting to, or else the end of the clean blocks it's playing through, once
+// that's coming up. Returns whether it made one.
+bool PxtoneRenderCache::prepareResume() {
+  bool cached = update();
+  int32_t smp = m_resume_wanted;
+  if (smp < 0) {
+    if (!cached || m_num_loop > 0) return false;
+    size_t b = m_playhead / BLOCK_SMP_NUM;
+    if (b >= m_blocks.size() || !m_blocks[b].clean) return false;
+    while (b < m_blocks.size() && m_blocks[b].clean) b++;
+    smp = b * BLOCK_SMP_NUM;
+    if (smp - m_playhead > BLOCK_SMP_NUM) return false;
+  }
+  if (smp == m_resume_smp) return false;
+
+  m_resume_state.params = m_params;
+  size_t b = smp / BLOCK_SMP_NUM;
+  if (cached && smp % BLOCK_SMP_NUM == 0 && b > 0 && b <= m_blocks.size() &&
+      m_blocks[b - 1].clean && m_blocks[b - 1].state)
+    restore(*m_blocks[b - 1].state, m_resume_state);
+  else {
+    resetDelays(m_resume_state);
+    pxtnVOMITPREPARATION prep = preparation(m_params, smp);
+    m_pxtn->moo_preparation(&prep, m_resume_state, m_moo_checkpoints);
+  }
+  m_resume_smp = smp;
+  return true;
+}
+
+PxtoneRenderCache::Key PxtoneRenderCache::key() const {
+  Key k;
+  k.clock_rate = m_params.clock_rate;
+  k.master_vol = m_params.master_vol;
+  k.b_mute_by_unit = m_params.b_mute_by_unit;
+  k.format = m_params.format;
+  k.resample = m_params.resample;
+  const pxtnMaster *master = m_pxtn->master;
+  // Same as in _moo_PXTONE_BLOCK.
+  k.smp_end = ((double)master->get_play_meas() * master->get_beat_num() *
+               master->get_beat_clock() * m_params.clock_rate);
+  k.unit_num = m_pxtn->Unit_Num();
+  k.delay_num = m_pxtn->Delay_Num();
+  return k;
+}
+
+// How many blocks of playback there are until [block] is reached, or -1 if it
+// isn't coming up soon.
+int32_t PxtoneRenderCache::blocksAhead(int32_t block) const {
+  int32_t ch_num, sps;
+  if (!m_pxtn->get_destination_quality(&ch_num, &sps)) return -1;
+  // Nothing's played from the cache after looping.
+  if (m_num_loop > 0) return -1;
+  int32_t ahead = block - m_playhead / BLOCK_SMP_NUM;
+  if (ahead < 0) return -1;
+  return (ahead * BLOCK_SMP_NUM < AHEAD_SEC * sps ? ahead : -1);
+}
+
+// Where to start rendering the next dirty block ahead from, which is after the
+// last state kept before it.
+int32_t PxtoneRenderCache::nextDirtyBlock() {
+  m_render_target = -1;
+  int32_t nearest = INT32_MAX;
+  for (size_t b = 0; b < m_blocks.size(); b++) {
+    if (m_blocks[b].clean) continue;
+    int32_t ahead = blocksAhead(b);
+    if (ahead >= 0 && ahead < nearest) {
+      nearest = ahead;
+      m_render_target = b;
+    }
+  }
+  int32_t b = m_render_target;
+  while (b > 0 && !(m_blocks[b - 1].clean && m_blocks[b - 1].state)) b--;
+  return b;
+}
+
+// Makes fresh delays for [moo_state], which moo_preparation doesn't.
+void PxtoneRenderCache::resetDelays(mooState &moo_state) const {
+  int32_t ch_num, sps;
+  m_pxtn->get_destination_quality(&ch_num, &sps);
+  moo_state.delays.clear();
+  for (int32_t i = 0; i < m_pxtn->Delay_Num(); i++)
+    moo_state.delays.emplace_back(*m_pxtn->Delay_Get(i),
+                                  m_pxtn->master->get_beat_num(),
+                                  m_pxtn->master->get_beat_tempo(), sps);
+}
+
+void PxtoneRenderCache::startRender(int32_t block) {
+  if (block == 0) {
+    resetDelays(m_render_state);
+    // Decoded here rather than ahead, since it isn't played as it's mooed.
+    pxtnVOMITPREPARATION prep = preparation(m_params, 0);
+    prep.flags &= ~pxtnVOMITPREPFLAG_realtime;
+    prep.thread_num = std::max(1, QThread::idealThreadCount() - 1);
+    m_pxtn->moo_preparation(&prep, m_render_state);
+  } else {
+    restore(*m_blocks[block - 1].state, m_render_state);
+    m_render_state.smp_count = block * BLOCK_SMP_NUM;
+  }
+  m_render_block = block;
+  m_render_smp = block * BLOCK_SMP_NUM;
+}
+
+// Keeps a copy of [moo_state] as the state after [block], unless it'd go over
+// the cap.
+void PxtoneRenderCache::keepState(Block &block, const mooState &moo_state) {
+  if (block.state) return;
+  size_t bytes = sizeof(Snapshot) +
+                 moo_state.units.size() * sizeof(pxtnUnitTone) +
+                 moo_state.active_units.size() * sizeof(int32_t);
+  for (const pxtnDelayTone &delay : moo_state.delays)
+    bytes += sizeof(pxtnDelayTone) + delay.get_buf_size();
+  if (m_state_bytes + bytes > MAX_STATE_BYTES) return;
+  block.state = std::make_unique<Snapshot>(
+      Snapshot{moo_state.units, moo_state.active_units, moo_state.delays,
+               moo_state.p_eve, moo_state.time_pan_index, bytes});
+  m_state_bytes += bytes;
+}
+
+void PxtoneRenderCache::dropState(Block &block) {
+  if (!block.state) return;
+  m_state_bytes -= block.state->bytes;
+  block.state.reset();
+}
+
+void PxtoneRenderCache::restore(const Snapshot &state, mooState &moo_state) {
+  moo_state.units = state.units;
+  for (pxtnUnitTone &unit : moo_state.units)
+    unit.Tone_Open_Streams(moo_state.params.b_realtime);
+  moo_state.active_units = state.active_units;
+  moo_state.delays = state.delays;
+  moo_state.p_eve = state.p_eve;
+  moo_state.time_pan_index = state.time_pan_index;
+  moo_state.seek_replays.clear();
+  moo_state.end_vomit = false;
+}
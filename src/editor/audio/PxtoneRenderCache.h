@@ -0,0 +1,123 @@
+#ifndef PXTONERENDERCACHE_H
+#define PXTONERENDERCACHE_H
+
+#include <QThread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "pxtone/pxtnService.h"
+/**
+ * @brief The song rendered ahead of the playhead on a background thread.
+ *
+ * The cache holds the song as it sounds played from the start up to where it
+ * first loops, in fixed-size blocks, along with the moo state after some of
+ * them. An edit to the events makes the blocks from its clock on dirty, and
+ * they're rendered again starting from the last state kept before them. Any
+ * other change to how the song sounds needs an invalidate().
+ *
+ * Everything is guarded by [moo_mutex], which the background thread only holds
+ * for a short render at a time, so call everything with it held.
+ */
+class PxtoneRenderCache {
+ public:
+  PxtoneRenderCache(const pxtnService *pxtn, std::recursive_mutex &moo_mutex,
+                    mooCheckpoints *moo_checkpoints);
+  ~PxtoneRenderCache();
+
+  // Drops everything cached.
+  void invalidate();
+  // Renders ahead of where [moo_state] is.
+  void follow(const mooState &moo_state);
+  // Copies up to [size] bytes of cached audio at [moo_state]'s position into
+  // [p_buf] and moves the position along, stopping short of the end. The
+  // units aren't moved along, so resume() before mooing [moo_state] again.
+  // Returns how much was copied, which is 0 if the audio there is dirty or
+  // [moo_state] has looped.
+  int32_t moo(mooState &moo_state, char *p_buf, int32_t size);
+  // Brings the rest of [moo_state] up to its position after moo() by swapping
+  // in a state the background thread got ready, so that it's quick enough for
+  // the audio thread. The state is exact at the end of a clean block,
+  // otherwise it's from a seek. Returns false if there isn't one for there
+  // yet, and asks for it; call again later without mooing meanwhile.
+  bool resume(mooState &moo_state);
+
+ private:
+  struct Snapshot {
+    std::vector<pxtnUnitTone> units;
+    std::vector<int32_t> active_units;
+    std::vector<pxtnDelayTone> delays;
+    const EVERECORD *p_eve;
+    int32_t time_pan_index;
+    size_t bytes;
+  };
+  struct Block {
+    bool clean = false;
+    // Edits after this clock don't affect the block.
+    int32_t end_clock = 0;
+    std::vector<char> pcm;
+    // The moo state after the block, if it's kept.
+    std::unique_ptr<Snapshot> state;
+  };
+  // What the blocks were rendered with.
+  struct Key {
+    float clock_rate;
+    float master_vol;
+    bool b_mute_by_unit;
+    int32_t smp_end;
+    int32_t unit_num;
+    int32_t delay_num;
+    pxtnSAMPLEFORMAT format;
+    pxtnRESAMPLE resample;
+    bool operator!=(const Key &other) const;
+  };
+
+  const pxtnService *m_pxtn;
+  std::recursive_mutex &m_moo_mutex;
+  mooCheckpoints *m_moo_checkpoints;
+  int32_t m_byte_per_smp;
+
+  mooParams m_params;  // Of the moo being followed.
+  int32_t m_playhead;  // In samples.
+  int m_num_loop;
+  bool m_valid;
+  Key m_key;
+  std::shared_ptr<std::atomic<int32_t>> m_edits;
+  std::vector<Block> m_blocks;
+  size_t m_state_bytes;
+
+  // The background render. [m_render_block] is -1 between runs of blocks,
+  // which go on at least up to [m_render_target].
+  mooState m_render_state;
+  int32_t m_render_block;
+  int32_t m_render_smp;
+  int32_t m_render_target;
+
+  // What resume() swaps in, for playback at [m_resume_smp] (-1 if none), and
+  // where playback is waiting to resume (-1 if it isn't).
+  mooState m_resume_state;
+  int32_t m_resume_smp;
+  int32_t m_resume_wanted;
+
+  QThread *m_thread;
+  std::atomic<bool> m_quit;
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+
+  void run();
+  bool renderSome();
+  bool prepareResume();
+  bool update();
+  Key key() const;
+  int32_t blocksAhead(int32_t block) const;
+  int32_t nextDirtyBlock();
+  void resetDelays(mooState &moo_state) const;
+  void startRender(int32_t block);
+  void keepState(Block &block, const mooState &moo_state);
+  void dropState(Block &block);
+  static void restore(const Snapshot &state, mooState &moo_state);
+};
+
+#endif  // PXTONERENDERCACHE_H
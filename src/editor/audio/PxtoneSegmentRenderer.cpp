@@ -0,0 +1,136 @@
+#include "PxtoneSegmentRenderer.h"
+
+#include <QString>
+#include <algorithm>
+
+PxtoneSegmentRenderer::PxtoneSegmentRenderer(const pxtnService *pxtn,
+                                             int32_t thread_num,
+                                             int32_t segment_smp_num,
+                                             int32_t preroll_smp_num)
+    : m_pxtn(pxtn),
+      m_pool(thread_num),
+      m_segment_smp_num(segment_smp_num),
+      m_preroll_smp_num(preroll_smp_num),
+      m_byte_per_smp(0),
+      m_seeked_num(0),
+      m_rerendered_num(0),
+      m_segments(2 * thread_num) {}
+
+int32_t PxtoneSegmentRenderer::seekedNum() const { return m_seeked_num; }
+
+int32_t PxtoneSegmentRenderer::rerenderedNum() const {
+  return m_rerendered_num;
+}
+
+// Only the parts of the state that soundsLike looks at.
+static void save_seam(const mooState &from, mooState &to) {
+  to.smp_count = from.smp_count;
+  to.p_eve = from.p_eve;
+  to.seek_replays = from.seek_replays;
+  to.time_pan_index = from.time_pan_index;
+  to.fade_fade = from.fade_fade;
+  to.fade_count = from.fade_count;
+  to.fade_max = from.fade_max;
+  to.units = from.units;
+  to.delays = from.delays;
+  to.stem_delays = from.stem_delays;
+}
+
+// Sets up the segment at [index] in a song [smp_num] samples long.
+PxtoneSegmentRenderer::Segment &PxtoneSegmentRenderer::start(int32_t index,
+                                                             int32_t smp_num) {
+  Segment &segment = m_segments[index % m_segments.size()];
+  segment.start = index * m_segment_smp_num;
+  segment.smp_num = std::min(m_segment_smp_num, smp_num - segment.start);
+  segment.pcm.resize(segment.smp_num * m_byte_per_smp);
+  segment.seeked = false;
+  segment.mooed = false;
+  return segment;
+}
+
+void PxtoneSegmentRenderer::renderSegment(Segment &segment,
+                                          const pxtnVOMITPREPARATION &prep) {
+  pxtnVOMITPREPARATION p = prep;
+  int32_t preroll = std::min(segment.start, m_preroll_smp_num);
+  p.start_pos_output = segment.start - preroll;
+  p.fadein_sec = 0;
+  // The segments are what's run in parallel.
+  p.thread_num = 0;
+  segment.seeked = true;
+  segment.mooed = m_pxtn->moo_preparation(&p, segment.state);
+  if (segment.mooed && preroll > 0) {
+    std::vector<char> buf(preroll * m_byte_per_smp);
+    segment.mooed = m_pxtn->Moo(segment.state, buf.data(), buf.size());
+  }
+  if (!segment.mooed) return;
+  save_seam(segment.state, segment.seam);
+  segment.mooed = m_pxtn->Moo(segment.state, segment.pcm.data(),
+                              segment.smp_num * m_byte_per_smp);
+}
+
+// Makes [segment] follow on from [last], keeping what was rendered from a seek
+// if it starts out sounding the same, and moves [last] along to after it.
+bool PxtoneSegmentRenderer::follow(Segment &segment, mooState *&last) {
+  if (segment.seeked) {
+    if (segment.mooed && last->soundsLike(segment.seam)) {
+      last = &segment.state;
+      return true;
+    }
+    ++m_rerendered_num;
+  }
+  return m_pxtn->Moo(*last, segment.pcm.data(), segment.pcm.size());
+}
+
+bool PxtoneSegmentRenderer::render(
+    mooState &moo_state, const pxtnVOMITPREPARATION &prep, int32_t smp_num,
+    const std::function<bool(const char *, int32_t)> &write) {
+  m_seeked_num = 0;
+  m_rerendered_num = 0;
+  m_byte_per_smp = m_pxtn->get_byte_per_smp(prep.format);
+  for (Segment &segment : m_segments) segment.state.delays = moo_state.delays;
+
+  int32_t segment_num = (smp_num + m_segment_smp_num - 1) / m_segment_smp_num;
+  int32_t wave_size = m_pool.get_thread_num();
+  // Segments before [followed] are written. Those up to [first] are rendered
+  // and wait to follow on from [last], and a wave from [first] on is rendered
+  // from seeks meanwhile. The first segment follows straight on from
+  // [moo_state].
+  int32_t followed = 0;
+  int32_t first = 1;
+  mooState *last = &moo_state;
+  start(0, smp_num);
+  while (followed < segment_num) {
+    // Seeks aren't worth it once most segments need rendering again.
+    bool seeking =
+        m_seeked_num < wave_size || m_rerendered_num * 2 <= m_seeked_num;
+    if (!seeking && followed == first) break;
+    int32_t num = seeking ? std::min(wave_size, segment_num - first) : 0;
+    bool mooed = true;
+    m_pool.For(num + 1, [&](int32_t i) {
+      if (i == 0)
+        for (int32_t j = followed; j < first && mooed; j++)
+          mooed = follow(m_segments[j % m_segments.size()], last);
+      else
+        renderSegment(start(first + i - 1, smp_num), prep);
+    });
+    if (!mooed) throw QString("Moo error during rendering");
+    for (; followed < first; followed++) {
+      const Segment &segment = m_segments[followed % m_segments.size()];
+      if (segment.seeked) ++m_seeked_num;
+      if (!write(segment.pcm.data(), int32_t(segment.pcm.size())))
+        return false;
+    }
+    // The segments' states are reused for later ones.
+    if (last != &moo_state) std::swap(moo_state, *last);
+    last = &moo_state;
+    first += num;
+  }
+
+  // The rest is mooed straight through.
+  for (; followed < segment_num; followed++) {
+    Segment &segment = start(followed, smp_num);
+    if (!follow(segment, last)) throw QString("Moo error during rendering");
+    if (!write(segment.pcm.data(), int32_t(segment.pcm.size()))) return false;
+  }
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef PXTONESEGMENTRENDERER_H
+#define PXTONESEGMENTRENDERER_H
+
+#include <functional>
+#include <vector>
+
+#include "pxtone/pxtnService.h"
+#include "pxtone/pxtnThreadPool.h"
+/**
+ * @brief Renders a song on several threads at once, a time segment each.
+ *
+ * Each segment after the first starts from a seek a little before it (the
+ * pre-roll), so that delays and note releases have settled by the time it
+ * starts. A segment is only kept if the moo state it reached at its start
+ * sounds like where the segment before it left off (see
+ * mooState::soundsLike); otherwise it's rendered again, following on from
+ * there. Either way the output is the same as mooing through serially.
+ *
+ * Segments are rendered a wave at a time, and each wave is checked and
+ * rendered again where need be on one thread while the next is rendered on
+ * the others. If most segments need rendering again, the rest of the song is
+ * just mooed through.
+ */
+class PxtoneSegmentRenderer {
+ public:
+  PxtoneSegmentRenderer(const pxtnService *pxtn, int32_t thread_num,
+                        int32_t segment_smp_num, int32_t preroll_smp_num);
+
+  // Renders [smp_num] samples on from [moo_state], which should have just been
+  // prepared with [prep] to start at the beginning of the song, handing them
+  // to [write] a segment at a time, in order. Stops early if [write] returns
+  // false. Afterwards, [moo_state] is where mooing all the way would have left
+  // it. Throws a QString on errors.
+  bool render(mooState &moo_state, const pxtnVOMITPREPARATION &prep,
+              int32_t smp_num,
+              const std::function<bool(const char *, int32_t)> &write);
+  // How many segments the last render() rendered from seeks, and how many of
+  // those it had to render again.
+  int32_t seekedNum() const;
+  int32_t rerenderedNum() const;
+
+ private:
+  struct Segment {
+    int32_t start;
+    int32_t smp_num;
+    std::vector<char> pcm;
+    // Whether it was rendered from a seek, rather than to follow on.
+    bool seeked;
+    bool mooed;
+    // Mooed from [seam] through the segment.
+    mooState state;
+    // The state the pre-roll reached, at the start of the segment.
+    mooState seam;
+  };
+
+  const pxtnService *m_pxtn;
+  pxtnThreadPool m_pool;
+  int32_t m_segment_smp_num;
+  int32_t m_preroll_smp_num;
+  int32_t m_byte_per_smp;
+  int32_t m_seeked_num;
+  int32_t m_rerendered_num;
+  // Two waves' worth, used in turn.
+  std::vector<Segment> m_segments;
+
+  Segment &start(int32_t index, int32_t smp_num);
+  void renderSegment(Segment &segment, const pxtnVOMITPREPARATION &prep);
+  bool follow(Segment &segment, mooState *&last);
+};
+
+#endif  // PXTONESEGMENTRENDERER_H
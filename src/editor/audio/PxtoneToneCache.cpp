@@ -0,0 +1,117 @@
+#include "PxtoneToneCache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <cstring>
+
+// What each file starts with, followed by the 16-bit samples.
+struct Header {
+  char magic[4];
+  int32_t ch_num;
+  int32_t sps;
+  int32_t smp_num;
+  int32_t smp_head_w;
+  int32_t smp_body_w;
+  int32_t smp_tail_w;
+};
+static const char MAGIC[4] = {'P', 'T', 'V', 'C'};
+
+PxtoneToneCache::PxtoneToneCache(const QString &dir, qint64 max_size)
+    : m_dir(dir), m_max_size(max_size) {}
+
+QString PxtoneToneCache::path(const std::vector<uint8_t> &key) const {
+  QByteArray hash = QCryptographicHash::hash(
+      QByteArray::fromRawData((const char *)key.data(), int(key.size())),
+      QCryptographicHash::Sha1);
+  return QDir(m_dir).filePath(QString::fromLatin1(hash.toHex()));
+}
+
+// Whether [h] makes sense for a file of [size] bytes. The head, body and tail
+// are at 44.1kHz, which [smp_num] either is already (e.g., noise) or is once
+// converted from [sps], give or take rounding each of them.
+static bool header_ok(const Header &h, qint64 size) {
+  if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.ch_num < 1 ||
+      h.ch_num > 2 || h.sps <= 0 || h.smp_num <= 0 || h.smp_head_w < 0 ||
+      h.smp_body_w < 0 || h.smp_tail_w < 0)
+    return false;
+  if (qint64(h.smp_num) * h.ch_num * sizeof(int16_t) !=
+      size - qint64(sizeof(Header)))
+    return false;
+  qint64 smp_w = qint64(h.smp_head_w) + h.smp_body_w + h.smp_tail_w;
+  qint64 smp_44k = qint64(h.smp_num) * 44100 / h.sps;
+  return smp_w == h.smp_num || qAbs(smp_w - smp_44k) <= 4;
+}
+
+bool PxtoneToneCache::Load(const std::vector<uint8_t> &key,
+                           pxtnVOICEINSTANCE *p_vi) {
+  QFile file(path(key));
+  if (!file.open(QIODevice::ReadOnly)) return false;
+  Header h;
+  if (file.read((char *)&h, sizeof(h)) != qint64(sizeof(h))) return false;
+  if (!header_ok(h, file.size())) {
+    qWarning() << "Ignoring malformed tone cache file" << file.fileName();
+    return false;
+  }
+  qint64 smp_size = qint64(h.smp_num) * h.ch_num * sizeof(int16_t);
+  uint8_t *p_smp = (uint8_t *)malloc(smp_size);
+  if (!p_smp) return false;
+  if (file.read((char *)p_smp, smp_size) != smp_size) {
+    free(p_smp);
+    return false;
+  }
+
+  p_vi->p_smp_w = p_smp;
+  p_vi->ch_num = h.ch_num;
+  p_vi->sps = h.sps;
+  p_vi->smp_num = h.smp_num;
+  p_vi->smp_head_w = h.smp_head_w;
+  p_vi->smp_body_w = h.smp_body_w;
+  p_vi->smp_tail_w = h.smp_tail_w;
+  // Its modification time is when it was last used, for eviction.
+  file.setFileTime(QDateTime::currentDateTimeUtc(),
+                   QFileDevice::FileModificationTime);
+  return true;
+}
+
+void PxtoneToneCache::Save(const std::vector<uint8_t> &key,
+                           const pxtnVOICEINSTANCE *p_vi) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!QDir().mkpath(m_dir)) return;
+
+  Header h;
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.ch_num = p_vi->ch_num;
+  h.sps = p_vi->sps;
+  h.smp_num = p_vi->smp_num;
+  h.smp_head_w = p_vi->smp_head_w;
+  h.smp_body_w = p_vi->smp_body_w;
+  h.smp_tail_w = p_vi->smp_tail_w;
+  qint64 smp_size = qint64(h.smp_num) * h.ch_num * sizeof(int16_t);
+  if (qint64(sizeof(Header)) + smp_size > m_max_size) return;
+
+  // Written whole and then moved into place, so a Load never sees half of it.
+  QSaveFile file(path(key));
+  if (!file.open(QIODevice::WriteOnly) ||
+      file.write((const char *)&h, sizeof(h)) != qint64(sizeof(h)) ||
+      file.write((const char *)p_vi->p_smp_w, smp_size) != smp_size ||
+      !file.commit()) {
+    qWarning() << "Could not write tone cache file" << file.fileName();
+    return;
+  }
+  evict();
+}
+
+void PxtoneToneCache::evict() {
+  QFileInfoList files =
+      QDir(m_dir).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+  qint64 total = 0;
+  for (const QFileInfo &f : files) total += f.size();
+  for (const QFileInfo &f : files) {
+    if (total <= m_max_size) break;
+    if (QFile::remove(f.filePath())) total -= f.size();
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef PXTONETONECACHE_H
+#define PXTONETONECACHE_H
+
+#include <QString>
+#include <mutex>
+
+#include "pxtone/pxtnWoice.h"
+/**
+ * @brief Readied voice samples kept in files under a directory.
+ *
+ * Each file is named after a hash of its key. When the files come to more
+ * than [max_size] bytes, the ones least recently used are removed.
+ */
+class PxtoneToneCache : public pxtnToneCache {
+ public:
+  PxtoneToneCache(const QString &dir, qint64 max_size);
+
+  bool Load(const std::vector<uint8_t> &key, pxtnVOICEINSTANCE *p_vi) override;
+  void Save(const std::vector<uint8_t> &key,
+            const pxtnVOICEINSTANCE *p_vi) override;
+
+ private:
+  QString m_dir;
+  qint64 m_max_size;
+  // Held while saving, so that eviction sees every file.
+  std::mutex m_mutex;
+
+  QString path(const std::vector<uint8_t> &key) const;
+  void evict();
+};
+
+#endif  // PXTONETONECACHE_H
@@ -0,0 +1,61 @@
+#include "PxtoneWoiceLoader.h"
+
+#include <QDebug>
+
+PxtoneWoiceLoader::PxtoneWoiceLoader(pxtnService *pxtn,
+                                     const mooState *moo_state,
+                                     std::recursive_mutex &moo_mutex,
+                                     std::function<void()> on_ready)
+    : m_pxtn(pxtn),
+      m_moo_state(moo_state),
+      m_moo_mutex(moo_mutex),
+      m_on_ready(on_ready),
+      m_quit(false) {
+  // Ordered once, up front, since it's a walk over all the events.
+  std::vector<int32_t> order =
+      m_pxtn->Woice_Order_by_use(m_pxtn->moo_get_now_clock(*m_moo_state));
+  for (auto w = order.rbegin(); w != order.rend(); ++w)
+    m_order.push_back(m_pxtn->Woice_Get_variable(*w));
+  m_thread = QThread::create([this]() { run(); });
+  m_thread->start(QThread::LowPriority);
+}
+
+PxtoneWoiceLoader::~PxtoneWoiceLoader() {
+  m_quit = true;
+  m_thread->wait();
+  delete m_thread;
+}
+
+void PxtoneWoiceLoader::run() {
+  while (!m_quit && readyNext())
+    ;
+}
+
+// Readies the next woice. Returns false once there are none left.
+bool PxtoneWoiceLoader::readyNext() {
+  std::shared_ptr<pxtnWoice> woice;
+  std::shared_ptr<pxtnWoice> copy = std::make_shared<pxtnWoice>();
+  {
+    std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+    while (!woice && !m_order.empty()) {
+      std::shared_ptr<pxtnWoice> next = std::move(m_order.back());
+      m_order.pop_back();
+      // Edits may have readied or removed it in the meantime.
+      if (next->is_tone_ready()) continue;
+      for (int32_t w = 0; w < m_pxtn->Woice_Num(); w++)
+        if (m_pxtn->Woice_Get(w) == next) woice = next;
+    }
+    if (!woice) return false;
+    if (!woice->Copy(copy.get())) return true;
+  }
+
+  pxtnERR err = m_pxtn->Woice_ReadyTone(copy);
+  std::lock_guard<std::recursive_mutex> lock(m_moo_mutex);
+  if (err != pxtnOK) {
+    qWarning() << "Error getting tone ready" << err;
+    return true;
+  }
+  // It may have been readied or changed by an edit in the meantime.
+  if (!woice->is_tone_ready() && woice->Tone_Take(copy.get())) m_on_ready();
+  return true;
+}
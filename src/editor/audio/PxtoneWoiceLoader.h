@@ -0,0 +1,48 @@
+#ifndef PXTONEWOICELOADER_H
+#define PXTONEWOICELOADER_H
+
+#include <QThread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "pxtone/pxtnService.h"
+/**
+ * @brief Readies the woices of a song loaded with lazy tones_ready() on a
+ * background thread.
+ *
+ * Woices are readied one at a time, those played soonest after [moo_state]'s
+ * position at the start first. Each is readied on a copy without [moo_mutex]
+ * held, then handed to the woice with it held, after which [on_ready] is
+ * called, still with it held. Units with a woice that isn't ready yet stay
+ * silent.
+ *
+ * Woices that fail to ready are left silent.
+ */
+class PxtoneWoiceLoader {
+ public:
+  // Call with [moo_mutex] held.
+  PxtoneWoiceLoader(pxtnService *pxtn, const mooState *moo_state,
+                    std::recursive_mutex &moo_mutex,
+                    std::function<void()> on_ready);
+  // Waits for the woice being readied, if any.
+  ~PxtoneWoiceLoader();
+
+ private:
+  pxtnService *m_pxtn;
+  const mooState *m_moo_state;
+  std::recursive_mutex &m_moo_mutex;
+  std::function<void()> m_on_ready;
+  // The woices still to ready, soonest played last.
+  std::vector<std::shared_ptr<pxtnWoice>> m_order;
+
+  QThread *m_thread;
+  std::atomic<bool> m_quit;
+
+  void run();
+  bool readyNext();
+};
+
+#endif  // PXTONEWOICELOADER_H
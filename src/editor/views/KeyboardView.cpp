@@ -1405,10 +1405,6 @@ void KeyboardView::quantizeSelectionX() {
     return ((2 * c + quantizeClock) / (quantizeClock * 2)) * quantizeClock;
   };
 
-  const EVERECORD *e = nullptr;
-  for (e = m_pxtn->evels->get_Records(); e; e = e->next)
-    if (e->clock >= range.start) break;
-
   std::list<Action::Primitive> actions;
   for (int unit_no : unit_nos)
     for (EVENTKIND kind : kindsToQuantize) {
@@ -1416,28 +1412,30 @@ void KeyboardView::quantizeSelectionX() {
       actions.push_back(
           {kind, unit_id, range.start, Action::Delete{range.end}});
     }
-  for (; e && e->clock < range.end; e = e->next) {
-    EVENTKIND kind(EVENTKIND(e->kind));
-    qint32 start_clock = quantize(e->clock);
-    if (start_clock >= range.end) continue;
-    if (unit_nos.find(e->unit_no) != unit_nos.end() &&
-        kindsToQuantize.find(kind) != kindsToQuantize.end()) {
-      int unit_id = m_client->unitIdMap().noToId(e->unit_no);
-      if (Evelist_Kind_IsTail(e->kind)) {
-        // We round the end time up if it's too small. Even though this
-        // might cause an add overlap with the next value, this should be
-        // okay in terms of interacting with undo, since the undos of both
-        // of these is 2 clears. (It takes some effort to explain)
-
-        // 2021-10-13: However we don't let it go beyond the selection
-        // end.
-        int v = std::min(std::max(quantizeClock, quantize(e->value)),
-                         range.end - start_clock);
-        actions.push_back({kind, unit_id, start_clock, Action::Add{v}});
-      } else
-        actions.push_back({kind, unit_id, start_clock, Action::Add{e->value}});
+  for (int unit_no : unit_nos)
+    for (EVENTKIND kind : kindsToQuantize) {
+      int unit_id = m_client->unitIdMap().noToId(unit_no);
+      for (const EVERECORD *e =
+               m_pxtn->evels->get_Kind_First(range.start, unit_no, kind);
+           e && e->clock < range.end; e = m_pxtn->evels->get_Next_Kind(e)) {
+        qint32 start_clock = quantize(e->clock);
+        if (start_clock >= range.end) continue;
+        if (Evelist_Kind_IsTail(e->kind)) {
+          // We round the end time up if it's too small. Even though this
+          // might cause an add overlap with the next value, this should be
+          // okay in terms of interacting with undo, since the undos of both
+          // of these is 2 clears. (It takes some effort to explain)
+
+          // 2021-10-13: However we don't let it go beyond the selection
+          // end.
+          int v = std::min(std::max(quantizeClock, quantize(e->value)),
+                           range.end - start_clock);
+          actions.push_back({kind, unit_id, start_clock, Action::Add{v}});
+        } else
+          actions.push_back(
+              {kind, unit_id, start_clock, Action::Add{e->value}});
+      }
     }
-  }
   qDebug() << "apply quantizeX";
   m_client->applyAction(actions);
 }
@@ -1449,10 +1447,6 @@ void KeyboardView::quantizeSelectionY() {
   const std::set<int> &unit_nos(m_client->selectedUnitNos());
   int denom = m_client->editState().m_quantize_pitch_denom;
 
-  const EVERECORD *e = nullptr;
-  for (e = m_pxtn->evels->get_Records(); e; e = e->next)
-    if (e->clock >= range.start) break;
-
   std::list<Action::Primitive> actions;
   for (int unit_no : unit_nos) {
     int unit_id = m_client->unitIdMap().noToId(unit_no);
@@ -1460,12 +1454,12 @@ void KeyboardView::quantizeSelectionY() {
         {EVENTKIND_KEY, unit_id, range.start, Action::Delete{range.end}});
   }
 
-  for (; e && e->clock < range.end; e = e->next) {
-    if (e->kind != EVENTKIND_KEY) continue;
-    if (unit_nos.find(e->unit_no) == unit_nos.end()) continue;
-    int unit_id = m_client->unitIdMap().noToId(e->unit_no);
-    actions.push_back({EVENTKIND_KEY, unit_id, e->clock,
-                       Action::Add{quantize_pitch(e->value, denom)}});
+  for (int unit_no : unit_nos) {
+    int unit_id = m_client->unitIdMap().noToId(unit_no);
+    for (const EVERECORD *e : m_pxtn->evels->get_Kind_Window(
+             range.start, range.end, unit_no, EVENTKIND_KEY))
+      actions.push_back({EVENTKIND_KEY, unit_id, e->clock,
+                         Action::Add{quantize_pitch(e->value, denom)}});
   }
   qDebug() << "apply quantizeY";
   m_client->applyAction(actions);
@@ -403,8 +403,6 @@ void MeasureView::paintEvent(QPaintEvent *raw_event) {
     }
   }
 
-  std::map<int, Interval> last_on_by_no;
-  std::map<int, int> last_vel_by_no;
   std::optional<Interval> selection(
       m_client->editState().mouse_edit_state.selection);
 
@@ -415,55 +413,38 @@ void MeasureView::paintEvent(QPaintEvent *raw_event) {
   double seconds_per_clock = 60 / m_client->pxtn()->master->get_beat_tempo() /
                              m_client->pxtn()->master->get_beat_clock();
   int now = m_moo_clock->now();
-  auto drawLastOn = [&](int no, bool erase) {
-    if (last_on_by_no.count(no) > 0) {
-      const Interval &i = last_on_by_no[no];
-      int vel = (last_vel_by_no.count(no) > 0 ? last_vel_by_no[no]
-                                              : EVENTDEFAULT_VELOCITY);
-      int x = i.start / scaleX;
-      int w = int(i.end / scaleX) - x;
-      std::shared_ptr<const NoteBrush> brush =
-          unit_draw_params_map.no_to_params[no].brush;
-      double on_strength = 0;
-      if (now >= i.start && now < i.end) {
-        double seconds_in_block = (now - i.start) * seconds_per_clock;
-        on_strength = lerp_f(seconds_in_block / 0.3, 1, 0.5);
-      }
-      QColor c = brush->toQColor(vel, on_strength, 255);
-      for (int y : unit_draw_params_map.no_to_params[no].ys)
-        fillUnitBullet(painter, x, y, w, c);
-      if (selected_unit_nos.count(no) > 0 && selection.has_value()) {
-        Interval selection_segment = interval_intersect(selection.value(), i);
-        if (!selection_segment.empty()) {
-          painter.setPen(brush->toQColor(EVENTDEFAULT_VELOCITY, 1, 255));
-          int x = selection_segment.start / scaleX;
-          int w = int(selection_segment.end / scaleX) - x;
-          for (int y : unit_draw_params_map.no_to_params[no].ys)
-            drawUnitBullet(painter, x, y, w);
-        }
+  auto drawOn = [&](int no, const UnitDrawParams &params, const Interval &i,
+                    int vel) {
+    int x = i.start / scaleX;
+    int w = int(i.end / scaleX) - x;
+    std::shared_ptr<const NoteBrush> brush = params.brush;
+    double on_strength = 0;
+    if (now >= i.start && now < i.end) {
+      double seconds_in_block = (now - i.start) * seconds_per_clock;
+      on_strength = lerp_f(seconds_in_block / 0.3, 1, 0.5);
+    }
+    QColor c = brush->toQColor(vel, on_strength, 255);
+    for (int y : params.ys) fillUnitBullet(painter, x, y, w, c);
+    if (selected_unit_nos.count(no) > 0 && selection.has_value()) {
+      Interval selection_segment = interval_intersect(selection.value(), i);
+      if (!selection_segment.empty()) {
+        painter.setPen(brush->toQColor(EVENTDEFAULT_VELOCITY, 1, 255));
+        int x = selection_segment.start / scaleX;
+        int w = int(selection_segment.end / scaleX) - x;
+        for (int y : params.ys) drawUnitBullet(painter, x, y, w);
       }
-      if (erase) last_on_by_no.erase(no);
     }
   };
 
-  for (const EVERECORD *e = pxtn->evels->get_Records(); e != nullptr;
-       e = e->next) {
-    if (e->clock > clockBounds.end) break;
-    if (unit_draw_params_map.no_to_params.count(e->unit_no) > 0) {
-      if (e->kind == EVENTKIND_ON) {
-        drawLastOn(e->unit_no, true);
-        last_on_by_no[e->unit_no] = Interval{e->clock, e->clock + e->value};
-      }
-      if (e->kind == EVENTKIND_VELOCITY) {
-        if (last_on_by_no.count(e->unit_no) > 0 &&
-            last_on_by_no[e->unit_no].start < e->clock)
-          drawLastOn(e->unit_no, true);
-        last_vel_by_no[e->unit_no] = e->value;
-      }
-    }
+  // Each note is drawn with the velocity it starts with.
+  const pxtnEvelist *evels = pxtn->evels;
+  for (const auto &[no, params] : unit_draw_params_map.no_to_params) {
+    for (const EVERECORD *e :
+         evels->get_Kind_Window(clockBounds.start, clockBounds.end + 1, no,
+                                EVENTKIND_ON))
+      drawOn(no, params, Interval{e->clock, e->clock + e->value},
+             evels->get_Value(e->clock, no, EVENTKIND_VELOCITY));
   }
-  for (auto it = last_on_by_no.begin(); it != last_on_by_no.end(); ++it)
-    drawLastOn(it->first, false);
 
   drawLastSeek(painter, m_client, height, true);
   drawCurrentPlayerPosition(painter, m_moo_clock, height,
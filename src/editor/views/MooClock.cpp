@@ -20,7 +20,7 @@ MooClock::MooClock(PxtoneClient *client)
 }
 
 void MooClock::tick() {
-  int clock = m_client->pxtn()->moo_get_now_clock(*m_client->moo());
+  int clock = m_client->mooNowClock();
 
   // Some really hacky magic to get the playhead smoother given that
   // there's a ton of buffering that makes it hard to actually tell where the
@@ -55,7 +55,7 @@ void MooClock::tick() {
     timeSinceLastClock.restart();
   else
     estimated_buffer_offset += timeSinceLastClock.elapsed() / 1000.0;
-  clock += (last_clock() - repeat_clock()) * m_client->moo()->num_loop;
+  clock += (last_clock() - repeat_clock()) * m_client->mooNumLoop();
 
   const pxtnMaster *master = m_client->pxtn()->master;
   clock += std::min(estimated_buffer_offset, 0.0) * master->get_beat_tempo() *
@@ -440,18 +440,25 @@ void ParamView::paintEvent(QPaintEvent *raw_event) {
   };
 
   std::vector<Event> current_unit_events;
-  for (const EVERECORD *e = pxtn->evels->get_Records(); e != nullptr;
-       e = e->next) {
-    if (e->clock > clockBounds.end) break;
-    if (e->kind != current_kind) continue;
-    int unit_no = e->unit_no;
-
-    Event curr{e->clock, e->value};
-    if (unit_no == current_unit_no)
-      current_unit_events.push_back(lastEvents[unit_no]);
-    else
-      handleLastEvent(lastEvents[unit_no], curr, unit_no);
-    lastEvents[unit_no] = curr;
+  const pxtnEvelist *evels = pxtn->evels;
+  for (int unit_no = 0; unit_no < m_client->pxtn()->Unit_Num(); ++unit_no) {
+    // What's drawn of the events before the window is from the last one.
+    const EVERECORD *e =
+        evels->get_Kind_Last(clockBounds.start, unit_no, current_kind);
+    if (e) {
+      lastEvents[unit_no] = Event{e->clock, e->value};
+      e = evels->get_Next_Kind(e);
+    } else
+      e = evels->get_Kind_First(clockBounds.start, unit_no, current_kind);
+
+    for (; e && e->clock <= clockBounds.end; e = evels->get_Next_Kind(e)) {
+      Event curr{e->clock, e->value};
+      if (unit_no == current_unit_no)
+        current_unit_events.push_back(lastEvents[unit_no]);
+      else
+        handleLastEvent(lastEvents[unit_no], curr, unit_no);
+      lastEvents[unit_no] = curr;
+    }
   }
   for (int unit_no = 0; unit_no < m_client->pxtn()->Unit_Num(); ++unit_no) {
     Event curr = lastEvents[unit_no];
@@ -617,16 +624,15 @@ void ParamView::mousePressEvent(QMouseEvent *event) {
       false);
 }
 
-static void setVelInRange(const EVERECORD *&p, int32_t unit_no, qint32 unit_id,
-                          const ParamEditInterval &interval,
+static void setVelInRange(const pxtnEvelist *evels, int32_t unit_no,
+                          qint32 unit_id, const ParamEditInterval &interval,
                           std::list<Action::Primitive> &actions) {
   using namespace Action;
-  while (p && p->prev && p->prev->clock >= interval.clock.start) p = p->prev;
-  while (p && p->clock < interval.clock.start) p = p->next;
-  for (; p && p->clock < interval.clock.end; p = p->next)
-    if (p->kind == EVENTKIND_VELOCITY && p->unit_no == unit_no)
-      actions.push_back(
-          {EVENTKIND_VELOCITY, unit_id, p->clock, Add{interval.param}});
+  for (const EVERECORD *p :
+       evels->get_Kind_Window(interval.clock.start, interval.clock.end,
+                              unit_no, EVENTKIND_VELOCITY))
+    actions.push_back(
+        {EVENTKIND_VELOCITY, unit_id, p->clock, Add{interval.param}});
 }
 
 void ParamView::mouseReleaseEvent(QMouseEvent *event) {
@@ -695,10 +701,9 @@ void ParamView::mouseReleaseEvent(QMouseEvent *event) {
                     std::optional<qint32> unit_no =
                         m_client->unitIdMap().idToNo(s.m_current_unit_id);
                     if (unit_no.has_value()) {
-                      const EVERECORD *records =
-                          m_client->pxtn()->evels->get_Records();
+                      const pxtnEvelist *evels = m_client->pxtn()->evels;
                       for (const ParamEditInterval &p : intervals)
-                        setVelInRange(records, unit_no.value(),
+                        setVelInRange(evels, unit_no.value(),
                                       s.m_current_unit_id, p, actions);
                     }
                   } else
@@ -3,6 +3,7 @@
 #include <QLibraryInfo>
 #include <QTranslator>
 
+#include "editor/BatchRender.h"
 #include "editor/EditorWindow.h"
 #include "editor/Settings.h"
 #include "editor/StyleEditor.h"
@@ -46,6 +47,9 @@ QCoreApplication *createApplication(int &argc, char *argv[]) {
   QStringList args(argv, argv + argc);
   if (args.contains("-headless") || args.contains("--headless"))
     return new QCoreApplication(argc, argv);
+  for (const QString &arg : args)
+    if (arg.startsWith("-render") || arg.startsWith("--render"))
+      return new QCoreApplication(argc, argv);
   return new QApplication(argc, argv);
 }
 
@@ -118,6 +122,79 @@ int main(int argc, char *argv[]) {
       QCoreApplication::translate("main", "Just run a server with no editor."));
   parser.addOption(headlessOption);
 
+  QCommandLineOption renderOption(
+      QStringList() << "render",
+      QCoreApplication::translate(
+          "main",
+          "Render the given files to WAVs in <dir> with no editor, and exit."),
+      QCoreApplication::translate("main", "dir"));
+  parser.addOption(renderOption);
+
+  QCommandLineOption lengthOption(
+      QStringList() << "length",
+      QCoreApplication::translate(
+          "main", "With --render, render <secs> of each file, before fade."),
+      QCoreApplication::translate("main", "secs"));
+  parser.addOption(lengthOption);
+
+  QCommandLineOption loopsOption(
+      QStringList() << "loops",
+      QCoreApplication::translate(
+          "main", "With --render, play each file through <n> times (1)."),
+      QCoreApplication::translate("main", "n"));
+  parser.addOption(loopsOption);
+
+  QCommandLineOption fadeoutOption(
+      QStringList() << "fadeout",
+      QCoreApplication::translate(
+          "main", "With --render, fade out over <secs> at the end (0)."),
+      QCoreApplication::translate("main", "secs"));
+  parser.addOption(fadeoutOption);
+
+  QCommandLineOption volumeOption(
+      QStringList() << "volume",
+      QCoreApplication::translate("main", "With --render, the volume (1)."),
+      QCoreApplication::translate("main", "volume"));
+  parser.addOption(volumeOption);
+
+  QCommandLineOption sampleRateOption(
+      QStringList() << "sample-rate",
+      QCoreApplication::translate("main",
+                                  "With --render, the sample rate: 11025, "
+                                  "22050, 44100 or 48000 (44100)."),
+      QCoreApplication::translate("main", "rate"));
+  parser.addOption(sampleRateOption);
+
+  QCommandLineOption stemsOption(
+      QStringList() << "stems",
+      QCoreApplication::translate(
+          "main",
+          "With --render, render a file per unit or group of each song."),
+      QCoreApplication::translate("main", "units|groups"));
+  parser.addOption(stemsOption);
+
+  QCommandLineOption formatOption(
+      QStringList() << "format",
+      QCoreApplication::translate(
+          "main", "With --render, the sample format of the WAVs (int16)."),
+      QCoreApplication::translate("main", "int16|int24|float32"));
+  parser.addOption(formatOption);
+
+  QCommandLineOption resampleOption(
+      QStringList() << "resample",
+      QCoreApplication::translate(
+          "main", "With --render, how voices are resampled (nearest)."),
+      QCoreApplication::translate("main", "nearest|sinc"));
+  parser.addOption(resampleOption);
+
+  QCommandLineOption jobsOption(
+      QStringList() << "j"
+                    << "jobs",
+      QCoreApplication::translate(
+          "main", "With --render, render <n> files at once (1)."),
+      QCoreApplication::translate("main", "n"));
+  parser.addOption(jobsOption);
+
   parser.addPositionalArgument(
       "file",
       QCoreApplication::translate("main", "Load this file when starting."),
@@ -147,6 +224,78 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  if (parser.isSet(renderOption)) {
+    BatchRenderOptions options;
+    options.destination = parser.value(renderOption);
+    bool ok = true;
+    auto parseDouble = [&](const QCommandLineOption &option, double *value) {
+      if (!parser.isSet(option)) return;
+      bool parsed;
+      *value = parser.value(option).toDouble(&parsed);
+      if (!parsed) qWarning() << "Could not parse" << option.names().last();
+      ok &= parsed;
+    };
+    auto parseInt = [&](const QCommandLineOption &option, int *value) {
+      if (!parser.isSet(option)) return;
+      bool parsed;
+      *value = parser.value(option).toInt(&parsed);
+      if (!parsed) qWarning() << "Could not parse" << option.names().last();
+      ok &= parsed;
+    };
+    if (parser.isSet(lengthOption)) {
+      double length;
+      parseDouble(lengthOption, &length);
+      options.length = length;
+    }
+    parseInt(loopsOption, &options.loops);
+    parseDouble(fadeoutOption, &options.fadeout);
+    parseDouble(volumeOption, &options.volume);
+    parseInt(sampleRateOption, &options.sample_rate);
+    parseInt(jobsOption, &options.jobs);
+    if (options.loops < 1) {
+      qWarning() << "--loops should be at least 1";
+      ok = false;
+    }
+    switch (options.sample_rate) {
+      // The rates pxtone supports.
+      case 11025:
+      case 22050:
+      case 44100:
+      case 48000:
+        break;
+      default:
+        qWarning() << "--sample-rate should be 11025, 22050, 44100 or 48000";
+        ok = false;
+    }
+    QString stems = parser.value(stemsOption);
+    if (stems == "units")
+      options.stems = pxtnSTEM_unit;
+    else if (stems == "groups")
+      options.stems = pxtnSTEM_group;
+    else if (stems != "") {
+      qWarning() << "--stems should be units or groups";
+      ok = false;
+    }
+    QString format = parser.value(formatOption);
+    if (format == "int24")
+      options.format = RenderFormat::Int24;
+    else if (format == "float32")
+      options.format = RenderFormat::Float32;
+    else if (format != "" && format != "int16") {
+      qWarning() << "--format should be int16, int24 or float32";
+      ok = false;
+    }
+    QString resample = parser.value(resampleOption);
+    if (resample == "sinc")
+      options.resample = pxtnRESAMPLE_sinc;
+    else if (resample != "" && resample != "nearest") {
+      qWarning() << "--resample should be nearest or sinc";
+      ok = false;
+    }
+    if (!ok) return 1;
+    return batchRender(parser.positionalArguments(), options) > 0 ? 1 : 0;
+  }
+
   bool startServerImmediately = false;
   std::optional<QString> filename = std::nullopt;
   if (parser.positionalArguments().length() > 1)
@@ -5,8 +5,7 @@
 namespace Action {
 
 void perform(const Primitive &a, pxtnService *pxtn, bool *widthChanged,
-             const NoIdMap &unit_id_map, const NoIdMap &woice_id_map,
-             pxtnEvelist::Hint *hint) {
+             const NoIdMap &unit_id_map, const NoIdMap &woice_id_map) {
   // if (a.kind == EVENTKIND_KEY) qDebug() << "Perform" << a;
   auto unit_no_maybe = unit_id_map.idToNo(a.unit_id);
   if (unit_no_maybe == std::nullopt) return;
@@ -20,7 +19,7 @@ void perform(const Primitive &a, pxtnService *pxtn, bool *widthChanged,
                             value = voice_no.value();
                           }
                           pxtn->evels->Record_Add_i(a.start_clock, unit_no,
-                                                    a.kind, value, hint);
+                                                    a.kind, value);
 
                           // -1 since end is exclusive
                           int end_clock = a.start_clock;
@@ -37,12 +36,12 @@ void perform(const Primitive &a, pxtnService *pxtn, bool *widthChanged,
                         },
                         [&](const Delete &b) {
                           pxtn->evels->Record_Delete(a.start_clock, b.end_clock,
-                                                     unit_no, a.kind, hint);
+                                                     unit_no, a.kind);
                         },
                         [&](const Shift &b) {
                           pxtn->evels->Record_Value_Change(
                               a.start_clock, b.end_clock, unit_no, a.kind,
-                              b.offset, hint);
+                              b.offset);
                         }},
              a.type);
 }
@@ -67,35 +66,22 @@ std::list<Primitive> get_undo(const Primitive &a, const pxtnService *pxtn,
           },
           [&](const Delete &b) {
             // find everything in this range and add actions to add
-            // them in.
-            if (Evelist_Kind_IsTail(a.kind)) {
-              const EVERECORD *p = pxtn->evels->get_Records();
-              for (; p && p->clock < a.start_clock; p = p->next) {
-                if (a.kind == p->kind && unit_no == p->unit_no)
-                  if (p->clock + p->value > a.start_clock) {
-                    // > instead of >= b/c exclusive. This was causing
-                    // undos to blow up in size because it'd lead to a
-                    // ton of empty noop actions that replace a note
-                    // with the same.
-                    undo.push_back(
-                        {a.kind, a.unit_id, p->clock, Delete{a.start_clock}});
-                    undo.push_back(
-                        {a.kind, a.unit_id, p->clock, Add{p->value}});
-                  }
+            // them in. The window also has the tails from before it that
+            // the delete cuts short. Only those that run past its start,
+            // not up to it, or undos fill up with noop actions that
+            // replace a note with the same.
+            for (const EVERECORD *p : pxtn->evels->get_Kind_Window(
+                     a.start_clock, b.end_clock, unit_no, a.kind)) {
+              if (p->clock < a.start_clock) {
+                undo.push_back(
+                    {a.kind, a.unit_id, p->clock, Delete{a.start_clock}});
+                undo.push_back({a.kind, a.unit_id, p->clock, Add{p->value}});
+                continue;
               }
-              for (; p && p->clock < b.end_clock; p = p->next)
-                if (a.kind == p->kind && unit_no == p->unit_no)
-                  undo.push_back({a.kind, a.unit_id, p->clock, Add{p->value}});
-            } else {
-              const EVERECORD *p = pxtn->evels->get_Records();
-              for (; p && p->clock < a.start_clock; p = p->next) continue;
-              for (; p && p->clock < b.end_clock; p = p->next)
-                if (a.kind == p->kind && unit_no == p->unit_no) {
-                  qint32 value = p->value;
-                  if (a.kind == EVENTKIND_VOICENO)
-                    value = woice_id_map.noToId(value);
-                  undo.push_back({a.kind, a.unit_id, p->clock, Add{value}});
-                }
+              qint32 value = p->value;
+              if (a.kind == EVENTKIND_VOICENO)
+                value = woice_id_map.noToId(value);
+              undo.push_back({a.kind, a.unit_id, p->clock, Add{value}});
             }
           },
           [&](const Shift &b) {
@@ -123,10 +109,9 @@ std::list<Primitive> apply_and_get_undo(const std::list<Primitive> &actions,
                                         const NoIdMap &unit_id_map,
                                         const NoIdMap &woice_id_map) {
   std::list<Primitive> undo;
-  pxtnEvelist::Hint hint = pxtn->evels->get_StartHint();
   for (const Primitive &a : actions) {
     undo.splice(undo.begin(), get_undo(a, pxtn, unit_id_map, woice_id_map));
-    perform(a, pxtn, widthChanged, unit_id_map, woice_id_map, &hint);
+    perform(a, pxtn, widthChanged, unit_id_map, woice_id_map);
   }
   return undo;
 }
@@ -1,6 +1,8 @@
 
 #include "./pxtnDelay.h"
 
+#include <algorithm>
+
 #include "./pxtn.h"
 #include "./pxtnMax.h"
 #include "./pxtnMem.h"
@@ -67,17 +69,67 @@ pxtnDelayTone::pxtnDelayTone(const pxtnDelay &delay, int32_t beat_num,
   }
 }
 
+pxtnDelayTone::pxtnDelayTone(const pxtnDelayTone &src) { *this = src; }
+
+pxtnDelayTone &pxtnDelayTone::operator=(const pxtnDelayTone &src) {
+  if (this == &src) return *this;
+  _smp_num = src._smp_num;
+  _offset = src._offset;
+  _rate_s32 = src._rate_s32;
+  for (int32_t c = 0; c < pxtnMAX_CHANNEL; c++) {
+    _bufs[c].reset();
+    if (!_smp_num) continue;
+    _bufs[c] = std::make_unique<int32_t[]>(_smp_num);
+    memcpy(_bufs[c].get(), src._bufs[c].get(), _smp_num * sizeof(int32_t));
+  }
+  return *this;
+}
+
 void pxtnDelayTone::Tone_Supple(const pxtnDelay &delay, int32_t ch,
-                                int32_t *group_smps) {
+                                int32_t *group_smps, int32_t group_stride,
+                                int32_t smp_num) {
   if (!_smp_num) return;
-  int32_t a = _bufs[ch][_offset] * _rate_s32 / 100;
-  if (delay.get_played()) group_smps[delay.get_group()] += a;
-  _bufs[ch][_offset] = group_smps[delay.get_group()];
+  int32_t *p = &group_smps[delay.get_group() * group_stride];
+  int32_t *buf = _bufs[ch].get();
+  bool b_played = delay.get_played();
+  int32_t offset = _offset;
+  for (int32_t i = 0; i < smp_num; i++) {
+    int32_t a = buf[offset] * _rate_s32 / 100;
+    if (b_played) p[i] += a;
+    buf[offset] = p[i];
+    if (++offset >= _smp_num) offset = 0;
+  }
 }
 
-void pxtnDelayTone::Tone_Increment() {
+void pxtnDelayTone::Tone_Increment(int32_t smp_num) {
   if (!_smp_num) return;
-  if (++_offset >= _smp_num) _offset = 0;
+  _offset = (_offset + smp_num) % _smp_num;
+}
+
+// Whether this delay will sound the same as [other] from here on, which it
+// does if they hold the same samples, even if at different offsets.
+bool pxtnDelayTone::sounds_like(const pxtnDelayTone &other) const {
+  if (_smp_num != other._smp_num || _rate_s32 != other._rate_s32)
+    return false;
+  if (!_smp_num) return true;
+  for (int32_t c = 0; c < pxtnMAX_CHANNEL; c++) {
+    const int32_t *a = _bufs[c].get(), *b = other._bufs[c].get();
+    // Compare in up to three runs, split where either offset wraps around.
+    int32_t i = 0, ia = _offset, ib = other._offset;
+    while (i < _smp_num) {
+      int32_t run = std::min(_smp_num - ia, _smp_num - ib);
+      run = std::min(run, _smp_num - i);
+      if (memcmp(&a[ia], &b[ib], run * sizeof(int32_t))) return false;
+      i += run;
+      ia = (ia + run) % _smp_num;
+      ib = (ib + run) % _smp_num;
+    }
+  }
+  return true;
+}
+
+size_t pxtnDelayTone::get_buf_size() const {
+  return size_t(_smp_num) * pxtnMAX_CHANNEL * sizeof(int32_t);
 }
 
 void pxtnDelayTone::Tone_Clear() {
@@ -54,9 +54,19 @@ class pxtnDelayTone {
  public:
   pxtnDelayTone(const pxtnDelay& delay, int32_t beat_num, float beat_tempo,
                 int32_t sps);
-  void Tone_Supple(const pxtnDelay& delay, int32_t ch_num, int32_t* group_smps);
-  void Tone_Increment();
+  pxtnDelayTone(const pxtnDelayTone& src);
+  pxtnDelayTone(pxtnDelayTone&& src) = default;
+  pxtnDelayTone& operator=(const pxtnDelayTone& src);
+  pxtnDelayTone& operator=(pxtnDelayTone&& src) = default;
+  // [group_smps] holds [smp_num] samples of channel [ch] for each group, with
+  // groups [group_stride] apart.
+  void Tone_Supple(const pxtnDelay& delay, int32_t ch, int32_t* group_smps,
+                   int32_t group_stride, int32_t smp_num);
+  void Tone_Increment(int32_t smp_num);
   void Tone_Clear();
+  bool sounds_like(const pxtnDelayTone& other) const;
+  // The size of the buffers in bytes.
+  size_t get_buf_size() const;
 };
 
 #endif
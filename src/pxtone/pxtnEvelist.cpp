@@ -1,6 +1,8 @@
 
 #include "./pxtnEvelist.h"
 
+#include <algorithm>
+
 const char* EVENTKIND_names[EVENTKIND_NUM] = {
     "EVENTKIND_NULL",       "EVENTKIND_ON",        "EVENTKIND_KEY",
     "EVENTKIND_PAN_VOLUME", "EVENTKIND_VELOCITY",  "EVENTKIND_VOLUME",
@@ -10,16 +12,14 @@ const char* EVENTKIND_names[EVENTKIND_NUM] = {
     "EVENTKIND_PAN_TIME"};
 
 void pxtnEvelist::Release() {
-  if (_eves) free(_eves);
-  _eves = NULL;
-  _start = NULL;
-  _eve_allocated_num = 0;
+  Clear();
+  _eve_max_num = 0;
 }
 
 pxtnEvelist::pxtnEvelist() {
-  _eves = NULL;
   _start = NULL;
-  _eve_allocated_num = 0;
+  _eve_max_num = 0;
+  _fresh_num = 0;
   _linear = 0;
   _p_x4x_rec = 0;
 }
@@ -27,23 +27,25 @@ pxtnEvelist::pxtnEvelist() {
 pxtnEvelist::~pxtnEvelist() { pxtnEvelist::Release(); }
 
 void pxtnEvelist::Clear() {
-  if (_eves) memset(_eves, 0, sizeof(EVERECORD) * _eve_allocated_num);
+  for (_CHUNK* p_chunk : _chunks) free(p_chunk);
+  _chunks.clear();
   _start = NULL;
+  _free_recs.clear();
+  _fresh_num = 0;
+  _clock_anchors.clear();
+  _kind_anchors.clear();
+  _tail_nums.clear();
+  _edited(0);
 }
 
 bool pxtnEvelist::Allocate(int32_t max_event_num) {
   pxtnEvelist::Release();
-  if (!(_eves = (EVERECORD*)malloc(sizeof(EVERECORD) * max_event_num)))
-    return false;
-  memset(_eves, 0, sizeof(EVERECORD) * max_event_num);
-  _eve_allocated_num = max_event_num;
+  if (max_event_num < 0) return false;
+  _eve_max_num = max_event_num;
   return true;
 }
 
-int32_t pxtnEvelist::get_Num_Max() const {
-  if (!_eves) return 0;
-  return _eve_allocated_num;
-}
+int32_t pxtnEvelist::get_Num_Max() const { return _eve_max_num; }
 
 int32_t pxtnEvelist::get_Max_Clock() const {
   int32_t max_clock = 0;
@@ -61,7 +63,7 @@ int32_t pxtnEvelist::get_Max_Clock() const {
 }
 
 int32_t pxtnEvelist::get_Count() const {
-  if (!_eves || !_start) return 0;
+  if (!_eve_max_num || !_start) return 0;
 
   int32_t count = 0;
   for (EVERECORD* p = _start; p; p = p->next) count++;
@@ -69,7 +71,7 @@ int32_t pxtnEvelist::get_Count() const {
 }
 
 int32_t pxtnEvelist::get_Count(uint8_t kind, int32_t value) const {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
   for (EVERECORD* p = _start; p; p = p->next) {
@@ -79,7 +81,7 @@ int32_t pxtnEvelist::get_Count(uint8_t kind, int32_t value) const {
 }
 
 int32_t pxtnEvelist::get_Count(uint8_t unit_no) const {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
   for (EVERECORD* p = _start; p; p = p->next) {
@@ -89,21 +91,24 @@ int32_t pxtnEvelist::get_Count(uint8_t unit_no) const {
 }
 
 int32_t pxtnEvelist::get_Count(uint8_t unit_no, uint8_t kind) const {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
-  for (EVERECORD* p = _start; p; p = p->next) {
-    if (p->unit_no == unit_no && p->kind == kind) count++;
-  }
+  for (EVERECORD* p = _kind_first(INT32_MIN, unit_no, kind); p;
+       p = _next_kind(p))
+    count++;
   return count;
 }
 
 int32_t pxtnEvelist::get_Count(int32_t clock1, int32_t clock2,
                                uint8_t unit_no) const {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
+  int32_t clock_from =
+      std::min(_tail_from(clock1, unit_no, EVENTKIND_ON),
+               _tail_from(clock1, unit_no, EVENTKIND_PORTAMENT));
   EVERECORD* p;
-  for (p = _start; p; p = p->next) {
+  for (p = _clock_first(clock_from); p; p = p->next) {
     if (p->unit_no == unit_no) {
       if (p->clock >= clock1) break;
       if (Evelist_Kind_IsTail(p->kind) && p->clock + p->value > clock1) break;
@@ -158,31 +163,54 @@ int32_t DefaultKindValue(uint8_t kind) {
 
 int32_t pxtnEvelist::get_Value(int32_t clock, uint8_t unit_no,
                                uint8_t kind) const {
-  if (!_eves) return 0;
-
-  EVERECORD* p;
-  int32_t val = DefaultKindValue(kind);
+  if (!_eve_max_num) return 0;
 
-  for (p = _start; p; p = p->next) {
-    if (p->clock > clock) break;
-    if (p->unit_no == unit_no && p->kind == kind) val = p->value;
-  }
-
-  return val;
+  EVERECORD* p = _kind_last(clock, unit_no, kind);
+  return (p ? p->value : DefaultKindValue(kind));
 }
 
 const EVERECORD* pxtnEvelist::get_Records() const {
-  if (!_eves) return NULL;
+  if (!_eve_max_num) return NULL;
   return _start;
 }
 
-pxtnEvelist::Hint pxtnEvelist::get_StartHint() const {
-  Hint h{};
-  if (!_eves)
-    h.eve = nullptr;
-  else
-    h.eve = _start;
-  return h;
+const EVERECORD* pxtnEvelist::get_Kind_First(int32_t clock, uint8_t unit_no,
+                                             uint8_t kind) const {
+  return _kind_first(clock, unit_no, kind);
+}
+
+const EVERECORD* pxtnEvelist::get_Kind_Last(int32_t clock, uint8_t unit_no,
+                                            uint8_t kind) const {
+  return _kind_last(clock, unit_no, kind);
+}
+
+pxtnEvelist::KindWindow pxtnEvelist::get_Kind_Window(int32_t clock1,
+                                                     int32_t clock2,
+                                                     uint8_t unit_no,
+                                                     uint8_t kind) const {
+  int32_t clock_from = _tail_from(clock1, unit_no, kind);
+  return KindWindow(this, _kind_first(clock_from, unit_no, kind), clock1,
+                    clock2);
+}
+
+std::shared_ptr<std::atomic<int32_t>> pxtnEvelist::Watch_Edits() {
+  auto watch = std::make_shared<std::atomic<int32_t>>(INT32_MAX);
+  _watches.push_back(watch);
+  return watch;
+}
+
+void pxtnEvelist::_edited(int32_t clock) {
+  for (size_t i = 0; i < _watches.size();) {
+    std::shared_ptr<std::atomic<int32_t>> watch = _watches[i].lock();
+    if (!watch) {
+      _watches.erase(_watches.begin() + i);
+      continue;
+    }
+    int32_t old = watch->load();
+    while (clock < old && !watch->compare_exchange_weak(old, clock)) {
+    }
+    i++;
+  }
 }
 
 void pxtnEvelist::_rec_set(EVERECORD* p_rec, EVERECORD* prev, EVERECORD* next,
@@ -192,14 +220,18 @@ void pxtnEvelist::_rec_set(EVERECORD* p_rec, EVERECORD* prev, EVERECORD* next,
     prev->next = p_rec;
   else
     _start = p_rec;
-  if (next) next->prev = p_rec;
+  if (next) _set_prev(next, p_rec);
 
   p_rec->next = next;
-  p_rec->prev = prev;
+  _set_prev(p_rec, prev);
   p_rec->clock = clock;
   p_rec->kind = kind;
   p_rec->unit_no = unit_no;
   p_rec->value = value;
+  _anchor_add(_clock_anchors, p_rec, prev, false);
+  _tail_count(p_rec, 1);
+  _kind_link(p_rec);
+  _edited(clock);
 }
 
 static int32_t _ComparePriority(uint8_t kind1, uint8_t kind2) {
@@ -226,38 +258,317 @@ static int32_t _ComparePriority(uint8_t kind1, uint8_t kind2) {
 }
 
 void pxtnEvelist::_rec_cut(EVERECORD* p_rec) {
-  if (p_rec->prev)
-    p_rec->prev->next = p_rec->next;
+  _anchor_cut(_clock_anchors, p_rec, false);
+  _tail_count(p_rec, -1);
+  EVERECORD* prev = _prev(p_rec);
+  EVERECORD* next = p_rec->next;
+  if (prev)
+    prev->next = next;
   else
-    _start = p_rec->next;
-  if (p_rec->next) p_rec->next->prev = p_rec->prev;
+    _start = next;
+  if (next) _set_prev(next, prev);
+  _kind_cut(p_rec);
+  _rec_free(p_rec);
+  _edited(p_rec->clock);
+}
+
+// A record that isn't in use, or NULL if they all are.
+EVERECORD* pxtnEvelist::_rec_alloc() {
+  if (!_free_recs.empty()) {
+    EVERECORD* p_rec = _free_recs.back();
+    _free_recs.pop_back();
+    return p_rec;
+  }
+  if (_fresh_num >= _eve_max_num) return NULL;
+  if (_fresh_num == (int64_t)_chunks.size() * _CHUNK_NUM) {
+    _CHUNK* p_chunk = (_CHUNK*)malloc(sizeof(_CHUNK));
+    if (!p_chunk) return NULL;
+    memset(p_chunk, 0, sizeof(_CHUNK));
+    _chunks.push_back(p_chunk);
+  }
+  EVERECORD* p_rec = _rec_at(_fresh_num);
+  p_rec->rec_no = _fresh_num++;
+  return p_rec;
+}
+
+// Marks [p_rec], already out of the list, as not in use. Its links are left
+// alone for loops that cut records as they go.
+void pxtnEvelist::_rec_free(EVERECORD* p_rec) {
   p_rec->kind = EVENTKIND_NULL;
+  _free_recs.push_back(p_rec);
+}
+
+// The first of [anchors] with a clock after [clock].
+template <class ANCHORS>
+static auto _anchor_after(ANCHORS& anchors, int32_t clock)
+    -> decltype(anchors.begin()) {
+  return std::partition_point(anchors.begin(), anchors.end(),
+                              [&](const auto& a) { return a.clock <= clock; });
+}
+
+// The first record at or after [clock] of the list or chain [anchors] are
+// for, or NULL if there's none.
+EVERECORD* pxtnEvelist::_anchor_first(const std::vector<_ANCHOR>& anchors,
+                                      int32_t clock, bool by_kind) const {
+  auto it =
+      std::partition_point(anchors.begin(), anchors.end(),
+                           [&](const _ANCHOR& a) { return a.clock < clock; });
+  if (it == anchors.begin()) return (it == anchors.end() ? NULL : it->p);
+  EVERECORD* p = (it - 1)->p;
+  while (p && p->clock < clock) p = _step(p, by_kind);
+  return p;
+}
+
+// The last record at or before [clock], or NULL if there's none.
+EVERECORD* pxtnEvelist::_anchor_last(const std::vector<_ANCHOR>& anchors,
+                                     int32_t clock, bool by_kind) const {
+  auto it = _anchor_after(anchors, clock);
+  if (it == anchors.begin()) return NULL;
+  EVERECORD* p = (it - 1)->p;
+  for (EVERECORD* next; (next = _step(p, by_kind)) && next->clock <= clock;)
+    p = next;
+  return p;
+}
+
+// For building anchors in order, [prev] being the record before [p_rec].
+void pxtnEvelist::_anchor_push(std::vector<_ANCHOR>& anchors, EVERECORD* p_rec,
+                               const EVERECORD* prev) {
+  if (anchors.empty() ||
+      (anchors.back().num >= _ANCHOR_GAP && prev->clock != p_rec->clock))
+    anchors.push_back({p_rec->clock, 1, p_rec});
+  else
+    anchors.back().num++;
+}
+
+// Call once [p_rec] is in the list or chain, after [prev].
+void pxtnEvelist::_anchor_add(std::vector<_ANCHOR>& anchors, EVERECORD* p_rec,
+                              const EVERECORD* prev, bool by_kind) {
+  if (anchors.empty()) {
+    anchors.push_back({p_rec->clock, 1, p_rec});
+    return;
+  }
+  auto it = _anchor_after(anchors, p_rec->clock);
+  if (it == anchors.begin()) it++;
+  _ANCHOR& a = *(it - 1);
+  a.num++;
+  if (!prev || (a.clock == p_rec->clock && prev->clock != p_rec->clock)) {
+    a.clock = p_rec->clock;
+    a.p = p_rec;
+  }
+  // Split the gap where a clock starts nearest its middle. There might be no
+  // such place, so only try again once the gap has doubled.
+  if (a.num < _ANCHOR_GAP * 2 || (a.num & (a.num - 1))) return;
+  int32_t half = a.num / 2;
+  int32_t split_n = 0;
+  EVERECORD* split = NULL;
+  EVERECORD* p = a.p;
+  for (int32_t n = 1; n < a.num; n++) {
+    EVERECORD* next = _step(p, by_kind);
+    if (next->clock != p->clock && abs(n - half) < abs(split_n - half)) {
+      split = next;
+      split_n = n;
+    }
+    p = next;
+  }
+  if (!split) return;
+  int32_t rest = a.num - split_n;
+  a.num = split_n;
+  anchors.insert(it, {split->clock, rest, split});
+}
+
+// Call before [p_rec] is taken out of the list or chain.
+void pxtnEvelist::_anchor_cut(std::vector<_ANCHOR>& anchors,
+                              const EVERECORD* p_rec, bool by_kind) {
+  auto it = _anchor_after(anchors, p_rec->clock) - 1;
+  it->num--;
+  if (it->p == p_rec) {
+    if (!it->num) {
+      anchors.erase(it);
+      return;
+    }
+    it->p = _step(p_rec, by_kind);
+    it->clock = it->p->clock;
+  }
+  if (it != anchors.begin() && (it - 1)->num + it->num <= _ANCHOR_GAP) {
+    (it - 1)->num += it->num;
+    anchors.erase(it);
+  }
+}
+
+// The records of each unit and kind are also chained together in list order,
+// with their own anchors, so that they can be found without walking the
+// events in between. Playback uses this to find a unit's next note. A note
+// can be cut short by the next one, so changing which ON follows it is an
+// edit at the note too.
+
+// Links [p_rec], already in the list, into its unit and kind's chain.
+void pxtnEvelist::_kind_link(EVERECORD* p_rec) {
+  EVERECORD* prev = NULL;
+  for (EVERECORD* p = _prev(p_rec); p && p->clock == p_rec->clock;
+       p = _prev(p)) {
+    if (p->unit_no == p_rec->unit_no && p->kind == p_rec->kind) {
+      prev = p;
+      break;
+    }
+  }
+  if (!prev) prev = _kind_last(p_rec->clock - 1, p_rec->unit_no, p_rec->kind);
+
+  EVERECORD* next =
+      (prev ? _next_kind(prev)
+            : _kind_first(INT32_MIN, p_rec->unit_no, p_rec->kind));
+  _set_prev_kind(p_rec, prev);
+  _set_next_kind(p_rec, next);
+  if (next) _set_prev_kind(next, p_rec);
+  if (prev) {
+    _set_next_kind(prev, p_rec);
+    if (p_rec->kind == EVENTKIND_ON) _edited(prev->clock);
+  }
+  _anchor_add(_kind_anchors[p_rec->unit_no << 8 | p_rec->kind], p_rec, prev,
+              true);
+}
+
+void pxtnEvelist::_kind_cut(EVERECORD* p_rec) {
+  auto it = _kind_anchors.find(p_rec->unit_no << 8 | p_rec->kind);
+  _anchor_cut(it->second, p_rec, true);
+  if (it->second.empty()) _kind_anchors.erase(it);
+  EVERECORD* prev = _prev_kind(p_rec);
+  EVERECORD* next = _next_kind(p_rec);
+  if (prev) {
+    _set_next_kind(prev, next);
+    if (p_rec->kind == EVENTKIND_ON) _edited(prev->clock);
+  }
+  if (next) _set_prev_kind(next, prev);
+  _set_prev_kind(p_rec, NULL);
+  _set_next_kind(p_rec, NULL);
+}
+
+void pxtnEvelist::_kind_set_next(EVERECORD* p_rec, EVERECORD* next_kind) {
+  if (p_rec->kind == EVENTKIND_ON && _next_kind(p_rec) != next_kind)
+    _edited(p_rec->clock);
+  _set_next_kind(p_rec, next_kind);
+}
+
+// For changes that move lots of records between units or in time.
+void pxtnEvelist::_kind_rebuild() {
+  std::vector<EVERECORD*> lasts(1 << 16);
+  std::vector<std::vector<_ANCHOR>*> anchors(1 << 16);
+  _kind_anchors.clear();
+  for (EVERECORD* p = _start; p; p = p->next) {
+    uint16_t key = p->unit_no << 8 | p->kind;
+    EVERECORD*& last = lasts[key];
+    _set_prev_kind(p, last);
+    if (last) _kind_set_next(last, p);
+    if (!anchors[key]) anchors[key] = &_kind_anchors[key];
+    _anchor_push(*anchors[key], p, last);
+    last = p;
+  }
+  for (EVERECORD* p : lasts)
+    if (p) _kind_set_next(p, NULL);
+}
+
+// The first record of [unit_no] and [kind] at or after [clock], or NULL.
+EVERECORD* pxtnEvelist::_kind_first(int32_t clock, uint8_t unit_no,
+                                    uint8_t kind) const {
+  auto it = _kind_anchors.find(unit_no << 8 | kind);
+  if (it == _kind_anchors.end()) return NULL;
+  return _anchor_first(it->second, clock, true);
+}
+
+// The last record of [unit_no] and [kind] at or before [clock], or NULL.
+EVERECORD* pxtnEvelist::_kind_last(int32_t clock, uint8_t unit_no,
+                                   uint8_t kind) const {
+  auto it = _kind_anchors.find(unit_no << 8 | kind);
+  if (it == _kind_anchors.end()) return NULL;
+  return _anchor_last(it->second, clock, true);
+}
+
+// For changes that move records in time, or add them without _rec_set.
+void pxtnEvelist::_clock_rebuild() {
+  _clock_anchors.clear();
+  _tail_nums.clear();
+  for (EVERECORD* p = _start; p; p = p->next) {
+    _anchor_push(_clock_anchors, p, _prev(p));
+    _tail_count(p, 1);
+  }
+}
+
+// The first record at or after [clock], or NULL if there's none.
+EVERECORD* pxtnEvelist::_clock_first(int32_t clock) const {
+  return _anchor_first(_clock_anchors, clock, false);
+}
+
+// The last record at or before [clock], or NULL if there's none.
+EVERECORD* pxtnEvelist::_clock_last(int32_t clock) const {
+  return _anchor_last(_clock_anchors, clock, false);
+}
+
+// Adds [num] to the count of tails as long as [p_rec]'s.
+void pxtnEvelist::_tail_count(const EVERECORD* p_rec, int32_t num) {
+  if (!Evelist_Kind_IsTail(p_rec->kind)) return;
+  auto it = _tail_nums.emplace(p_rec->value, 0).first;
+  it->second += num;
+  if (!it->second) _tail_nums.erase(it);
+}
+
+int32_t pxtnEvelist::_tail_max() const {
+  return (_tail_nums.empty() ? 0 : _tail_nums.rbegin()->first);
+}
+
+// The earliest clock of the records of [unit_no] and [kind] from before
+// [clock] whose tails reach it, or [clock] if there are none.
+int32_t pxtnEvelist::_tail_from(int32_t clock, uint8_t unit_no,
+                                uint8_t kind) const {
+  if (!Evelist_Kind_IsTail(kind)) return clock;
+  int32_t from = clock;
+  int32_t tail_max = _tail_max();
+  for (const EVERECORD* p = _kind_last(clock - 1, unit_no, kind);
+       p && p->clock > clock - tail_max; p = _prev_kind(p)) {
+    if (p->clock + p->value > clock) from = p->clock;
+  }
+  return from;
+}
+
+// Cuts short the tails of [unit_no] and [kind] from before [clock] that run
+// past it, returning how many there were.
+int32_t pxtnEvelist::_tail_trim(int32_t clock, uint8_t unit_no, uint8_t kind) {
+  int32_t count = 0;
+  int32_t tail_max = _tail_max();
+  for (EVERECORD* p = _kind_last(clock - 1, unit_no, kind);
+       p && p->clock > clock - tail_max; p = _prev_kind(p)) {
+    if (p->clock + p->value > clock) {
+      _value_set(p, clock - p->clock);
+      _edited(p->clock);
+      count++;
+    }
+  }
+  return count;
+}
+
+// Sets the value of [p_rec], already in the list.
+void pxtnEvelist::_value_set(EVERECORD* p_rec, int32_t value) {
+  _tail_count(p_rec, -1);
+  p_rec->value = value;
+  _tail_count(p_rec, 1);
 }
 
 bool pxtnEvelist::Record_Add_f(int32_t clock, uint8_t unit_no, uint8_t kind,
                                float value_f) {
   int32_t value;
   memcpy(&value, &value_f, sizeof(value));
-  return Record_Add_i(clock, unit_no, kind, value, nullptr);
+  return Record_Add_i(clock, unit_no, kind, value);
 }
 
 #include <QDebug>
 bool pxtnEvelist::Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
-                               int32_t value, pxtnEvelist::Hint* hint) {
-  if (!_eves) return false;
+                               int32_t value) {
+  if (!_eve_max_num) return false;
 
   EVERECORD* p_new = NULL;
   EVERECORD* p_prev = NULL;
   EVERECORD* p_next = NULL;
 
   // 空き検索
-  for (int32_t r = 0; r < _eve_allocated_num; r++) {
-    if (_eves[r].kind == EVENTKIND_NULL) {
-      p_new = &_eves[r];
-      break;
-    }
-  }
-  if (!p_new) return false;
+  if (!(p_new = _rec_alloc())) return false;
 
   // first.
   if (!_start) {
@@ -266,34 +577,26 @@ bool pxtnEvelist::Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
   else if (clock < _start->clock) {
     p_next = _start;
   } else {
-    EVERECORD* p = _start;
-    if (hint && hint->eve) {
-      // try to set up hint to be the first p s.t. p->clock >= clock,
-      // since I may be adding other things with the same clock (or slightly
-      // later clock) after
-      p = hint->eve;
-      while (p->prev && p->prev->clock >= clock) p = p->prev;
-      hint->eve = p;
-    }
+    EVERECORD* p = _clock_first(clock);
+    if (!p) p = _clock_last(clock);
 
     for (; p; p = p->next) {
       if (p->clock == clock)  // 同時
       {
-        if (hint) hint->eve = p;
         for (; true; p = p->next) {
           if (p->clock != clock) {
-            p_prev = p->prev;
+            p_prev = _prev(p);
             p_next = p;
             break;
           }
           if (unit_no == p->unit_no && kind == p->kind) {
-            p_prev = p->prev;
+            p_prev = _prev(p);
             p_next = p->next;
-            p->kind = EVENTKIND_NULL;
+            _rec_cut(p);
             break;
           }  // 置き換え
           if (_ComparePriority(kind, p->kind) < 0) {
-            p_prev = p->prev;
+            p_prev = _prev(p);
             p_next = p;
             break;
           }  // プライオリティを検査
@@ -304,8 +607,7 @@ bool pxtnEvelist::Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
         }
         break;
       } else if (p->clock > clock) {
-        if (hint) hint->eve = p;
-        p_prev = p->prev;
+        p_prev = _prev(p);
         p_next = p;
         break;
       }  // 追い越した
@@ -320,21 +622,20 @@ bool pxtnEvelist::Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
 
   // cut prev tail
   if (Evelist_Kind_IsTail(kind)) {
-    for (EVERECORD* p = p_new->prev; p; p = p->prev) {
-      if (p->unit_no == unit_no && p->kind == kind) {
-        if (clock < p->clock + p->value) p->value = clock - p->clock;
-        break;
-      }
+    EVERECORD* p = _prev_kind(p_new);
+    if (p && clock < p->clock + p->value) {
+      _value_set(p, clock - p->clock);
+      _edited(p->clock);
     }
   }
 
   // delete next
   if (Evelist_Kind_IsTail(kind)) {
-    for (EVERECORD* p = p_new->next; p && p->clock < clock + value;
-         p = p->next) {
-      if (p->unit_no == unit_no && p->kind == kind) {
-        _rec_cut(p);
-      }
+    EVERECORD* p_next_kind;
+    for (EVERECORD* p = _next_kind(p_new); p && p->clock < clock + value;
+         p = p_next_kind) {
+      p_next_kind = _next_kind(p);
+      _rec_cut(p);
     }
   }
 
@@ -342,75 +643,46 @@ bool pxtnEvelist::Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
 }
 
 int32_t pxtnEvelist::Record_Delete(int32_t clock1, int32_t clock2,
-                                   uint8_t unit_no, uint8_t kind,
-                                   pxtnEvelist::Hint* hint) {
-  if (!_eves) return 0;
+                                   uint8_t unit_no, uint8_t kind) {
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
-  EVERECORD* p = _start;
-  // Try to set up hint to be the last p with p->clock < clock, since I may get
-  // multiple deletions in the same range in a row. Or I may get a list of
-  // deletions going backwards.
-  if (hint && hint->eve) {
-    p = hint->eve;
-    while (p->prev && p->prev->clock >= clock1) p = p->prev;
-    hint->eve = p->prev;
-  }
-
-  for (; p; p = p->next) {
+  EVERECORD* p_next_kind;
+  for (EVERECORD* p = _kind_first(clock1, unit_no, kind); p; p = p_next_kind) {
     if (p->clock != clock1 && p->clock >= clock2) break;
-    if (p->clock >= clock1) {
-      if (p->unit_no == unit_no && p->kind == kind) {
-        _rec_cut(p);
-        count++;
-      }
-    } else if (hint)
-      hint->eve = p;
+    p_next_kind = _next_kind(p);
+    _rec_cut(p);
+    count++;
   }
 
-  if (Evelist_Kind_IsTail(kind)) {
-    for (EVERECORD* p = _start; p; p = p->next) {
-      if (p->clock >= clock1) break;
-      if (p->unit_no == unit_no && p->kind == kind &&
-          p->clock + p->value > clock1) {
-        p->value = clock1 - p->clock;
-        count++;
-      }
-    }
-  }
+  if (Evelist_Kind_IsTail(kind)) count += _tail_trim(clock1, unit_no, kind);
 
   return count;
 }
 
 int32_t pxtnEvelist::Record_Delete(int32_t clock1, int32_t clock2,
                                    uint8_t unit_no) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
-  for (EVERECORD* p = _start; p; p = p->next) {
+  for (EVERECORD* p = _clock_first(clock1); p; p = p->next) {
     if (p->clock != clock1 && p->clock >= clock2) break;
-    if (p->clock >= clock1 && p->unit_no == unit_no) {
+    if (p->unit_no == unit_no) {
       _rec_cut(p);
       count++;
     }
   }
 
-  for (EVERECORD* p = _start; p; p = p->next) {
-    if (p->clock >= clock1) break;
-    if (p->unit_no == unit_no && Evelist_Kind_IsTail(p->kind) &&
-        p->clock + p->value > clock1) {
-      p->value = clock1 - p->clock;
-      count++;
-    }
-  }
+  count += _tail_trim(clock1, unit_no, EVENTKIND_ON);
+  count += _tail_trim(clock1, unit_no, EVENTKIND_PORTAMENT);
 
   return count;
 }
 
 int32_t pxtnEvelist::Record_UnitNo_Miss(uint8_t unit_no) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
@@ -420,25 +692,29 @@ int32_t pxtnEvelist::Record_UnitNo_Miss(uint8_t unit_no) {
       count++;
     } else if (p->unit_no > unit_no) {
       p->unit_no--;
+      _edited(p->clock);
       count++;
     }
   }
+  _kind_rebuild();
   return count;
 }
 
 int32_t pxtnEvelist::Record_UnitNo_Set(uint8_t unit_no) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
   for (EVERECORD* p = _start; p; p = p->next) {
     p->unit_no = unit_no;
+    _edited(p->clock);
     count++;
   }
+  _kind_rebuild();
   return count;
 }
 
 int32_t pxtnEvelist::Record_UnitNo_Replace(uint8_t old_u, uint8_t new_u) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
@@ -447,9 +723,11 @@ int32_t pxtnEvelist::Record_UnitNo_Replace(uint8_t old_u, uint8_t new_u) {
     for (EVERECORD* p = _start; p; p = p->next) {
       if (p->unit_no == old_u) {
         p->unit_no = new_u;
+        _edited(p->clock);
         count++;
       } else if (p->unit_no > old_u && p->unit_no <= new_u) {
         p->unit_no--;
+        _edited(p->clock);
         count++;
       }
     }
@@ -457,37 +735,39 @@ int32_t pxtnEvelist::Record_UnitNo_Replace(uint8_t old_u, uint8_t new_u) {
     for (EVERECORD* p = _start; p; p = p->next) {
       if (p->unit_no == old_u) {
         p->unit_no = new_u;
+        _edited(p->clock);
         count++;
       } else if (p->unit_no < old_u && p->unit_no >= new_u) {
         p->unit_no++;
+        _edited(p->clock);
         count++;
       }
     }
   }
 
+  _kind_rebuild();
   return count;
 }
 
 int32_t pxtnEvelist::Record_Value_Set(int32_t clock1, int32_t clock2,
                                       uint8_t unit_no, uint8_t kind,
                                       int32_t value) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
-  for (EVERECORD* p = _start; p; p = p->next) {
-    if (p->unit_no == unit_no && p->kind == kind && p->clock >= clock1 &&
-        p->clock < clock2) {
-      p->value = value;
-      count++;
-    }
+  for (EVERECORD* p = _kind_first(clock1, unit_no, kind);
+       p && p->clock < clock2; p = _next_kind(p)) {
+    _value_set(p, value);
+    _edited(p->clock);
+    count++;
   }
 
   return count;
 }
 
 int32_t pxtnEvelist::BeatClockOperation(int32_t rate) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
@@ -496,15 +776,17 @@ int32_t pxtnEvelist::BeatClockOperation(int32_t rate) {
     if (Evelist_Kind_IsTail(p->kind)) p->value *= rate;
     count++;
   }
+  _kind_rebuild();
+  _clock_rebuild();
+  _edited(0);
 
   return count;
 }
 
 int32_t pxtnEvelist::Record_Value_Change(int32_t clock1, int32_t clock2,
                                          uint8_t unit_no, uint8_t kind,
-                                         int32_t value,
-                                         pxtnEvelist::Hint* hint) {
-  if (!_eves) return 0;
+                                         int32_t value) {
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
@@ -544,31 +826,22 @@ int32_t pxtnEvelist::Record_Value_Change(int32_t clock1, int32_t clock2,
       min = 0;
   }
 
-  EVERECORD* p = _start;
-  // hint is set to roughly some time between t1 and t2.
-  if (hint && hint->eve) {
-    p = hint->eve;
-    while (p->prev && p->prev->clock >= clock1) p = p->prev;
-    hint->eve = p;
-  }
-
-  for (; p; p = p->next) {
-    if (p->unit_no == unit_no && p->kind == kind && p->clock >= clock1) {
-      if (clock2 == -1 || p->clock < clock2) {
-        p->value += value;
-        if (p->value < min) p->value = min;
-        if (p->value > max) p->value = max;
-        count++;
-      }
-    }
+  for (EVERECORD* p = _kind_first(clock1, unit_no, kind); p;
+       p = _next_kind(p)) {
+    if (clock2 != -1 && p->clock >= clock2) break;
+    int32_t new_value = p->value + value;
+    if (new_value < min) new_value = min;
+    if (new_value > max) new_value = max;
+    _value_set(p, new_value);
+    _edited(p->clock);
+    count++;
   }
-  if (hint) hint->eve = p;
 
   return count;
 }
 
 int32_t pxtnEvelist::Record_Value_Omit(uint8_t kind, int32_t value) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
@@ -578,7 +851,8 @@ int32_t pxtnEvelist::Record_Value_Omit(uint8_t kind, int32_t value) {
         _rec_cut(p);
         count++;
       } else if (p->value > value) {
-        p->value--;
+        _value_set(p, p->value - 1);
+        _edited(p->clock);
         count++;
       }
     }
@@ -588,7 +862,7 @@ int32_t pxtnEvelist::Record_Value_Omit(uint8_t kind, int32_t value) {
 
 int32_t pxtnEvelist::Record_Value_Replace(uint8_t kind, int32_t old_value,
                                           int32_t new_value) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
 
   int32_t count = 0;
 
@@ -597,10 +871,12 @@ int32_t pxtnEvelist::Record_Value_Replace(uint8_t kind, int32_t old_value,
     for (EVERECORD* p = _start; p; p = p->next) {
       if (p->kind == kind) {
         if (p->value == old_value) {
-          p->value = new_value;
+          _value_set(p, new_value);
+          _edited(p->clock);
           count++;
         } else if (p->value > old_value && p->value <= new_value) {
-          p->value--;
+          _value_set(p, p->value - 1);
+          _edited(p->clock);
           count++;
         }
       }
@@ -609,10 +885,12 @@ int32_t pxtnEvelist::Record_Value_Replace(uint8_t kind, int32_t old_value,
     for (EVERECORD* p = _start; p; p = p->next) {
       if (p->kind == kind) {
         if (p->value == old_value) {
-          p->value = new_value;
+          _value_set(p, new_value);
+          _edited(p->clock);
           count++;
         } else if (p->value < old_value && p->value >= new_value) {
-          p->value++;
+          _value_set(p, p->value + 1);
+          _edited(p->clock);
           count++;
         }
       }
@@ -624,7 +902,7 @@ int32_t pxtnEvelist::Record_Value_Replace(uint8_t kind, int32_t old_value,
 
 int32_t pxtnEvelist::Record_Clock_Shift(int32_t clock, int32_t shift,
                                         uint8_t unit_no) {
-  if (!_eves) return 0;
+  if (!_eve_max_num) return 0;
   if (!_start) return 0;
   if (!shift) return 0;
 
@@ -637,18 +915,18 @@ int32_t pxtnEvelist::Record_Clock_Shift(int32_t clock, int32_t shift,
   EVERECORD* p = _start;
 
   if (shift < 0) {
-    for (; p; p = p->next) {
-      if (p->clock >= clock) break;
-    }
+    p = _clock_first(clock);
     while (p) {
-      if (p->unit_no == unit_no) {
+      // Adding a record can delete later ones that its tail covers, which are
+      // skipped.
+      if (p->unit_no == unit_no && p->kind != EVENTKIND_NULL) {
         c = p->clock + shift;
         k = p->kind;
         v = p->value;
         p_next = p->next;
 
         _rec_cut(p);
-        if (c >= 0) Record_Add_i(c, unit_no, k, v, nullptr);
+        if (c >= 0) Record_Add_i(c, unit_no, k, v);
         count++;
 
         p = p_next;
@@ -657,7 +935,7 @@ int32_t pxtnEvelist::Record_Clock_Shift(int32_t clock, int32_t shift,
       }
     }
   } else if (shift > 0) {
-    while (p->next) p = p->next;
+    p = _clock_last(INT32_MAX);
     while (p) {
       if (p->clock < clock) break;
 
@@ -665,15 +943,15 @@ int32_t pxtnEvelist::Record_Clock_Shift(int32_t clock, int32_t shift,
         c = p->clock + shift;
         k = p->kind;
         v = p->value;
-        p_prev = p->prev;
+        p_prev = _prev(p);
 
         _rec_cut(p);
-        Record_Add_i(c, unit_no, k, v, nullptr);
+        Record_Add_i(c, unit_no, k, v);
         count++;
 
         p = p_prev;
       } else {
-        p = p->prev;
+        p = _prev(p);
       }
     }
   }
@@ -685,7 +963,7 @@ int32_t pxtnEvelist::Record_Clock_Shift(int32_t clock, int32_t shift,
 /////////////////////
 
 bool pxtnEvelist::Linear_Start() {
-  if (!_eves) return false;
+  if (!_eve_max_num) return false;
   Clear();
   _linear = 0;
   return true;
@@ -693,7 +971,8 @@ bool pxtnEvelist::Linear_Start() {
 
 void pxtnEvelist::Linear_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
                                int32_t value) {
-  EVERECORD* p = &_eves[_linear];
+  EVERECORD* p = _rec_alloc();
+  if (!p) return;
 
   p->clock = clock;
   p->unit_no = unit_no;
@@ -711,19 +990,21 @@ void pxtnEvelist::Linear_Add_f(int32_t clock, uint8_t unit_no, uint8_t kind,
 }
 
 void pxtnEvelist::Linear_End(bool b_connect) {
-  if (_eves[0].kind != EVENTKIND_NULL) _start = &_eves[0];
+  if (_fresh_num && _rec_at(0)->kind != EVENTKIND_NULL) _start = _rec_at(0);
 
   if (b_connect) {
-    for (int32_t r = 1; r < _eve_allocated_num; r++) {
-      if (_eves[r].kind == EVENTKIND_NULL) break;
-      _eves[r].prev = &_eves[r - 1];
-      _eves[r - 1].next = &_eves[r];
+    for (int32_t r = 1; r < _fresh_num; r++) {
+      if (_rec_at(r)->kind == EVENTKIND_NULL) break;
+      _set_prev(_rec_at(r), _rec_at(r - 1));
+      _rec_at(r - 1)->next = _rec_at(r);
     }
   }
+  _kind_rebuild();
+  _clock_rebuild();
 }
 
 bool pxtnEvelist::x4x_Read_Start() {
-  if (!_eves) return false;
+  if (!_eve_max_num) return false;
   Clear();
   _linear = 0;
   _p_x4x_rec = NULL;
@@ -738,7 +1019,8 @@ void pxtnEvelist::x4x_Read_Add(int32_t clock, uint8_t unit_no, uint8_t kind,
   EVERECORD* p_prev = NULL;
   EVERECORD* p_next = NULL;
 
-  p_new = &_eves[_linear++];
+  if (!(p_new = _rec_alloc())) return;
+  _linear++;
 
   // first.
   if (!_start) {
@@ -751,26 +1033,26 @@ void pxtnEvelist::x4x_Read_Add(int32_t clock, uint8_t unit_no, uint8_t kind,
 
     if (_p_x4x_rec)
       p = _p_x4x_rec;
-    else
-      p = _start;
+    else if (!(p = _clock_first(clock)))
+      p = _clock_last(clock);
 
     for (; p; p = p->next) {
       if (p->clock == clock)  // 同時
       {
         for (; true; p = p->next) {
           if (p->clock != clock) {
-            p_prev = p->prev;
+            p_prev = _prev(p);
             p_next = p;
             break;
           }
           if (unit_no == p->unit_no && kind == p->kind) {
-            p_prev = p->prev;
+            p_prev = _prev(p);
             p_next = p->next;
-            p->kind = EVENTKIND_NULL;
+            _rec_cut(p);
             break;
           }  // 置き換え
           if (_ComparePriority(kind, p->kind) < 0) {
-            p_prev = p->prev;
+            p_prev = _prev(p);
             p_next = p;
             break;
           }  // プライオリティを検査
@@ -781,7 +1063,7 @@ void pxtnEvelist::x4x_Read_Add(int32_t clock, uint8_t unit_no, uint8_t kind,
         }
         break;
       } else if (p->clock > clock) {
-        p_prev = p->prev;
+        p_prev = _prev(p);
         p_next = p;
         break;
       }  // 追い越した
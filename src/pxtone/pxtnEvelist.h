@@ -1,6 +1,11 @@
 #ifndef pxtnEvelist_H
 #define pxtnEvelist_H
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
 #include "./pxtn.h"
 #include "./pxtnDescriptor.h"
 
@@ -50,7 +55,9 @@ typedef struct EVERECORD {
   uint8_t reserve2;
   int32_t value;
   int32_t clock;
-  EVERECORD *prev;
+  // Where the record is in its pxtnEvelist, which keeps the links other than
+  // [next] apart from the records (see get_Next_Kind).
+  int32_t rec_no;
   EVERECORD *next;
 } EVERECORD;
 
@@ -61,16 +68,112 @@ class pxtnEvelist {
   pxtnEvelist(const pxtnEvelist &src) = delete;               // copy
   pxtnEvelist &operator=(const pxtnEvelist &right) = delete;  // substitution
 
-  int32_t _eve_allocated_num;
-  EVERECORD *_eves;
+  // Records are allocated a chunk at a time as they're needed, up to
+  // [_eve_max_num]. Moo states can hold on to deleted records, so they stay
+  // where they are until the list is emptied with Clear or Release, which
+  // frees the chunks. Links other than next are kept beside them, as rec_no +
+  // 1 or 0 for none, so that walking the list only reads the records.
+  static constexpr int32_t _CHUNK_NUM = 4096;
+  enum _LINK {
+    _LINK_PREV = 0,
+    _LINK_NEXT_KIND,
+    _LINK_PREV_KIND,
+    _LINK_NUM,
+  };
+  struct _CHUNK {
+    EVERECORD recs[_CHUNK_NUM];
+    int32_t links[_LINK_NUM][_CHUNK_NUM];
+  };
+  int32_t _eve_max_num;
+  std::vector<_CHUNK *> _chunks;
   EVERECORD *_start;
   int32_t _linear;
 
   EVERECORD *_p_x4x_rec;
 
+  // Records not in use are the ones in [_free_recs] and those from
+  // [_fresh_num] on, so that adding one needn't look for it.
+  std::vector<EVERECORD *> _free_recs;
+  int32_t _fresh_num;
+
+  // Every _ANCHOR_GAP or so records, the list and each unit and kind's chain
+  // note where a clock starts and how many records there are up to the next
+  // note, so that a clock can be found with a binary search and a short walk.
+  static constexpr int32_t _ANCHOR_GAP = 32;
+  struct _ANCHOR {
+    int32_t clock;
+    int32_t num;
+    EVERECORD *p;
+  };
+  std::vector<_ANCHOR> _clock_anchors;
+  // By unit_no << 8 | kind.
+  std::map<uint16_t, std::vector<_ANCHOR>> _kind_anchors;
+
+  // How many tails there are of each length. No tail is longer than the last
+  // of them, so those that reach a clock are all within that much before it.
+  std::map<int32_t, int32_t> _tail_nums;
+
+  std::vector<std::weak_ptr<std::atomic<int32_t>>> _watches;
+
   void _rec_set(EVERECORD *p_rec, EVERECORD *prev, EVERECORD *next,
                 int32_t clock, uint8_t unit_no, uint8_t kind, int32_t value);
   void _rec_cut(EVERECORD *p_rec);
+  EVERECORD *_rec_at(int32_t rec_no) const {
+    return &_chunks[rec_no / _CHUNK_NUM]->recs[rec_no % _CHUNK_NUM];
+  }
+  EVERECORD *_link(const EVERECORD *p_rec, _LINK link) const {
+    int32_t no = _chunks[p_rec->rec_no / _CHUNK_NUM]
+                     ->links[link][p_rec->rec_no % _CHUNK_NUM];
+    return (no ? _rec_at(no - 1) : NULL);
+  }
+  void _set_link(const EVERECORD *p_rec, _LINK link, const EVERECORD *to) {
+    _chunks[p_rec->rec_no / _CHUNK_NUM]
+        ->links[link][p_rec->rec_no % _CHUNK_NUM] = (to ? to->rec_no + 1 : 0);
+  }
+  EVERECORD *_prev(const EVERECORD *p) const { return _link(p, _LINK_PREV); }
+  EVERECORD *_next_kind(const EVERECORD *p) const {
+    return _link(p, _LINK_NEXT_KIND);
+  }
+  EVERECORD *_prev_kind(const EVERECORD *p) const {
+    return _link(p, _LINK_PREV_KIND);
+  }
+  void _set_prev(EVERECORD *p, EVERECORD *to) { _set_link(p, _LINK_PREV, to); }
+  void _set_next_kind(EVERECORD *p, EVERECORD *to) {
+    _set_link(p, _LINK_NEXT_KIND, to);
+  }
+  void _set_prev_kind(EVERECORD *p, EVERECORD *to) {
+    _set_link(p, _LINK_PREV_KIND, to);
+  }
+  EVERECORD *_rec_alloc();
+  void _rec_free(EVERECORD *p_rec);
+  EVERECORD *_step(const EVERECORD *p, bool by_kind) const {
+    return (by_kind ? _next_kind(p) : p->next);
+  }
+  EVERECORD *_anchor_first(const std::vector<_ANCHOR> &anchors, int32_t clock,
+                           bool by_kind) const;
+  EVERECORD *_anchor_last(const std::vector<_ANCHOR> &anchors, int32_t clock,
+                          bool by_kind) const;
+  void _anchor_push(std::vector<_ANCHOR> &anchors, EVERECORD *p_rec,
+                    const EVERECORD *prev);
+  void _anchor_add(std::vector<_ANCHOR> &anchors, EVERECORD *p_rec,
+                   const EVERECORD *prev, bool by_kind);
+  void _anchor_cut(std::vector<_ANCHOR> &anchors, const EVERECORD *p_rec,
+                   bool by_kind);
+  void _kind_link(EVERECORD *p_rec);
+  void _kind_cut(EVERECORD *p_rec);
+  void _kind_set_next(EVERECORD *p_rec, EVERECORD *next_kind);
+  void _kind_rebuild();
+  EVERECORD *_kind_first(int32_t clock, uint8_t unit_no, uint8_t kind) const;
+  EVERECORD *_kind_last(int32_t clock, uint8_t unit_no, uint8_t kind) const;
+  void _clock_rebuild();
+  EVERECORD *_clock_first(int32_t clock) const;
+  EVERECORD *_clock_last(int32_t clock) const;
+  void _tail_count(const EVERECORD *p_rec, int32_t num);
+  int32_t _tail_max() const;
+  int32_t _tail_from(int32_t clock, uint8_t unit_no, uint8_t kind) const;
+  int32_t _tail_trim(int32_t clock, uint8_t unit_no, uint8_t kind);
+  void _value_set(EVERECORD *p_rec, int32_t value);
+  void _edited(int32_t clock);
 
  public:
   void Release();
@@ -91,17 +194,72 @@ class pxtnEvelist {
   int32_t get_Value(int32_t clock, uint8_t unit_no, uint8_t kind) const;
 
   const EVERECORD *get_Records() const;
+  // The next record of [p_rec]'s unit and kind, or NULL if it's the last.
+  const EVERECORD *get_Next_Kind(const EVERECORD *p_rec) const {
+    return _next_kind(p_rec);
+  }
+
+  // A unit's records of one kind are chained by get_Next_Kind in clock order.
+  // These find the first at or after [clock] and the last at or before it,
+  // or NULL if there's none.
+  const EVERECORD *get_Kind_First(int32_t clock, uint8_t unit_no,
+                                  uint8_t kind) const;
+  const EVERECORD *get_Kind_Last(int32_t clock, uint8_t unit_no,
+                                 uint8_t kind) const;
+
+  // The records of one unit and kind with clock1 <= clock < clock2, and for
+  // tail kinds also those from before clock1 whose tails run past it. For a
+  // range-based for.
+  class KindWindow {
+   public:
+    class iterator {
+     public:
+      iterator(const pxtnEvelist *evels, const EVERECORD *p, int32_t clock1,
+               int32_t clock2)
+          : _evels(evels), _p(p), _clock1(clock1), _clock2(clock2) {
+        while (_p && _p->clock < _clock1 && _p->clock + _p->value <= _clock1)
+          _p = _evels->get_Next_Kind(_p);
+        if (_p && _p->clock >= _clock2) _p = NULL;
+      }
+      const EVERECORD *operator*() const { return _p; }
+      iterator &operator++() {
+        const EVERECORD *next = _evels->get_Next_Kind(_p);
+        return *this = iterator(_evels, next, _clock1, _clock2);
+      }
+      bool operator!=(const iterator &right) const { return _p != right._p; }
+
+     private:
+      const pxtnEvelist *_evels;
+      const EVERECORD *_p;
+      int32_t _clock1;
+      int32_t _clock2;
+    };
+
+    KindWindow(const pxtnEvelist *evels, const EVERECORD *first,
+               int32_t clock1, int32_t clock2)
+        : _evels(evels), _first(first), _clock1(clock1), _clock2(clock2) {}
+    iterator begin() const {
+      return iterator(_evels, _first, _clock1, _clock2);
+    }
+    iterator end() const { return iterator(_evels, NULL, _clock1, _clock2); }
 
-  class Hint {
    private:
-    EVERECORD *eve;
-    friend class pxtnEvelist;
+    const pxtnEvelist *_evels;
+    const EVERECORD *_first;
+    int32_t _clock1;
+    int32_t _clock2;
   };
 
-  Hint get_StartHint() const;
+  KindWindow get_Kind_Window(int32_t clock1, int32_t clock2, uint8_t unit_no,
+                             uint8_t kind) const;
+
+  // For caches of things worked out from the events. Every edit lowers the
+  // returned value to the earliest clock it changed, and it's up to the
+  // watcher to set it back to INT32_MAX once it has caught up.
+  std::shared_ptr<std::atomic<int32_t>> Watch_Edits();
 
-  bool Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind, int32_t value,
-                    Hint *hint);
+  bool Record_Add_i(int32_t clock, uint8_t unit_no, uint8_t kind,
+                    int32_t value);
   bool Record_Add_f(int32_t clock, uint8_t unit_no, uint8_t kind,
                     float value_f);
 
@@ -117,12 +275,12 @@ class pxtnEvelist {
   int32_t Record_Value_Set(int32_t clock1, int32_t clock2, uint8_t unit_no,
                            uint8_t kind, int32_t value);
   int32_t Record_Value_Change(int32_t clock1, int32_t clock2, uint8_t unit_no,
-                              uint8_t kind, int32_t value, Hint *hint);
+                              uint8_t kind, int32_t value);
   int32_t Record_Value_Omit(uint8_t kind, int32_t value);
   int32_t Record_Value_Replace(uint8_t kind, int32_t old_value,
                                int32_t new_value);
   int32_t Record_Delete(int32_t clock1, int32_t clock2, uint8_t unit_no,
-                        uint8_t kind, Hint *hint);
+                        uint8_t kind);
   int32_t Record_Delete(int32_t clock1, int32_t clock2, uint8_t unit_no);
 
   int32_t Record_UnitNo_Miss(uint8_t unit_no);  // delete event has the unit-no
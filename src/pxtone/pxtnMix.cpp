@@ -0,0 +1,467 @@
+
+#include "./pxtnMix.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define _MIX_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define _TARGET_SSE2
+#define _TARGET_AVX2
+#else
+#define _TARGET_SSE2 __attribute__((target("sse2")))
+#define _TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace pxtnMix {
+
+////////////////////////////////////////////////
+// scalar  /////////////////////////////////////
+////////////////////////////////////////////////
+
+static void _Gain_scalar(int32_t *p, int32_t num, int32_t velocity,
+                         int32_t volume, int32_t pan_volume) {
+  for (int32_t i = 0; i < num; i++) {
+    int32_t work = p[i];
+    work = (work * velocity) / 128;
+    work = (work * volume) / 128;
+    work = work * pan_volume / 64;
+    p[i] = work;
+  }
+}
+
+static void _Envelope_scalar(int32_t *p, const int32_t *env, int32_t num) {
+  for (int32_t i = 0; i < num; i++) p[i] = p[i] * env[i] / 128;
+}
+
+static void _Add_scalar(int32_t *dst, const int32_t *src, int32_t num) {
+  for (int32_t i = 0; i < num; i++) dst[i] += src[i];
+}
+
+static void _Volume_scalar(int32_t *p, int32_t num, float volume) {
+  for (int32_t i = 0; i < num; i++) p[i] = (int32_t)(p[i] * volume);
+}
+
+static void _Clip_Store_scalar(int16_t *dst, const int32_t *const *srcs,
+                               int32_t ch_num, int32_t num, int32_t top) {
+  for (int32_t i = 0; i < num; i++) {
+    for (int32_t ch = 0; ch < ch_num; ch++) {
+      int32_t work = srcs[ch][i];
+      if (work > top) work = top;
+      if (work < -top) work = -top;
+      *dst++ = (int16_t)(work);
+    }
+  }
+}
+
+static void _Float_Store_scalar(float *dst, const int32_t *const *srcs,
+                                int32_t ch_num, int32_t num, float scale) {
+  for (int32_t i = 0; i < num; i++)
+    for (int32_t ch = 0; ch < ch_num; ch++) *dst++ = (float)srcs[ch][i] * scale;
+}
+
+#ifdef _MIX_X86
+
+////////////////////////////////////////////////
+// SSE2  ///////////////////////////////////////
+////////////////////////////////////////////////
+
+// SSE2 has no 32-bit mullo, so multiply the even and odd lanes separately. The
+// low 32 bits are the same for signed and unsigned.
+_TARGET_SSE2 static inline __m128i _mullo_sse2(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// x / (1 << shift), truncating toward zero like integer division does.
+template <int shift>
+_TARGET_SSE2 static inline __m128i _div_sse2(__m128i x) {
+  __m128i bias = _mm_srli_epi32(_mm_srai_epi32(x, 31), 32 - shift);
+  return _mm_srai_epi32(_mm_add_epi32(x, bias), shift);
+}
+
+_TARGET_SSE2 static inline __m128i _clip_sse2(__m128i x, __m128i top,
+                                              __m128i bottom) {
+  __m128i m = _mm_cmpgt_epi32(x, top);
+  x = _mm_or_si128(_mm_and_si128(m, top), _mm_andnot_si128(m, x));
+  m = _mm_cmplt_epi32(x, bottom);
+  return _mm_or_si128(_mm_and_si128(m, bottom), _mm_andnot_si128(m, x));
+}
+
+_TARGET_SSE2 static void _Gain_sse2(int32_t *p, int32_t num, int32_t velocity,
+                                    int32_t volume, int32_t pan_volume) {
+  const __m128i vel = _mm_set1_epi32(velocity);
+  const __m128i vol = _mm_set1_epi32(volume);
+  const __m128i pan = _mm_set1_epi32(pan_volume);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(p + i));
+    w = _div_sse2<7>(_mullo_sse2(w, vel));
+    w = _div_sse2<7>(_mullo_sse2(w, vol));
+    w = _div_sse2<6>(_mullo_sse2(w, pan));
+    _mm_storeu_si128((__m128i *)(p + i), w);
+  }
+  _Gain_scalar(p + i, num - i, velocity, volume, pan_volume);
+}
+
+_TARGET_SSE2 static void _Envelope_sse2(int32_t *p, const int32_t *env,
+                                        int32_t num) {
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i e = _mm_loadu_si128((const __m128i *)(env + i));
+    _mm_storeu_si128((__m128i *)(p + i), _div_sse2<7>(_mullo_sse2(w, e)));
+  }
+  _Envelope_scalar(p + i, env + i, num - i);
+}
+
+_TARGET_SSE2 static void _Add_sse2(int32_t *dst, const int32_t *src,
+                                   int32_t num) {
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi32(d, s));
+  }
+  _Add_scalar(dst + i, src + i, num - i);
+}
+
+_TARGET_SSE2 static void _Volume_sse2(int32_t *p, int32_t num, float volume) {
+  const __m128 vol = _mm_set1_ps(volume);
+  int32_t i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m128 w = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(p + i)));
+    _mm_storeu_si128((__m128i *)(p + i),
+                     _mm_cvttps_epi32(_mm_mul_ps(w, vol)));
+  }
+  _Volume_scalar(p + i, num - i, volume);
+}
+
+_TARGET_SSE2 static void _Clip_Store_sse2(int16_t *dst,
+                                          const int32_t *const *srcs,
+                                          int32_t ch_num, int32_t num,
+                                          int32_t top) {
+  // packs saturates instead of truncating, which only agrees with the int16
+  // cast when everything is already within int16.
+  if (top > 0x7fff || top < 0 || ch_num > 2) {
+    _Clip_Store_scalar(dst, srcs, ch_num, num, top);
+    return;
+  }
+  const __m128i hi = _mm_set1_epi32(top);
+  const __m128i lo = _mm_set1_epi32(-top);
+  int32_t i = 0;
+  if (ch_num == 1) {
+    for (; i + 8 <= num; i += 8) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(srcs[0] + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(srcs[0] + i + 4));
+      a = _clip_sse2(a, hi, lo);
+      b = _clip_sse2(b, hi, lo);
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+  } else {
+    for (; i + 4 <= num; i += 4) {
+      __m128i l = _mm_loadu_si128((const __m128i *)(srcs[0] + i));
+      __m128i r = _mm_loadu_si128((const __m128i *)(srcs[1] + i));
+      l = _clip_sse2(l, hi, lo);
+      r = _clip_sse2(r, hi, lo);
+      _mm_storeu_si128((__m128i *)(dst + i * 2),
+                       _mm_packs_epi32(_mm_unpacklo_epi32(l, r),
+                                       _mm_unpackhi_epi32(l, r)));
+    }
+  }
+  const int32_t *rest[pxtnMAX_CHANNEL] = {srcs[0] + i, srcs[ch_num - 1] + i};
+  _Clip_Store_scalar(dst + i * ch_num, rest, ch_num, num - i, top);
+}
+
+_TARGET_SSE2 static void _Float_Store_sse2(float *dst,
+                                          const int32_t *const *srcs,
+                                          int32_t ch_num, int32_t num,
+                                          float scale) {
+  if (ch_num > 2) {
+    _Float_Store_scalar(dst, srcs, ch_num, num, scale);
+    return;
+  }
+  const __m128 s = _mm_set1_ps(scale);
+  int32_t i = 0;
+  if (ch_num == 1) {
+    for (; i + 4 <= num; i += 4) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(srcs[0] + i));
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), s));
+    }
+  } else {
+    for (; i + 4 <= num; i += 4) {
+      __m128 l = _mm_mul_ps(
+          _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(srcs[0] + i))), s);
+      __m128 r = _mm_mul_ps(
+          _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(srcs[1] + i))), s);
+      _mm_storeu_ps(dst + i * 2, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+  }
+  const int32_t *rest[pxtnMAX_CHANNEL] = {srcs[0] + i, srcs[ch_num - 1] + i};
+  _Float_Store_scalar(dst + i * ch_num, rest, ch_num, num - i, scale);
+}
+
+////////////////////////////////////////////////
+// AVX2  ///////////////////////////////////////
+////////////////////////////////////////////////
+
+template <int shift>
+_TARGET_AVX2 static inline __m256i _div_avx2(__m256i x) {
+  __m256i bias = _mm256_srli_epi32(_mm256_srai_epi32(x, 31), 32 - shift);
+  return _mm256_srai_epi32(_mm256_add_epi32(x, bias), shift);
+}
+
+_TARGET_AVX2 static void _Gain_avx2(int32_t *p, int32_t num, int32_t velocity,
+                                    int32_t volume, int32_t pan_volume) {
+  const __m256i vel = _mm256_set1_epi32(velocity);
+  const __m256i vol = _mm256_set1_epi32(volume);
+  const __m256i pan = _mm256_set1_epi32(pan_volume);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(p + i));
+    w = _div_avx2<7>(_mm256_mullo_epi32(w, vel));
+    w = _div_avx2<7>(_mm256_mullo_epi32(w, vol));
+    w = _div_avx2<6>(_mm256_mullo_epi32(w, pan));
+    _mm256_storeu_si256((__m256i *)(p + i), w);
+  }
+  _Gain_scalar(p + i, num - i, velocity, volume, pan_volume);
+}
+
+_TARGET_AVX2 static void _Envelope_avx2(int32_t *p, const int32_t *env,
+                                        int32_t num) {
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i e = _mm256_loadu_si256((const __m256i *)(env + i));
+    _mm256_storeu_si256((__m256i *)(p + i),
+                        _div_avx2<7>(_mm256_mullo_epi32(w, e)));
+  }
+  _Envelope_scalar(p + i, env + i, num - i);
+}
+
+_TARGET_AVX2 static void _Add_avx2(int32_t *dst, const int32_t *src,
+                                   int32_t num) {
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi32(d, s));
+  }
+  _Add_scalar(dst + i, src + i, num - i);
+}
+
+_TARGET_AVX2 static void _Volume_avx2(int32_t *p, int32_t num, float volume) {
+  const __m256 vol = _mm256_set1_ps(volume);
+  int32_t i = 0;
+  for (; i + 8 <= num; i += 8) {
+    __m256 w =
+        _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(p + i)));
+    _mm256_storeu_si256((__m256i *)(p + i),
+                        _mm256_cvttps_epi32(_mm256_mul_ps(w, vol)));
+  }
+  _Volume_scalar(p + i, num - i, volume);
+}
+
+_TARGET_AVX2 static void _Clip_Store_avx2(int16_t *dst,
+                                          const int32_t *const *srcs,
+                                          int32_t ch_num, int32_t num,
+                                          int32_t top) {
+  if (top > 0x7fff || top < 0 || ch_num > 2) {
+    _Clip_Store_scalar(dst, srcs, ch_num, num, top);
+    return;
+  }
+  const __m256i hi = _mm256_set1_epi32(top);
+  const __m256i lo = _mm256_set1_epi32(-top);
+  int32_t i = 0;
+  // 256-bit packs work within 128-bit lanes, so pack the halves separately.
+  if (ch_num == 1) {
+    for (; i + 8 <= num; i += 8) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(srcs[0] + i));
+      a = _mm256_max_epi32(_mm256_min_epi32(a, hi), lo);
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_packs_epi32(_mm256_castsi256_si128(a),
+                                       _mm256_extracti128_si256(a, 1)));
+    }
+  } else {
+    for (; i + 8 <= num; i += 8) {
+      __m256i l = _mm256_loadu_si256((const __m256i *)(srcs[0] + i));
+      __m256i r = _mm256_loadu_si256((const __m256i *)(srcs[1] + i));
+      l = _mm256_max_epi32(_mm256_min_epi32(l, hi), lo);
+      r = _mm256_max_epi32(_mm256_min_epi32(r, hi), lo);
+      __m128i l0 = _mm256_castsi256_si128(l);
+      __m128i r0 = _mm256_castsi256_si128(r);
+      __m128i l1 = _mm256_extracti128_si256(l, 1);
+      __m128i r1 = _mm256_extracti128_si256(r, 1);
+      _mm_storeu_si128((__m128i *)(dst + i * 2),
+                       _mm_packs_epi32(_mm_unpacklo_epi32(l0, r0),
+                                       _mm_unpackhi_epi32(l0, r0)));
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 8),
+                       _mm_packs_epi32(_mm_unpacklo_epi32(l1, r1),
+                                       _mm_unpackhi_epi32(l1, r1)));
+    }
+  }
+  const int32_t *rest[pxtnMAX_CHANNEL] = {srcs[0] + i, srcs[ch_num - 1] + i};
+  _Clip_Store_scalar(dst + i * ch_num, rest, ch_num, num - i, top);
+}
+
+_TARGET_AVX2 static void _Float_Store_avx2(float *dst,
+                                           const int32_t *const *srcs,
+                                           int32_t ch_num, int32_t num,
+                                           float scale) {
+  if (ch_num > 2) {
+    _Float_Store_scalar(dst, srcs, ch_num, num, scale);
+    return;
+  }
+  const __m256 s = _mm256_set1_ps(scale);
+  int32_t i = 0;
+  if (ch_num == 1) {
+    for (; i + 8 <= num; i += 8) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(srcs[0] + i));
+      _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), s));
+    }
+  } else {
+    // Unpacking works within 128-bit lanes, so the halves are swapped back
+    // into order.
+    for (; i + 8 <= num; i += 8) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(srcs[0] + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *)(srcs[1] + i));
+      __m256 l = _mm256_mul_ps(_mm256_cvtepi32_ps(a), s);
+      __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(b), s);
+      __m256 lo = _mm256_unpacklo_ps(l, r);
+      __m256 hi = _mm256_unpackhi_ps(l, r);
+      _mm256_storeu_ps(dst + i * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+      _mm256_storeu_ps(dst + i * 2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+  }
+  const int32_t *rest[pxtnMAX_CHANNEL] = {srcs[0] + i, srcs[ch_num - 1] + i};
+  _Float_Store_scalar(dst + i * ch_num, rest, ch_num, num - i, scale);
+}
+
+#endif
+
+////////////////////////////////////////////////
+// dispatch  ///////////////////////////////////
+////////////////////////////////////////////////
+
+typedef struct {
+  void (*gain)(int32_t *, int32_t, int32_t, int32_t, int32_t);
+  void (*envelope)(int32_t *, const int32_t *, int32_t);
+  void (*add)(int32_t *, const int32_t *, int32_t);
+  void (*volume)(int32_t *, int32_t, float);
+  void (*clip_store)(int16_t *, const int32_t *const *, int32_t, int32_t,
+                     int32_t);
+  void (*float_store)(float *, const int32_t *const *, int32_t, int32_t,
+                      float);
+} _KERNELS;
+
+static const _KERNELS _kernels[] = {
+    {_Gain_scalar, _Envelope_scalar, _Add_scalar, _Volume_scalar,
+     _Clip_Store_scalar, _Float_Store_scalar},
+#ifdef _MIX_X86
+    {_Gain_sse2, _Envelope_sse2, _Add_sse2, _Volume_sse2, _Clip_Store_sse2,
+     _Float_Store_sse2},
+    {_Gain_avx2, _Envelope_avx2, _Add_avx2, _Volume_avx2, _Clip_Store_avx2,
+     _Float_Store_avx2},
+#endif
+};
+
+static SIMD _detect() {
+#ifdef _MIX_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  int32_t id_num = info[0];
+  __cpuid(info, 1);
+  bool b_sse2 = (info[3] & (1 << 26)) != 0;
+  bool b_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+               (_xgetbv(0) & 0x6) == 0x6;  // OS saves the ymm registers
+  bool b_avx2 = false;
+  if (b_avx && id_num >= 7) {
+    __cpuidex(info, 7, 0);
+    b_avx2 = (info[1] & (1 << 5)) != 0;
+  }
+  if (b_avx2) return SIMD_avx2;
+  if (b_sse2) return SIMD_sse2;
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SIMD_avx2;
+  if (__builtin_cpu_supports("sse2")) return SIMD_sse2;
+#endif
+#endif
+  return SIMD_scalar;
+}
+
+static std::atomic<int8_t> _simd(-1);
+
+static const _KERNELS &_get_kernels() {
+  int8_t simd = _simd.load(std::memory_order_relaxed);
+  if (simd < 0) {
+    simd = get_supported();
+    _simd.store(simd, std::memory_order_relaxed);
+  }
+  return _kernels[simd];
+}
+
+SIMD get_supported() {
+  static const SIMD supported = _detect();
+  return supported;
+}
+
+SIMD get_simd() {
+  _get_kernels();
+  return SIMD(_simd.load(std::memory_order_relaxed));
+}
+
+void set_simd(SIMD simd) {
+  if (simd > get_supported()) simd = get_supported();
+  if (simd < SIMD_scalar) simd = SIMD_scalar;
+  _simd.store(simd, std::memory_order_relaxed);
+}
+
+const char *SIMD_name(SIMD simd) {
+  switch (simd) {
+    case SIMD_scalar:
+      return "scalar";
+    case SIMD_sse2:
+      return "SSE2";
+    case SIMD_avx2:
+      return "AVX2";
+  }
+  return "?";
+}
+
+void Gain(int32_t *p, int32_t num, int32_t velocity, int32_t volume,
+          int32_t pan_volume) {
+  _get_kernels().gain(p, num, velocity, volume, pan_volume);
+}
+
+void Envelope(int32_t *p, const int32_t *env, int32_t num) {
+  _get_kernels().envelope(p, env, num);
+}
+
+void Add(int32_t *dst, const int32_t *src, int32_t num) {
+  _get_kernels().add(dst, src, num);
+}
+
+void Volume(int32_t *p, int32_t num, float volume) {
+  _get_kernels().volume(p, num, volume);
+}
+
+void Clip_Store(int16_t *dst, const int32_t *const *srcs, int32_t ch_num,
+                int32_t num, int32_t top) {
+  _get_kernels().clip_store(dst, srcs, ch_num, num, top);
+}
+
+void Float_Store(float *dst, const int32_t *const *srcs, int32_t ch_num,
+                 int32_t num, float scale) {
+  _get_kernels().float_store(dst, srcs, ch_num, num, scale);
+}
+
+};  // namespace pxtnMix
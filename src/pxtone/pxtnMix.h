@@ -0,0 +1,46 @@
+#ifndef pxtnMix_H
+#define pxtnMix_H
+
+#include "./pxtn.h"
+#include "./pxtnMax.h"
+
+// Kernels for the block mixing path. Each one works on [num] samples and has
+// a scalar, SSE2 and AVX2 version, picked at runtime. They all keep the int32
+// rounding of the scalar code (divisions truncate toward zero), so output
+// doesn't depend on which version runs.
+namespace pxtnMix {
+
+enum SIMD : int8_t {
+  SIMD_scalar = 0,
+  SIMD_sse2,
+  SIMD_avx2,
+};
+
+// Best instruction set supported by this CPU / build.
+SIMD get_supported();
+// Currently used instruction set.
+SIMD get_simd();
+// Use at most [simd] (clamped to what's supported). Mostly for benchmarking.
+void set_simd(SIMD simd);
+const char *SIMD_name(SIMD simd);
+
+// p[i] = ((p[i] * velocity / 128) * volume / 128) * pan_volume / 64
+void Gain(int32_t *p, int32_t num, int32_t velocity, int32_t volume,
+          int32_t pan_volume);
+// p[i] = p[i] * env[i] / 128
+void Envelope(int32_t *p, const int32_t *env, int32_t num);
+// dst[i] += src[i]
+void Add(int32_t *dst, const int32_t *src, int32_t num);
+// p[i] = (int32_t)(p[i] * volume)
+void Volume(int32_t *p, int32_t num, float volume);
+// Clips each of [ch_num] planar [srcs] to +-[top] and stores them interleaved
+// as int16.
+void Clip_Store(int16_t *dst, const int32_t *const *srcs, int32_t ch_num,
+                int32_t num, int32_t top);
+// Stores each of [ch_num] planar [srcs] interleaved as float, times [scale].
+void Float_Store(float *dst, const int32_t *const *srcs, int32_t ch_num,
+                 int32_t num, float scale);
+
+};  // namespace pxtnMix
+
+#endif
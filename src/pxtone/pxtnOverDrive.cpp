@@ -33,14 +33,18 @@ bool pxtnOverDrive::switch_played() {
   return _b_played;
 }
 
-void pxtnOverDrive::Tone_Supple(int32_t *group_smps) const {
+void pxtnOverDrive::Tone_Supple(int32_t *group_smps, int32_t group_stride,
+                                int32_t smp_num) const {
   if (!_b_played) return;
-  int32_t work = group_smps[_group];
-  if (work > _cut_16bit_top)
-    work = _cut_16bit_top;
-  else if (work < -_cut_16bit_top)
-    work = -_cut_16bit_top;
-  group_smps[_group] = (int32_t)((float)work * _amp_f);
+  int32_t *p = &group_smps[_group * group_stride];
+  for (int32_t i = 0; i < smp_num; i++) {
+    int32_t work = p[i];
+    if (work > _cut_16bit_top)
+      work = _cut_16bit_top;
+    else if (work < -_cut_16bit_top)
+      work = -_cut_16bit_top;
+    p[i] = (int32_t)((float)work * _amp_f);
+  }
 }
 
 // (8byte) =================
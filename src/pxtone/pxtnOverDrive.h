@@ -33,7 +33,9 @@ class pxtnOverDrive {
   ~pxtnOverDrive();
 
   void Tone_Ready();
-  void Tone_Supple(int32_t *group_smps) const;
+  // [group_smps] holds [smp_num] samples for each group, [group_stride] apart.
+  void Tone_Supple(int32_t *group_smps, int32_t group_stride,
+                   int32_t smp_num) const;
 
   bool Write(pxtnDescriptor *p_doc) const;
   pxtnERR Read(pxtnDescriptor *p_doc);
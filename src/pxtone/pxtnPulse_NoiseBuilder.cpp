@@ -111,23 +111,23 @@ pxtnPulse_NoiseBuilder::~pxtnPulse_NoiseBuilder() {
     pxtnMem_free((void **)&_p_tables[i]);
 }
 
-void pxtnPulse_NoiseBuilder::_random_reset() {
-  _rand_buf[0] = 0x4444;
-  _rand_buf[1] = 0x8888;
+static void _random_reset(int32_t *rand_buf) {
+  rand_buf[0] = 0x4444;
+  rand_buf[1] = 0x8888;
 }
 
-short pxtnPulse_NoiseBuilder::_random_get() {
+static short _random_get(int32_t *rand_buf) {
   int32_t w1, w2;
   char *p1;
   char *p2;
 
-  w1 = (short)_rand_buf[0] + _rand_buf[1];
+  w1 = (short)rand_buf[0] + rand_buf[1];
   p1 = (char *)&w1;
   p2 = (char *)&w2;
   p2[0] = p1[1];
   p2[1] = p1[0];
-  _rand_buf[1] = (short)_rand_buf[0];
-  _rand_buf[0] = (short)w2;
+  rand_buf[1] = (short)rand_buf[0];
+  rand_buf[0] = (short)w2;
 
   return (short)w2;
 }
@@ -140,6 +140,7 @@ bool pxtnPulse_NoiseBuilder::Init() {
 
   int32_t a;
   short v;
+  int32_t rand_buf[2];
 
   pxtnPulse_Oscillator osci;
 
@@ -247,9 +248,9 @@ bool pxtnPulse_NoiseBuilder::Init() {
 
   // random --
   p = _p_tables[pxWAVETYPE_Random];
-  _random_reset();
+  _random_reset(rand_buf);
   for (s = 0; s < _smp_num_rand; s++) {
-    *p = _random_get();
+    *p = _random_get(rand_buf);
     p++;
   }
 
@@ -11,10 +11,6 @@ class pxtnPulse_NoiseBuilder {
 
   bool _b_init;
   short* _p_tables[pxWAVETYPE_num];
-  int32_t _rand_buf[2];
-
-  void _random_reset();
-  short _random_get();
 
  public:
   pxtnPulse_NoiseBuilder();
@@ -22,6 +18,8 @@ class pxtnPulse_NoiseBuilder {
 
   bool Init();
 
+  // Only reads the tables made by Init, so it can be called from several
+  // threads at once (for different [p_noise]s).
   pxtnPulse_PCM* BuildNoise(pxtnPulse_Noise* p_noise, int32_t ch, int32_t sps,
                             int32_t bps) const;
 };
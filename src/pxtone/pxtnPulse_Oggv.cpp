@@ -3,6 +3,13 @@
 
 #ifdef pxINCLUDE_OGGVORBIS
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <vorbis/codec.h>
 #include <vorbis/vorbisfile.h>
 
@@ -270,6 +277,11 @@ int32_t pxtnPulse_Oggv::GetSize() const {
   return sizeof(int32_t) * 4 + _size;
 }
 
+const char* pxtnPulse_Oggv::GetData(int32_t* p_size) const {
+  *p_size = _size;
+  return _p_data;
+}
+
 bool pxtnPulse_Oggv::ogg_write(pxtnDescriptor* desc) const {
   bool b_ret = false;
 
@@ -332,4 +344,326 @@ bool pxtnPulse_Oggv::Copy(pxtnPulse_Oggv* p_dst) const {
   return true;
 }
 
+/////////////////
+// stream
+/////////////////
+
+struct pxtnPulse_OggvStream::Decoder {
+  OVMEM ovmem;
+  OggVorbis_File vf;
+};
+
+pxtnPulse_OggvStream::pxtnPulse_OggvStream(const pxtnPulse_Oggv* p_src) {
+  _p_dec = NULL;
+  _p_src = p_src;
+  _p_src_data = p_src->_p_data;
+  _ch = p_src->_ch;
+  _p_buf = NULL;
+  _buf_head = 0;
+  _buf_num = 0;
+
+  if (!_p_src_data || _ch <= 0) return;
+
+  ov_callbacks oc;
+  oc.read_func = _mread;
+  oc.seek_func = _mseek;
+  oc.close_func = _mclose_dummy;
+  oc.tell_func = _mtell;
+
+  _p_dec = new Decoder();
+  _p_dec->ovmem.p_buf = p_src->_p_data;
+  _p_dec->ovmem.pos = 0;
+  _p_dec->ovmem.size = p_src->_size;
+  if (ov_open_callbacks(&_p_dec->ovmem, &_p_dec->vf, NULL, 0, oc) != 0) {
+    SAFE_DELETE(_p_dec);
+    return;
+  }
+  _p_buf = (int16_t*)malloc(sizeof(int16_t) * _ch * WINDOW_SMP_NUM);
+}
+
+pxtnPulse_OggvStream::~pxtnPulse_OggvStream() {
+  if (_p_dec) ov_clear(&_p_dec->vf);
+  SAFE_DELETE(_p_dec);
+  if (_p_buf) free(_p_buf);
+}
+
+bool pxtnPulse_OggvStream::is_of(const pxtnPulse_Oggv* p_src) const {
+  return p_src == _p_src && p_src->_p_data == _p_src_data;
+}
+
+bool pxtnPulse_OggvStream::Seek(int32_t smp_pos) {
+  if (!_p_dec || smp_pos < 0) return false;
+  int32_t end = _buf_head + _buf_num;
+  if (smp_pos >= _buf_head && smp_pos <= end) return true;
+  if (smp_pos > end && smp_pos <= end + WINDOW_SMP_NUM) return _Skip(smp_pos);
+
+  _buf_num = 0;
+  if (ov_pcm_seek(&_p_dec->vf, smp_pos)) {
+    _buf_head = -WINDOW_SMP_NUM * 2;
+    return false;
+  }
+  _buf_head = smp_pos;
+  return true;
+}
+
+// Decodes and drops the samples from the end of the buffer up to [smp_pos],
+// leaving it empty there. Returns false if the voice ends first.
+bool pxtnPulse_OggvStream::_Skip(int32_t smp_pos) {
+  int32_t end = _buf_head + _buf_num;
+  _buf_num = 0;
+  while (end < smp_pos) {
+    int32_t num = _Decode(_p_buf, std::min(smp_pos - end, WINDOW_SMP_NUM));
+    end += num;
+    if (!num) break;
+  }
+  _buf_head = end;
+  return end >= smp_pos;
+}
+
+// Decodes up to [smp_num] samples into [p], from wherever the decoder is.
+int32_t pxtnPulse_OggvStream::_Decode(int16_t* p, int32_t smp_num) {
+  int32_t smp_size = sizeof(int16_t) * _ch;
+  int32_t done = 0;
+  int32_t current_section;
+  while (done < smp_num) {
+    long ret = ov_read(&_p_dec->vf, (char*)&p[done * _ch],
+                       (smp_num - done) * smp_size, 0, 2, 1, &current_section);
+    if (ret == OV_HOLE) continue;
+    if (ret <= 0) break;
+    done += ret / smp_size;
+  }
+  return done;
+}
+
+const int16_t* pxtnPulse_OggvStream::Read(int32_t smp_pos, int32_t smp_num) {
+  if (!_p_buf || smp_pos < 0 || smp_num > WINDOW_SMP_NUM) return NULL;
+
+  int32_t end = _buf_head + _buf_num;
+  if (smp_pos >= _buf_head && smp_pos + smp_num <= end)
+    return &_p_buf[(smp_pos - _buf_head) * _ch];
+
+  if (smp_pos >= _buf_head && smp_pos <= end + WINDOW_SMP_NUM) {
+    // Close enough ahead to keep decoding from here, which unlike seeking
+    // doesn't have to go back over the page before.
+    if (smp_pos < end) {
+      memmove(_p_buf, &_p_buf[(smp_pos - _buf_head) * _ch],
+              sizeof(int16_t) * _ch * (end - smp_pos));
+      _buf_num = end - smp_pos;
+    } else if (!_Skip(smp_pos)) {
+      return NULL;
+    }
+  } else {
+    _buf_num = 0;
+    if (ov_pcm_seek(&_p_dec->vf, smp_pos)) {
+      // Where the decoder is now isn't known, so don't carry on from it.
+      _buf_head = -WINDOW_SMP_NUM * 2;
+      return NULL;
+    }
+  }
+  _buf_head = smp_pos;
+  _buf_num += _Decode(&_p_buf[_buf_num * _ch], WINDOW_SMP_NUM - _buf_num);
+
+  if (smp_pos + smp_num > _buf_head + _buf_num) return NULL;
+  return _p_buf;
+}
+
+/////////////////
+// prefetch
+/////////////////
+
+// Samples at the end of the ring that repeat its start, so that reads across
+// the end are contiguous.
+static constexpr int32_t _MIRROR_SMP_NUM = pxtnPulse_OggvStream::WINDOW_SMP_NUM;
+
+// Decodes for every pxtnPulse_OggvPrefetch, a window of each at a time.
+class pxtnPulse_OggvPrefetch::Thread {
+ private:
+  std::atomic<pxtnPulse_OggvPrefetch*> _p_new;
+  std::vector<pxtnPulse_OggvPrefetch*> _prefetches;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _b_quit;
+  std::thread _thread;
+
+  void _Main() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_b_quit) {
+      lock.unlock();
+      for (pxtnPulse_OggvPrefetch* p = _p_new.exchange(NULL); p;
+           p = p->_p_next)
+        _prefetches.push_back(p);
+      bool b_busy = false;
+      for (size_t i = 0; i < _prefetches.size();) {
+        pxtnPulse_OggvPrefetch* p = _prefetches[i];
+        if (p->_b_released) {
+          delete p;
+          _prefetches[i] = _prefetches.back();
+          _prefetches.pop_back();
+          continue;
+        }
+        if (p->_Decode()) b_busy = true;
+        i++;
+      }
+      lock.lock();
+      // Reads move the ring along without waking this, so it looks again
+      // every so often.
+      if (!b_busy && !_b_quit)
+        _wake.wait_for(lock, std::chrono::milliseconds(2));
+    }
+  }
+
+ public:
+  Thread() : _p_new(NULL), _b_quit(false), _thread([this]() { _Main(); }) {}
+  // Prefetches that haven't been released are left, since they're still
+  // being read from.
+  ~Thread() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _b_quit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+  }
+
+  static Thread& get() {
+    static Thread thread;
+    return thread;
+  }
+
+  // Doesn't lock, so it can be called from the audio thread.
+  void Add(pxtnPulse_OggvPrefetch* p) {
+    p->_p_next = _p_new.load(std::memory_order_relaxed);
+    while (!_p_new.compare_exchange_weak(p->_p_next, p)) {
+    }
+    Wake();
+  }
+  void Wake() { _wake.notify_one(); }
+};
+
+pxtnPulse_OggvPrefetch::pxtnPulse_OggvPrefetch(
+    const pxtnPulse_Oggv* p_src, std::shared_ptr<const void> p_keep,
+    int32_t smp_pos)
+    : _p_src(p_src),
+      _p_src_data(p_src->_p_data),
+      _p_keep(std::move(p_keep)),
+      _ch(p_src->_ch),
+      _smp_num(p_src->_smp_num),
+      _p_next(NULL),
+      _seek_num(1),
+      _floor(std::max(smp_pos, 0)),
+      _p_stream(NULL),
+      _p_buf(NULL),
+      _seek_num_done(0),
+      _seek_num_stuck(0),
+      _b_released(false),
+      _seek_num_shared(_seek_num),
+      _floor_shared(_floor),
+      _seek_num_done_shared(0),
+      _head(0),
+      _end(0) {}
+
+pxtnPulse_OggvPrefetch::~pxtnPulse_OggvPrefetch() {
+  SAFE_DELETE(_p_stream);
+  if (_p_buf) free(_p_buf);
+}
+
+pxtnPulse_OggvPrefetch* pxtnPulse_OggvPrefetch::Start(
+    const pxtnPulse_Oggv* p_src, std::shared_ptr<const void> p_keep,
+    int32_t smp_pos) {
+  pxtnPulse_OggvPrefetch* p =
+      new pxtnPulse_OggvPrefetch(p_src, std::move(p_keep), smp_pos);
+  Thread::get().Add(p);
+  return p;
+}
+
+void pxtnPulse_OggvPrefetch::Release() { _b_released = true; }
+
+bool pxtnPulse_OggvPrefetch::is_of(const pxtnPulse_Oggv* p_src) const {
+  return p_src == _p_src && p_src->_p_data == _p_src_data;
+}
+
+void pxtnPulse_OggvPrefetch::Seek(int32_t smp_pos) {
+  smp_pos = std::max(smp_pos, 0);
+  if (smp_pos >= _floor) {
+    _floor = smp_pos;
+    _floor_shared.store(_floor, std::memory_order_release);
+    return;
+  }
+  _floor = smp_pos;
+  _floor_shared.store(_floor, std::memory_order_relaxed);
+  _seek_num_shared.store(++_seek_num, std::memory_order_release);
+  Thread::get().Wake();
+}
+
+const int16_t* pxtnPulse_OggvPrefetch::Read(int32_t smp_pos, int32_t smp_num) {
+  if (smp_pos < 0 || smp_num > _MIRROR_SMP_NUM) return NULL;
+  if (smp_pos < _floor) {
+    Seek(smp_pos - READ_BEHIND_NUM);
+    return NULL;
+  }
+  if (_seek_num_done_shared.load(std::memory_order_acquire) != _seek_num)
+    return NULL;
+  // Letting the thread decode over what's before here first is fine, since
+  // that's not read again.
+  if (smp_pos - READ_BEHIND_NUM > _floor) {
+    _floor = smp_pos - READ_BEHIND_NUM;
+    _floor_shared.store(_floor, std::memory_order_release);
+  }
+  int32_t end = _end.load(std::memory_order_acquire);
+  if (smp_pos < _head.load(std::memory_order_relaxed) ||
+      smp_pos + smp_num > end)
+    return NULL;
+  return &_p_buf[smp_pos % RING_SMP_NUM * _ch];
+}
+
+// Decodes the next window, or seeks if the reader asked to. The ring is never
+// filled further than RING_SMP_NUM past the reader's floor, so nothing it
+// might still read is overwritten. Returns whether there's more to do.
+bool pxtnPulse_OggvPrefetch::_Decode() {
+  if (!_p_stream) {
+    _p_stream = new pxtnPulse_OggvStream(_p_src);
+    _p_buf = (int16_t*)malloc(sizeof(int16_t) * _ch *
+                              (RING_SMP_NUM + _MIRROR_SMP_NUM));
+    if (!_p_buf) _seek_num_stuck = INT32_MAX;
+  }
+  if (_seek_num_stuck == INT32_MAX) return false;
+
+  int32_t seek_num = _seek_num_shared.load(std::memory_order_acquire);
+  int32_t floor = _floor_shared.load(std::memory_order_acquire);
+  int32_t end = _end.load(std::memory_order_relaxed);
+  // Far ahead, it's quicker to let the stream skip or seek there.
+  if (seek_num != _seek_num_done ||
+      floor > end + pxtnPulse_OggvStream::WINDOW_SMP_NUM) {
+    end = floor;
+    _head.store(end, std::memory_order_relaxed);
+    _end.store(end, std::memory_order_release);
+    _seek_num_done = seek_num;
+    _seek_num_done_shared.store(seek_num, std::memory_order_release);
+  }
+  if (_seek_num_stuck == seek_num) return false;
+
+  int32_t smp_num = std::min({pxtnPulse_OggvStream::WINDOW_SMP_NUM,
+                              floor + RING_SMP_NUM - end, _smp_num - end});
+  if (smp_num <= 0) return false;
+  const int16_t* p = _p_stream->Read(end, smp_num);
+  if (!p) {
+    // Until the next seek, rather than try again every time round.
+    _seek_num_stuck = seek_num;
+    return false;
+  }
+  for (int32_t pos = end, left = smp_num; left > 0;) {
+    int32_t i = pos % RING_SMP_NUM;
+    int32_t num = std::min(left, RING_SMP_NUM - i);
+    memcpy(&_p_buf[i * _ch], p, sizeof(int16_t) * _ch * num);
+    if (i < _MIRROR_SMP_NUM)
+      memcpy(&_p_buf[(RING_SMP_NUM + i) * _ch], p,
+             sizeof(int16_t) * _ch * std::min(num, _MIRROR_SMP_NUM - i));
+    pos += num;
+    p += _ch * num;
+    left -= num;
+  }
+  _end.store(end + smp_num, std::memory_order_release);
+  return true;
+}
+
 #endif
@@ -3,12 +3,18 @@
 
 #ifdef pxINCLUDE_OGGVORBIS
 
+#include <atomic>
+#include <memory>
+
 #include "./pxtn.h"
 #include "./pxtnDescriptor.h"
 #include "./pxtnPulse_PCM.h"
 
 class pxtnPulse_Oggv {
  private:
+  friend class pxtnPulse_OggvStream;
+  friend class pxtnPulse_OggvPrefetch;
+
   void operator=(const pxtnPulse_Oggv& src) = delete;
   pxtnPulse_Oggv(const pxtnPulse_Oggv& src) = delete;
 
@@ -28,6 +34,8 @@ class pxtnPulse_Oggv {
   void Release();
   bool GetInfo(int* p_ch, int* p_sps, int* p_smp_num);
   int32_t GetSize() const;
+  // The Ogg file as it was read, or NULL if there isn't one.
+  const char* GetData(int32_t* p_size) const;
 
   bool ogg_write(pxtnDescriptor* p_doc) const;
   pxtnERR ogg_read(pxtnDescriptor* p_doc);
@@ -36,5 +44,120 @@ class pxtnPulse_Oggv {
 
   bool Copy(pxtnPulse_Oggv* p_dst) const;
 };
+
+// Decodes a pxtnPulse_Oggv a window at a time, for voices too long to keep
+// decoded. Reads a little past the last window decode on from it; anything
+// else seeks.
+class pxtnPulse_OggvStream {
+ private:
+  void operator=(const pxtnPulse_OggvStream& src) = delete;
+  pxtnPulse_OggvStream(const pxtnPulse_OggvStream& src) = delete;
+
+  struct Decoder;
+  Decoder* _p_dec;
+  const pxtnPulse_Oggv* _p_src;
+  const char* _p_src_data;
+  int32_t _ch;
+
+  // Decoded samples from [_buf_head]. The decoder carries on from the end.
+  int16_t* _p_buf;
+  int32_t _buf_head;
+  int32_t _buf_num;
+
+  int32_t _Decode(int16_t* p, int32_t smp_num);
+  bool _Skip(int32_t smp_pos);
+
+ public:
+  // Most samples a single Read can ask for.
+  static constexpr int32_t WINDOW_SMP_NUM = 0x1000;
+
+  pxtnPulse_OggvStream(const pxtnPulse_Oggv* p_src);
+  ~pxtnPulse_OggvStream();
+
+  // Whether this is still reading [p_src] as it is now.
+  bool is_of(const pxtnPulse_Oggv* p_src) const;
+
+  // Gets ready to Read from [smp_pos] on by decoding from there, seeking if
+  // it's not a little past the last window already. Returns false if seeking
+  // failed.
+  bool Seek(int32_t smp_pos);
+
+  // Samples [smp_pos, smp_pos + smp_num) as interleaved 16-bit, or NULL if
+  // they couldn't be decoded.
+  const int16_t* Read(int32_t smp_pos, int32_t smp_num);
+};
+
+// Decodes a pxtnPulse_Oggv ahead of where it's read on a background thread,
+// for reading on a thread that mustn't wait for a decoder to open or seek.
+// Reading what isn't decoded yet gives NULL, and reading further back than a
+// little before the last read seeks. Starting one only allocates it; the
+// decoder is opened on the background thread, and freed there after Release.
+class pxtnPulse_OggvPrefetch {
+ private:
+  void operator=(const pxtnPulse_OggvPrefetch& src) = delete;
+  pxtnPulse_OggvPrefetch(const pxtnPulse_OggvPrefetch& src) = delete;
+
+  class Thread;
+  friend class Thread;
+
+  const pxtnPulse_Oggv* _p_src;
+  const char* _p_src_data;
+  std::shared_ptr<const void> _p_keep;
+  int32_t _ch;
+  int32_t _smp_num;
+  pxtnPulse_OggvPrefetch* _p_next;  // While waiting for the thread.
+
+  // Only used by the reader.
+  int32_t _seek_num;
+  int32_t _floor;
+
+  // Only used by the background thread.
+  pxtnPulse_OggvStream* _p_stream;
+  int16_t* _p_buf;
+  int32_t _seek_num_done;
+  int32_t _seek_num_stuck;
+
+  // Set by the reader: seeks are counted, and samples before [_floor_shared]
+  // aren't read again until the next.
+  std::atomic<bool> _b_released;
+  std::atomic<int32_t> _seek_num_shared;
+  std::atomic<int32_t> _floor_shared;
+  // Set by the background thread: once it's done seek [_seek_num_done_shared],
+  // samples [_head, _end) are in [_p_buf].
+  std::atomic<int32_t> _seek_num_done_shared;
+  std::atomic<int32_t> _head;
+  std::atomic<int32_t> _end;
+
+  pxtnPulse_OggvPrefetch(const pxtnPulse_Oggv* p_src,
+                         std::shared_ptr<const void> p_keep, int32_t smp_pos);
+  ~pxtnPulse_OggvPrefetch();
+
+  bool _Decode();
+
+ public:
+  // Samples kept decoded ahead of the last read.
+  static constexpr int32_t RING_SMP_NUM = 0x4000;
+  // How far before the last read reading can go without seeking.
+  static constexpr int32_t READ_BEHIND_NUM = 64;
+
+  // Starts decoding [p_src] from [smp_pos] on. [p_keep] is held until the
+  // decoder's freed, to keep [p_src] alive for it.
+  static pxtnPulse_OggvPrefetch* Start(const pxtnPulse_Oggv* p_src,
+                                       std::shared_ptr<const void> p_keep,
+                                       int32_t smp_pos);
+  // Stops reading. This mustn't be used after.
+  void Release();
+
+  bool is_of(const pxtnPulse_Oggv* p_src) const;
+
+  // Gets ready to Read from [smp_pos] on, seeking if that's before the last
+  // read.
+  void Seek(int32_t smp_pos);
+
+  // Samples [smp_pos, smp_pos + smp_num) as interleaved 16-bit, or NULL if
+  // they aren't decoded yet. [smp_num] is at most
+  // pxtnPulse_OggvStream::WINDOW_SMP_NUM.
+  const int16_t* Read(int32_t smp_pos, int32_t smp_num);
+};
 #endif
 #endif
@@ -0,0 +1,132 @@
+#include "./pxtnResample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace pxtnResample {
+
+// A polyphase windowed sinc: each phase is the filter for one fraction of a
+// sample between two of the voice's, in fixed point. Reading faster than one
+// voice sample per output sample needs the cutoff lowered to match, which takes
+// proportionally more taps, so there's a table for each quarter step of
+// [_MAX_SCALE] steps, and anything faster than that aliases.
+constexpr int32_t _TAP_NUM = 16;
+constexpr int32_t _PHASE_NUM = 256;
+constexpr int32_t _COEF_BITS = 14;
+constexpr int32_t _SCALE_STEPS = 4;
+constexpr int32_t _MAX_SCALE = 4;
+static_assert(_TAP_NUM * _MAX_SCALE <= READ_BEHIND_NUM * 2,
+              "Streams are opened too late for the widest table");
+static_assert(_TAP_NUM * _MAX_SCALE / 2 <= pxtnSTREAM_TAIL_NUM,
+              "Streamed voices don't keep enough of their end to loop");
+
+struct _Table {
+  int32_t tap_num;
+  int32_t tap_before;
+  std::vector<int16_t> coefs;
+};
+
+// With the cutoff at 1 / [scale] of the voice's rate.
+static _Table _make_table(double scale) {
+  const double pi = 3.14159265358979323846;
+  _Table table;
+  table.tap_num = (int32_t)std::ceil(_TAP_NUM * scale / 2) * 2;
+  table.tap_before = table.tap_num / 2 - 1;
+  table.coefs.resize(_PHASE_NUM * table.tap_num);
+  std::vector<double> coefs(table.tap_num);
+  for (int32_t p = 0; p < _PHASE_NUM; p++) {
+    double frac = (double)p / _PHASE_NUM;
+    double sum = 0;
+    for (int32_t k = 0; k < table.tap_num; k++) {
+      double x = k - table.tap_before - frac;
+      double xs = x / scale;
+      double sinc = (xs == 0 ? 1 : std::sin(pi * xs) / (pi * xs));
+      // Blackman, over the whole span of taps.
+      double t = (x + table.tap_num / 2) / table.tap_num;
+      double window =
+          0.42 - 0.5 * std::cos(2 * pi * t) + 0.08 * std::cos(4 * pi * t);
+      coefs[k] = sinc * window;
+      sum += coefs[k];
+    }
+    // Normalised so that a constant comes out the same, rounding error and
+    // all going to the centre tap.
+    int32_t total = 0;
+    int16_t *row = &table.coefs[p * table.tap_num];
+    for (int32_t k = 0; k < table.tap_num; k++) {
+      row[k] = (int16_t)std::lround(coefs[k] / sum * (1 << _COEF_BITS));
+      total += row[k];
+    }
+    row[table.tap_before] += (int16_t)((1 << _COEF_BITS) - total);
+  }
+  return table;
+}
+
+static std::vector<_Table> _make_tables() {
+  std::vector<_Table> tables;
+  for (int32_t s = _SCALE_STEPS; s <= _MAX_SCALE * _SCALE_STEPS; s++)
+    tables.push_back(_make_table((double)s / _SCALE_STEPS));
+  return tables;
+}
+
+void Read_sinc(const pxtnVOICEINSTANCE *p_vi, pxtnVOICESTREAM *p_stream,
+               double smp_pos, double smp_step, bool b_loop, int32_t ch_num,
+               int32_t *out) {
+  static const std::vector<_Table> tables = _make_tables();
+
+  double pos = smp_pos;
+  if (p_vi->sps != 44100) {
+    pos = pos * p_vi->sps / 44100;
+    smp_step = smp_step * p_vi->sps / 44100;
+  }
+  // Rounded up, so the cutoff is never above what the step needs.
+  int32_t t = 0;
+  if (smp_step > 1)
+    t = std::min((int32_t)std::ceil(smp_step * _SCALE_STEPS) - _SCALE_STEPS,
+                 (int32_t)tables.size() - 1);
+  const _Table &table = tables[t];
+  int32_t tap_num = table.tap_num;
+  int32_t i0 = (int32_t)pos;
+  int32_t phase = (int32_t)((pos - i0) * _PHASE_NUM);
+  const int16_t *coefs = &table.coefs[phase * tap_num];
+  int32_t src_ch = p_vi->ch_num;
+  int32_t smp_num = p_vi->smp_num;
+
+  int64_t l = 0, r = 0;
+  int32_t first = i0 - table.tap_before;
+  const int16_t *p;
+  // Taps that can't be read (e.g. from a stream not decoded that far yet)
+  // leave the sample silent rather than half summed.
+  if (first >= 0 && first + tap_num <= smp_num) {
+    if ((p = Samples(p_vi, p_stream, first, tap_num)))
+      for (int32_t k = 0; k < tap_num; k++, p += src_ch) {
+        l += p[0] * coefs[k];
+        r += p[src_ch - 1] * coefs[k];
+      }
+  } else {
+    // Past the ends it's either the other end of the loop or silence.
+    for (int32_t k = 0; k < tap_num; k++) {
+      int32_t i = first + k;
+      if (b_loop)
+        i = ((i % smp_num) + smp_num) % smp_num;
+      else if (i < 0 || i >= smp_num)
+        continue;
+      if (!(p = Samples(p_vi, p_stream, i, 1))) {
+        l = r = 0;
+        break;
+      }
+      l += p[0] * coefs[k];
+      r += p[src_ch - 1] * coefs[k];
+    }
+  }
+  l >>= _COEF_BITS;
+  r >>= _COEF_BITS;
+  if (ch_num == 1)
+    out[0] = (int32_t)((l + r) / 2);
+  else {
+    out[0] = (int32_t)l;
+    out[1] = (int32_t)r;
+  }
+}
+
+}  // namespace pxtnResample
@@ -0,0 +1,94 @@
+#ifndef pxtnResample_H
+#define pxtnResample_H
+
+#include <algorithm>
+
+#include "./pxtn.h"
+#include "./pxtnWoice.h"
+
+// Reading voice samples at a playback position. Voices are kept at the rate
+// and channel count they were loaded with (see pxtnVOICEINSTANCE), and the
+// position is in 44.1kHz samples, so this converts on the fly.
+namespace pxtnResample {
+
+// The stored samples [smp_pos, smp_pos + smp_num) of [p_vi], from [p_stream]
+// if they're not all resident. NULL if they can't be decoded (or haven't been
+// yet).
+inline const int16_t *Samples(const pxtnVOICEINSTANCE *p_vi,
+                              pxtnVOICESTREAM *p_stream, int32_t smp_pos,
+                              int32_t smp_num) {
+  if (smp_pos + smp_num <= p_vi->smp_resident)
+    return (const int16_t *)p_vi->p_smp_w + smp_pos * p_vi->ch_num;
+  int32_t tail = p_vi->smp_num - pxtnSTREAM_TAIL_NUM;
+  if (smp_pos >= tail && p_vi->smp_resident < p_vi->smp_num)
+    return (const int16_t *)p_vi->p_smp_w +
+           (p_vi->smp_resident + smp_pos - tail) * p_vi->ch_num;
+  return p_stream->Read(p_vi, smp_pos, smp_num);
+}
+
+// The most stored samples before a position that reading there looks at.
+constexpr int32_t READ_BEHIND_NUM = 32;
+
+// Where to open [p_vi]'s stream to read at [smp_pos]. The first samples are
+// resident, so it's never before the end of those.
+inline int32_t StreamPos(const pxtnVOICEINSTANCE *p_vi, double smp_pos) {
+  int32_t pos = (int32_t)(smp_pos * p_vi->sps / 44100);
+  pos = std::max(pos - READ_BEHIND_NUM,
+                 p_vi->smp_resident - READ_BEHIND_NUM * 2);
+  return std::max(pos, 0);
+}
+
+// Opens [p_stream] to read [p_vi] from [smp_pos] on, so that reading doesn't
+// have to open or seek it. With [p_keep], it's decoded on another thread (see
+// pxtnVOICESTREAM::Open).
+inline void Open(const pxtnVOICEINSTANCE *p_vi, pxtnVOICESTREAM *p_stream,
+                 double smp_pos, std::shared_ptr<const void> p_keep = nullptr) {
+  p_stream->Open(p_vi, StreamPos(p_vi, smp_pos), std::move(p_keep));
+}
+
+// Moves an open [p_stream] to read from [smp_pos] on, e.g. after looping.
+inline void Seek(const pxtnVOICEINSTANCE *p_vi, pxtnVOICESTREAM *p_stream,
+                 double smp_pos) {
+  p_stream->Seek(p_vi, StreamPos(p_vi, smp_pos));
+}
+
+// Reads [p_vi] at [smp_pos] into [out], as [ch_num] channels. [smp_step] is how
+// far the position moves per output sample, which lowers the cutoff when it's
+// more than one of the voice's samples. With [b_loop], sinc interpolation wraps
+// around the end of the voice.
+void Read_sinc(const pxtnVOICEINSTANCE *p_vi, pxtnVOICESTREAM *p_stream,
+               double smp_pos, double smp_step, bool b_loop, int32_t ch_num,
+               int32_t *out);
+
+// Nearest is how pxtone always sounded: the voice as though converted to
+// 44.1kHz stereo by nearest sample, read at the sample before [smp_pos].
+inline void Read(const pxtnVOICEINSTANCE *p_vi, pxtnVOICESTREAM *p_stream,
+                 double smp_pos, double smp_step, bool b_loop,
+                 pxtnRESAMPLE quality, int32_t ch_num, int32_t *out) {
+  if (quality == pxtnRESAMPLE_sinc) {
+    Read_sinc(p_vi, p_stream, smp_pos, smp_step, b_loop, ch_num, out);
+    return;
+  }
+  int32_t pos = (int32_t)smp_pos;
+  if (p_vi->sps != 44100) {
+    pos = (int32_t)((double)pos * p_vi->sps / 44100);
+    if (pos >= p_vi->smp_num) pos = p_vi->smp_num - 1;
+  }
+  const int16_t *p_smp = Samples(p_vi, p_stream, pos, 1);
+  if (!p_smp) {
+    for (int32_t ch = 0; ch < ch_num; ch++) out[ch] = 0;
+    return;
+  }
+  int32_t l = p_smp[0];
+  int32_t r = p_smp[p_vi->ch_num - 1];
+  if (ch_num == 1)
+    out[0] = (l + r) / 2;
+  else {
+    out[0] = l;
+    out[1] = r;
+  }
+}
+
+}  // namespace pxtnResample
+
+#endif
@@ -104,6 +104,7 @@ pxtnService::pxtnService() {
 
   _sampled_proc = NULL;
   _sampled_user = NULL;
+  _tone_cache = NULL;
 }
 
 bool pxtnService::_release() {
@@ -214,21 +215,32 @@ bool pxtnService::AdjustMeasNum() {
 
 int32_t pxtnService::Group_Num() const { return _b_init ? _group_num : 0; }
 
-pxtnERR pxtnService::tones_ready(mooState &moo_state) {
+pxtnERR pxtnService::tones_ready(mooState &moo_state, int32_t thread_num,
+                                 bool b_lazy) {
   if (!_b_init) return pxtnERR_INIT;
 
-  pxtnERR res = pxtnERR_VOID;
   int32_t beat_num = master->get_beat_num();
   float beat_tempo = master->get_beat_tempo();
 
   moo_state.delays.clear();
   for (size_t i = 0; i < _delays.size(); i++)
     moo_state.delays.emplace_back(_delays[i], beat_num, beat_tempo, _dst_sps);
+  if (b_lazy) return pxtnOK;
+
+  // Each woice only touches its own voices, and noise is built from the
+  // builder's tables without changing them.
+  std::vector<pxtnERR> results(_woice_num, pxtnOK);
+  auto ready = [&](int32_t i) {
+    results[i] = _woices[i]->Tone_Ready(_ptn_bldr, _dst_sps, _tone_cache);
+  };
+  if (thread_num > 1 && _woice_num > 1) {
+    pxtnThreadPool pool(std::min(thread_num, _woice_num));
+    pool.For(_woice_num, ready);
+  } else
+    for (int32_t i = 0; i < _woice_num; i++) ready(i);
 
-  for (int32_t i = 0; i < _woice_num; i++) {
-    res = _woices[i]->Tone_Ready(_ptn_bldr, _dst_sps);
-    if (res != pxtnOK) return res;
-  }
+  for (int32_t i = 0; i < _woice_num; i++)
+    if (results[i] != pxtnOK) return results[i];
   return pxtnOK;
 }
 
@@ -376,7 +388,38 @@ pxtnERR pxtnService::Woice_read(int32_t idx, pxtnDescriptor *desc,
 }
 
 pxtnERR pxtnService::Woice_ReadyTone(std::shared_ptr<pxtnWoice> woice) const {
-  return woice->Tone_Ready(_ptn_bldr, _dst_sps);
+  return woice->Tone_Ready(_ptn_bldr, _dst_sps, _tone_cache);
+}
+
+std::vector<int32_t> pxtnService::Woice_Order_by_use(int32_t clock) const {
+  // Ranked by when each is first heard, with those that aren't from [clock] on
+  // after those that are.
+  const int64_t never = INT64_MAX;
+  std::vector<int64_t> ranks(_woice_num, never);
+  std::vector<int32_t> unit_woices(_unit_num, EVENTDEFAULT_VOICENO);
+  for (const EVERECORD *e = evels->get_Records(); e; e = e->next) {
+    if (e->unit_no >= _unit_num) continue;
+    if (e->kind == EVENTKIND_VOICENO) {
+      unit_woices[e->unit_no] = e->value;
+      continue;
+    }
+    if (e->kind != EVENTKIND_ON) continue;
+    int32_t w = unit_woices[e->unit_no];
+    if (w < 0 || w >= _woice_num) continue;
+    int64_t rank;
+    if (e->clock + e->value > clock)
+      rank = std::max(e->clock, clock);
+    else
+      rank = int64_t(INT32_MAX) + 1 + e->clock;
+    ranks[w] = std::min(ranks[w], rank);
+  }
+
+  std::vector<int32_t> order(_woice_num);
+  for (int32_t i = 0; i < _woice_num; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+    return ranks[a] < ranks[b];
+  });
+  return order;
 }
 
 bool pxtnService::Woice_Remove(int32_t idx) {
@@ -476,6 +519,7 @@ bool pxtnService::Unit_Replace(int32_t old_place, int32_t new_place,
                 moo_state.units.begin() +
                     (old_place < new_place ? old_place + 1 : old_place),
                 moo_state.units.begin() + std::max(old_place, new_place) + 1);
+  moo_state.resetActiveUnits();
   return true;
 }
 
@@ -534,6 +578,13 @@ bool pxtnService::get_byte_per_smp(int32_t *p_byte_per_smp) const {
   return true;
 }
 
+int32_t pxtnService::get_byte_per_smp(pxtnSAMPLEFORMAT format) const {
+  if (!_b_init) return 0;
+  if (format == pxtnSAMPLEFORMAT_float32)
+    return int32_t(sizeof(float)) * _dst_ch_num;
+  return _dst_byte_per_smp;
+}
+
 bool pxtnService::set_sampled_callback(pxtnSampledCallback proc, void *user) {
   if (!_b_init) return false;
   _sampled_proc = proc;
@@ -541,6 +592,8 @@ bool pxtnService::set_sampled_callback(pxtnSampledCallback proc, void *user) {
   return true;
 }
 
+void pxtnService::set_tone_cache(pxtnToneCache *cache) { _tone_cache = cache; }
+
 static _enum_Tag _CheckTagCode(const char *p_code) {
   if (!memcmp(p_code, _code_antiOPER, _CODESIZE))
     return _TAG_antiOPER;
@@ -1294,11 +1347,9 @@ bool pxtnService::_x3x_TuningKeyEvent() {
         _woices[u]->get_x3x_basic_key() - EVENTDEFAULT_BASICKEY;
 
     if (!evels->get_Count((uint8_t)u, (uint8_t)EVENTKIND_KEY)) {
-      evels->Record_Add_i(0, (uint8_t)u, EVENTKIND_KEY, (int32_t)0x6000,
-                          nullptr);
+      evels->Record_Add_i(0, (uint8_t)u, EVENTKIND_KEY, (int32_t)0x6000);
     }
-    evels->Record_Value_Change(0, -1, (uint8_t)u, EVENTKIND_KEY, change_value,
-                               nullptr);
+    evels->Record_Value_Change(0, -1, (uint8_t)u, EVENTKIND_KEY, change_value);
   }
   return true;
 }
@@ -14,6 +14,7 @@
 #include "./pxtnOverDrive.h"
 #include "./pxtnPulse_NoiseBuilder.h"
 #include "./pxtnText.h"
+#include "./pxtnThreadPool.h"
 #include "./pxtnUnit.h"
 #include "./pxtnWoice.h"
 
@@ -21,13 +22,34 @@
 
 #define pxtnVOMITPREPFLAG_loop 0x01
 #define pxtnVOMITPREPFLAG_unit_mute 0x02
+// For playing as it's mooed: streamed voices are decoded ahead on another
+// thread, and are silent where that hasn't caught up rather than wait.
+#define pxtnVOMITPREPFLAG_realtime 0x04
 
 class InterpolatedVolumeMeter;
 
+// Ways to split a render into stems. A unit's stem is what it sounds like
+// soloed, through its group's effects. A group's stem is the group after its
+// effects.
+enum pxtnSTEM : int8_t {
+  pxtnSTEM_none = 0,
+  pxtnSTEM_unit,
+  pxtnSTEM_group,
+};
+
+// What Moo writes. float32 is the mix before clipping, scaled so that int16's
+// full scale is 1.0.
+enum pxtnSAMPLEFORMAT : int8_t {
+  pxtnSAMPLEFORMAT_int16 = 0,
+  pxtnSAMPLEFORMAT_float32,
+};
+
 typedef struct {
   int32_t start_pos_meas;
   int32_t start_pos_sample;
   float start_pos_float;
+  // Samples of output to start after, counting loops. Overrides the others.
+  int32_t start_pos_output;
 
   int32_t meas_end;
   int32_t meas_repeat;
@@ -37,6 +59,14 @@ typedef struct {
   float master_volume;
 
   std::optional<uint32_t> solo_unit;
+  // For Moo_Stems.
+  pxtnSTEM stems;
+  pxtnSAMPLEFORMAT format;
+  pxtnRESAMPLE resample;
+
+  // Number of threads to render units on. 0 / 1 renders everything on the
+  // thread calling Moo.
+  int32_t thread_num;
 } pxtnVOMITPREPARATION;
 
 class pxtnService;
@@ -47,6 +77,8 @@ struct mooParams {
   bool b_mute_by_unit;
   // Is looping enabled?
   bool b_loop;
+  // See pxtnVOMITPREPFLAG_realtime.
+  bool b_realtime;
 
   // How many samples at the tail end of the note to use to fade to silence?
   int32_t smp_smooth;
@@ -61,6 +93,11 @@ struct mooParams {
 
   // A setting to only render a single unit. For ptcollab per-unit export
   std::optional<uint32_t> solo_unit;
+  // What Moo_Stems splits into.
+  pxtnSTEM stems;
+  pxtnSAMPLEFORMAT format;
+  // How voices are read between their samples.
+  pxtnRESAMPLE resample;
 
   mooParams();
 
@@ -74,11 +111,23 @@ struct mooParams {
   void adjustClockRate(float rate) { clock_rate = rate; };
 };
 
+// Unit states at a measure, after all events before it.
+struct mooCheckpoint {
+  int32_t clock;
+  const EVERECORD *p_eve;  // Last event before [clock].
+  // For a unit with a note still on at [clock] (whose effect depends on
+  // where a seek lands), the first such ON, and the unit state from just
+  // before it.
+  std::vector<const EVERECORD *> p_ons;
+  std::vector<pxtnUnitTone> units;
+};
+
 // Moo values that change as the song plays.
 struct mooState {
   mooParams params;
-  // Buffers that units write to for group operations
-  std::vector<int32_t> group_smps;
+  // Buffers that units write to for group operations (a block of samples per
+  // group and channel)
+  std::vector<int32_t> group_block_smps;
   int32_t time_pan_index;
   bool end_vomit;
 
@@ -87,6 +136,16 @@ struct mooState {
 
   // Next event
   const EVERECORD *p_eve;
+  // After seeking from a checkpoint: notes that were still on at the
+  // checkpoint. Their unit's events from there up to [p_eve] are replayed.
+  std::vector<const EVERECORD *> seek_replays;
+
+  // Unit states at the repeat measure, made ahead of time (see
+  // pxtnService::moo_prepare_repeat) so that looping back doesn't have to
+  // replay every event up to there.
+  mooCheckpoint repeat_point;
+  std::shared_ptr<std::atomic<int32_t>> repeat_edits;  // Null if not made.
+  float repeat_clock_rate;
 
   // Number of times this moo has looped. For ptcollab bookkeeping.
   int num_loop;
@@ -97,7 +156,18 @@ struct mooState {
 
   // Buffers for each unit
   std::vector<pxtnUnitTone> units;
+  // Units that are sounding (see pxtnUnitTone::is_sounding), in order. Only
+  // these are rendered, the rest are just skipped forward.
+  std::vector<int32_t> active_units;
   std::vector<pxtnDelayTone> delays;
+  // Buffers that units render a block of samples into
+  std::vector<int32_t> unit_block_smps;
+  // If set, units are rendered in parallel. Each unit still renders into its
+  // own buffer and they are mixed in order, so the output is the same.
+  std::unique_ptr<pxtnThreadPool> thread_pool;
+  // For unit stems, each unit's own delays and group buffers.
+  std::vector<std::vector<pxtnDelayTone>> stem_delays;
+  std::vector<int32_t> stem_group_smps;
 
   mooState();
 
@@ -110,10 +180,37 @@ struct mooState {
   void resetGroups(int32_t group_num);
   bool resetUnits(size_t unit_num, std::shared_ptr<const pxtnWoice> woice);
   bool addUnit(std::shared_ptr<const pxtnWoice> woice);
+  void activateUnit(int32_t u);
+  // Call after [units] are removed or reordered.
+  void resetActiveUnits();
+  // Whether mooing on from this state gives the same output as from [other],
+  // e.g., to check that a seek has caught up with playing from the start.
+  bool soundsLike(const mooState &other) const;
 
   void tones_clear();
 };
 
+// Checkpoints every few measures, so that moo_preparation only has to replay
+// the events since the nearest one instead of all since the start of the
+// song. They're made as seeks go past them and dropped when events before
+// them are edited. Other changes to how events play (e.g., editing a woice)
+// aren't noticed, so call clear() after those.
+struct mooCheckpoints {
+  int32_t meas_interval;
+  std::vector<mooCheckpoint> checkpoints;
+
+  // What [checkpoints] were made with.
+  std::shared_ptr<std::atomic<int32_t>> edits;
+  float clock_rate;
+  float bt_tempo;
+  int32_t meas_clock;
+  int32_t dst_ch_num, dst_sps;
+  size_t unit_num;
+
+  mooCheckpoints(int32_t meas_interval = 4);
+  void clear();
+};
+
 typedef bool (*pxtnSampledCallback)(void *user, const pxtnService *pxtn);
 
 class pxtnService {
@@ -186,8 +283,33 @@ class pxtnService {
   bool _moo_InitUnitTone(mooState &moo_state) const;
   pxtnSampledCallback _sampled_proc;
   void *_sampled_user;
-
-  bool _moo_PXTONE_SAMPLE(void *p_data, mooState &moo_state) const;
+  pxtnToneCache *_tone_cache;
+
+  bool _moo_PXTONE_BLOCK(void *p_data, int32_t smp_num, mooState &moo_state,
+                         int32_t *p_smp_w,
+                         void *const *p_stems = nullptr) const;
+  static bool _moo_Fade(mooState &moo_state, int32_t smp_run, int32_t *scales);
+  void _moo_Groups_Mix(int32_t *group_smps, const mooState &moo_state,
+                       const int32_t *units, size_t unit_num,
+                       int32_t smp_run) const;
+  void _moo_Groups_Supple(int32_t *group_smps,
+                          std::vector<pxtnDelayTone> &delays,
+                          int32_t smp_run) const;
+  void _moo_Groups_Store(const int32_t *group_smps, int32_t group,
+                         const int32_t *fade_scales, const mooState &moo_state,
+                         void *p_data, int32_t smp_run) const;
+  void _moo_Stems_Mix(void *const *p_stems, int32_t smp_run,
+                      const int32_t *fade_scales, mooState &moo_state) const;
+  std::vector<mooCheckpoint> _moo_Checkpoints_Make(
+      const mooCheckpoint *p_from, const std::vector<int32_t> &clocks,
+      const mooParams &params, size_t unit_num) const;
+  void _moo_Checkpoints_Extend(mooCheckpoints &cps, const mooParams &params,
+                               size_t checkpoint_num) const;
+  bool _moo_Checkpoints_Check(mooCheckpoints &cps,
+                              const mooState &moo_state) const;
+  void _moo_Checkpoints_Seek(mooCheckpoints &cps, mooState &moo_state) const;
+  int32_t _moo_Repeat_Clock(const mooParams &params) const;
+  bool _moo_Repeat_IsReady(const mooState &moo_state) const;
 
  public:
   pxtnService();
@@ -208,7 +330,11 @@ class pxtnService {
 
   int32_t get_last_error_id() const;
 
-  pxtnERR tones_ready(mooState &moo_state);
+  // Readies the woices [thread_num] at a time. If any fail, returns the error
+  // of the first of them. With [b_lazy] the woices are left to be readied
+  // later (see Woice_Order_by_use), and units stay silent until theirs are.
+  pxtnERR tones_ready(mooState &moo_state, int32_t thread_num = 1,
+                      bool b_lazy = false);
 
   int32_t Group_Num() const;
 
@@ -241,6 +367,9 @@ class pxtnService {
 
   pxtnERR Woice_read(int32_t idx, pxtnDescriptor *desc, pxtnWOICETYPE type);
   pxtnERR Woice_ReadyTone(std::shared_ptr<pxtnWoice> woice) const;
+  // The woices in the order they're first played from [clock] on, then the
+  // ones only played before it, then the rest.
+  std::vector<int32_t> Woice_Order_by_use(int32_t clock) const;
   bool Woice_Remove(int32_t idx);
   bool Woice_Replace(int32_t old_place, int32_t new_place);
 
@@ -260,7 +389,11 @@ class pxtnService {
   bool set_destination_quality(int32_t ch_num, int32_t sps);
   bool get_destination_quality(int32_t *p_ch_num, int32_t *p_sps) const;
   bool get_byte_per_smp(int32_t *p_byte_per_smp) const;
+  // Bytes per sample of [format] output, or 0 before init.
+  int32_t get_byte_per_smp(pxtnSAMPLEFORMAT format) const;
   bool set_sampled_callback(pxtnSampledCallback proc, void *user);
+  // Where readied woices are kept and looked up, or NULL for nowhere.
+  void set_tone_cache(pxtnToneCache *cache);
 
   //////////////
   // Moo..
@@ -269,6 +402,12 @@ class pxtnService {
   bool Moo(mooState &moo_state, void *p_buf, int32_t size,
            int32_t *filled_size = nullptr,
            std::vector<InterpolatedVolumeMeter> *volume_meters = nullptr) const;
+  // Like Moo, but renders each stem (see pxtnSTEM) into its own buffer of
+  // [size] bytes in [p_bufs], in one pass. Needs moo_preparation with stems
+  // set. What's past the end of the song is left silent.
+  bool Moo_Stems(mooState &moo_state, void *const *p_bufs, int32_t size) const;
+  // The number of buffers Moo_Stems fills.
+  int32_t moo_get_stem_num(const mooState &moo_state) const;
 
   int32_t moo_tone_sample_multi(std::map<int, pxtnUnitTone *> p_us,
                                 const mooParams &params, void *data,
@@ -307,7 +446,14 @@ class pxtnService {
   int32_t moo_get_num_loop() const;
 
   bool moo_preparation(const pxtnVOMITPREPARATION *p_prep,
-                       mooState &moo_state) const;
+                       mooState &moo_state,
+                       mooCheckpoints *p_checkpoints = nullptr) const;
+  // Makes [moo_state]'s repeat point if it's missing or out of date, so that
+  // looping back is quick. moo_preparation does this, but after edits before
+  // the repeat measure it's best called again ahead of the loop, outside of
+  // the audio callback. Until then, looping back replays every event.
+  void moo_prepare_repeat(mooState &moo_state,
+                          mooCheckpoints *p_checkpoints = nullptr) const;
 };
 
 int32_t pxtnService_moo_CalcSampleNum(int32_t meas_num, int32_t beat_num,
@@ -1,10 +1,17 @@
 
+#include <algorithm>
+
 #include "../editor/audio/VolumeMeter.h"
+#include "./pxtnMix.h"
 #include "./pxtnService.h"
 
 mooParams::mooParams() {
   b_mute_by_unit = false;
   b_loop = true;
+  b_realtime = false;
+  stems = pxtnSTEM_none;
+  format = pxtnSAMPLEFORMAT_int16;
+  resample = pxtnRESAMPLE_nearest;
 
   master_vol = 1.0f;
 }
@@ -14,17 +21,20 @@ mooState::mooState() {
   num_loop = 0;
   smp_count = 0;
   fade_fade = 0;
+  repeat_clock_rate = 0;
   end_vomit = true;
 }
 
 void mooState::resetGroups(int32_t group_num) {
-  group_smps.clear();
-  group_smps.resize(group_num, 0);
+  group_block_smps.clear();
+  group_block_smps.resize(
+      size_t(group_num) * pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL, 0);
 }
 
 bool mooState::resetUnits(size_t unit_num,
                           std::shared_ptr<const pxtnWoice> woice) {
   units.clear();
+  active_units.clear();
   units.reserve(unit_num);
   for (size_t i = 0; i < unit_num; ++i)
     if (!addUnit(woice)) return false;
@@ -38,6 +48,74 @@ bool mooState::addUnit(std::shared_ptr<const pxtnWoice> woice) {
   return true;
 }
 
+mooCheckpoints::mooCheckpoints(int32_t meas_interval)
+    : meas_interval(meas_interval) {
+  clear();
+}
+
+void mooCheckpoints::clear() {
+  checkpoints.clear();
+  edits.reset();
+  clock_rate = 0;
+  bt_tempo = 0;
+  meas_clock = 0;
+  dst_ch_num = 0;
+  dst_sps = 0;
+  unit_num = 0;
+}
+
+void mooState::activateUnit(int32_t u) {
+  auto it = std::lower_bound(active_units.begin(), active_units.end(), u);
+  if (it == active_units.end() || *it != u) active_units.insert(it, u);
+}
+
+void mooState::resetActiveUnits() {
+  active_units.clear();
+  for (size_t u = 0; u < units.size(); u++)
+    if (units[u].is_sounding()) active_units.push_back(int32_t(u));
+}
+
+static bool all_sound_like(const std::vector<pxtnDelayTone>& a,
+                           const std::vector<pxtnDelayTone>& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++)
+    if (!a[i].sounds_like(b[i])) return false;
+  return true;
+}
+
+bool mooState::soundsLike(const mooState& other) const {
+  if (smp_count != other.smp_count || p_eve != other.p_eve ||
+      seek_replays != other.seek_replays ||
+      time_pan_index != other.time_pan_index)
+    return false;
+  if (fade_fade != other.fade_fade ||
+      (fade_fade && (fade_count != other.fade_count ||
+                     fade_max != other.fade_max)))
+    return false;
+  if (units.size() != other.units.size()) return false;
+  // Which units have a portamento before their next key event or note (which
+  // sets the key start from the key it's at). Looping back resets the units,
+  // so events up to the end of the song are enough.
+  std::vector<bool> portament_next(units.size(), !p_eve);
+  std::vector<bool> seen(units.size(), !p_eve);
+  for (const EVERECORD* e = p_eve ? p_eve->next : nullptr; e; e = e->next) {
+    bool b_key = e->kind == EVENTKIND_KEY ||
+                 (e->kind == EVENTKIND_ON &&
+                  int32_t(e->value * params.clock_rate) > 0);
+    if (!b_key && !(e->kind == EVENTKIND_PORTAMENT && e->value)) continue;
+    if (size_t(e->unit_no) >= units.size() || seen[e->unit_no]) continue;
+    seen[e->unit_no] = true;
+    portament_next[e->unit_no] = (e->kind == EVENTKIND_PORTAMENT);
+  }
+  for (size_t u = 0; u < units.size(); u++)
+    if (!units[u].sounds_like(other.units[u], portament_next[u])) return false;
+  if (!all_sound_like(delays, other.delays)) return false;
+  if (stem_delays.size() != other.stem_delays.size()) return false;
+  for (size_t i = 0; i < stem_delays.size(); i++)
+    if (!all_sound_like(stem_delays[i], other.stem_delays[i])) return false;
+  return true;
+}
+
 ////////////////////////////////////////////////
 // Units   ////////////////////////////////////
 ////////////////////////////////////////////////
@@ -103,17 +181,20 @@ void mooParams::processNonOnEvent(pxtnUnitTone* p_u, EVENTKIND kind,
       // A bit hacky but interpret EVENTKIND_ON value as how much time is left
       std::shared_ptr<const pxtnWoice> p_wc;
       if (!(p_wc = p_u->get_woice())) break;
+      if (!p_wc->is_tone_ready()) break;
       for (int32_t v = 0; v < p_wc->get_voice_num(); v++) {
         pxtnVOICETONE* p_tone = p_u->get_tone(v);
         const pxtnVOICEINSTANCE* p_vi = p_wc->get_instance(v);
         p_tone->life_count = p_vi->env_release + value;  //
         p_tone->on_count = value;
       }
+      p_u->Tone_Open_Streams(b_realtime);
     }
   }
 }
 
-// u is used to look ahead to cut short notes whose release go into the next.
+// u is used to look ahead to cut short notes whose release go into the next
+// (found through the per-unit ON chain of pxtnEvelist).
 // This note duration cutting is for the smoothing near the end of a note.
 void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
                              int32_t clock, int32_t smp_end,
@@ -133,6 +214,12 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
       p_u->Tone_KeyOn();
 
       if (!(p_wc = p_u->get_woice())) break;
+      // Woices still being readied in the background keep their units silent.
+      if (!p_wc->is_tone_ready()) {
+        p_u->Tone_ZeroLives();
+        break;
+      }
+      if (p_u->was_reset_unready()) resetVoiceOn(p_u);
       for (int32_t v = 0; v < p_wc->get_voice_num(); v++) {
         p_tone = p_u->get_tone(v);
         p_vi = p_wc->get_instance(v);
@@ -146,14 +233,8 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
               p_vi->env_release;
           int32_t max_life_count2;
           int32_t c = e->clock + e->value + p_tone->env_release_clock;
-          EVERECORD* next = NULL;
-          for (EVERECORD* p = e->next; p; p = p->next) {
-            if (p->clock > c) break;
-            if (p->unit_no == e->unit_no && p->kind == EVENTKIND_ON) {
-              next = p;
-              break;
-            }
-          }
+          const EVERECORD* next = pxtn->evels->get_Next_Kind(e);
+          if (next && next->clock > c) next = NULL;
           /* end the note at the end of the song if there's no next note */
           if (!next) {
             if (smp_end == -1)
@@ -185,6 +266,7 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
             p_tone->env_volume = p_tone->env_start = 128;  // no-envelope
         }
       }
+      p_u->Tone_Open_Streams(b_realtime);
       break;
     }
 
@@ -193,13 +275,189 @@ void mooParams::processEvent(pxtnUnitTone* p_u, const EVERECORD* e,
       break;
   }
 }
+
+// Steps the fade along [smp_run] samples, setting the volume scale for each
+// in [scales] (-1 for none). Returns whether a fade out has finished.
+bool pxtnService::_moo_Fade(mooState& moo_state, int32_t smp_run,
+                            int32_t* scales) {
+  bool b_fade_end = false;
+  for (int32_t i = 0; i < smp_run; i++) {
+    if (!moo_state.fade_fade) {
+      scales[i] = -1;
+      continue;
+    }
+    scales[i] = moo_state.fade_count >> 8;
+
+    // fade out
+    if (moo_state.fade_fade < 0) {
+      if (moo_state.fade_count > 0)
+        moo_state.fade_count--;
+      else
+        b_fade_end = true;
+    }
+    // fade in
+    else if (moo_state.fade_fade > 0) {
+      if (moo_state.fade_count < (moo_state.fade_max << 8))
+        moo_state.fade_count++;
+      else
+        moo_state.fade_fade = 0;
+    }
+  }
+  return b_fade_end;
+}
+
+// Sums [unit_num] of the units just rendered into their groups in
+// [group_smps], laid out like moo_state.group_block_smps.
+void pxtnService::_moo_Groups_Mix(int32_t* group_smps,
+                                  const mooState& moo_state,
+                                  const int32_t* units, size_t unit_num,
+                                  int32_t smp_run) const {
+  constexpr int32_t block_size = pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL;
+  for (int32_t g = 0; g < _group_num; g++) {
+    for (int32_t ch = 0; ch < _dst_ch_num; ch++)
+      std::fill_n(&group_smps[g * block_size + ch * pxtnBUFSIZE_MOOBLOCK],
+                  smp_run, 0);
+  }
+  for (size_t i = 0; i < unit_num; i++) {
+    int32_t u = units[i];
+    int32_t g = moo_state.units[u].get_group_no();
+    for (int32_t ch = 0; ch < _dst_ch_num; ch++)
+      pxtnMix::Add(&group_smps[g * block_size + ch * pxtnBUFSIZE_MOOBLOCK],
+                   &moo_state.unit_block_smps[u * block_size +
+                                              ch * pxtnBUFSIZE_MOOBLOCK],
+                   smp_run);
+  }
+}
+
+// Applies overdrives and [delays] to [group_smps].
+void pxtnService::_moo_Groups_Supple(int32_t* group_smps,
+                                     std::vector<pxtnDelayTone>& delays,
+                                     int32_t smp_run) const {
+  constexpr int32_t block_size = pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL;
+  for (int32_t ch = 0; ch < _dst_ch_num; ch++) {
+    int32_t* p_group_smps = &group_smps[ch * pxtnBUFSIZE_MOOBLOCK];
+    for (size_t o = 0; o < _ovdrvs.size(); o++)
+      _ovdrvs[o].Tone_Supple(p_group_smps, block_size, smp_run);
+    for (size_t d = 0; d < _delays.size(); d++) {
+      // TODO: Be robust to if there's a new delay. Generate new delay on the
+      // fly?
+      delays[d].Tone_Supple(_delays[d], ch, p_group_smps, block_size,
+                            smp_run);
+    }
+  }
+  // delay
+  for (size_t d = 0; d < delays.size(); d++) delays[d].Tone_Increment(smp_run);
+}
+
+// Writes the groups in [group_smps] (or only [group], if not -1) to [p_data]
+// with the fade and master volume.
+void pxtnService::_moo_Groups_Store(const int32_t* group_smps, int32_t group,
+                                    const int32_t* fade_scales,
+                                    const mooState& moo_state,
+                                    void* p_data, int32_t smp_run) const {
+  constexpr int32_t block_size = pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL;
+  /* Add group samples together for final */
+  // collect.
+  int32_t works[pxtnMAX_CHANNEL][pxtnBUFSIZE_MOOBLOCK];
+  int32_t* p_works[pxtnMAX_CHANNEL];
+  for (int32_t ch = 0; ch < _dst_ch_num; ch++) {
+    p_works[ch] = works[ch];
+    std::fill_n(works[ch], smp_run, 0);
+    for (int32_t g = 0; g < _group_num; g++) {
+      if (group >= 0 && g != group) continue;
+      pxtnMix::Add(works[ch],
+                   &group_smps[g * block_size + ch * pxtnBUFSIZE_MOOBLOCK],
+                   smp_run);
+    }
+  }
+
+  /* Fading scale probably for rendering at the end */
+  for (int32_t i = 0; i < smp_run; i++) {
+    if (fade_scales[i] < 0) continue;
+    for (int32_t ch = 0; ch < _dst_ch_num; ch++)
+      works[ch][i] = works[ch][i] * fade_scales[i] / moo_state.fade_max;
+  }
+
+  // Float output takes the master volume without rounding, and isn't clipped.
+  if (moo_state.params.format == pxtnSAMPLEFORMAT_float32) {
+    pxtnMix::Float_Store(static_cast<float*>(p_data), p_works, _dst_ch_num,
+                         smp_run, moo_state.params.master_vol / 32768.0f);
+    return;
+  }
+
+  // master volume
+  for (int32_t ch = 0; ch < _dst_ch_num; ch++)
+    pxtnMix::Volume(works[ch], smp_run, moo_state.params.master_vol);
+
+  // to buffer..
+  pxtnMix::Clip_Store(static_cast<int16_t*>(p_data), p_works, _dst_ch_num,
+                      smp_run, moo_state.params.top);
+}
+
+// Writes a run of each stem to [p_stems], once the units have rendered it.
+void pxtnService::_moo_Stems_Mix(void* const* p_stems, int32_t smp_run,
+                                 const int32_t* fade_scales,
+                                 mooState& moo_state) const {
+  const std::vector<int32_t>& active_units = moo_state.active_units;
+  if (moo_state.params.stems == pxtnSTEM_group) {
+    int32_t* p_group_smps = moo_state.group_block_smps.data();
+    _moo_Groups_Mix(p_group_smps, moo_state, active_units.data(),
+                    active_units.size(), smp_run);
+    _moo_Groups_Supple(p_group_smps, moo_state.delays, smp_run);
+    for (int32_t g = 0; g < _group_num; g++)
+      _moo_Groups_Store(p_group_smps, g, fade_scales, moo_state, p_stems[g],
+                        smp_run);
+    return;
+  }
+
+  // Each unit goes through effects of its own, so that its stem sounds like
+  // it does soloed.
+  constexpr int32_t block_size = pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL;
+  size_t unit_num = moo_state.units.size();
+  size_t groups_size = size_t(_group_num) * block_size;
+  // Made from the song's delays when the stems start, and again if delays are
+  // added or removed.
+  moo_state.stem_delays.resize(unit_num, moo_state.delays);
+  for (std::vector<pxtnDelayTone>& delays : moo_state.stem_delays)
+    if (delays.size() != moo_state.delays.size()) delays = moo_state.delays;
+  if (moo_state.stem_group_smps.size() < unit_num * groups_size)
+    moo_state.stem_group_smps.resize(unit_num * groups_size);
+  auto mix_stem = [&](int32_t u) {
+    int32_t* p_group_smps = &moo_state.stem_group_smps[u * groups_size];
+    bool sounding =
+        std::binary_search(active_units.begin(), active_units.end(), u);
+    _moo_Groups_Mix(p_group_smps, moo_state, &u, sounding ? 1 : 0, smp_run);
+    _moo_Groups_Supple(p_group_smps, moo_state.stem_delays[u], smp_run);
+    _moo_Groups_Store(p_group_smps, -1, fade_scales, moo_state, p_stems[u],
+                      smp_run);
+  };
+  if (moo_state.thread_pool)
+    moo_state.thread_pool->For(int32_t(unit_num), mix_stem);
+  else
+    for (size_t u = 0; u < unit_num; u++) mix_stem(int32_t(u));
+}
+
 #include <QDebug>
 // TODO: Could probably put this in moo_state. Maybe make moo_state.params a
 // member of it.
-bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
+// Renders up to [smp_num] samples into [p_data]. Events are only checked at
+// the start of the call, and the run is cut short at the next event, the end
+// of the song or the end of a fade, so that every unit can render its run in
+// one go. [*p_smp_w] is set to the number of samples written. Returns false
+// when the song has ended (the last sample rendered is then not written).
+// With [p_stems], the stems are written there instead of the mix to [p_data].
+bool pxtnService::_moo_PXTONE_BLOCK(void* p_data, int32_t smp_num,
+                                    mooState& moo_state, int32_t* p_smp_w,
+                                    void* const* p_stems) const {
+  *p_smp_w = 0;
+
+  std::vector<int32_t>& active_units = moo_state.active_units;
+  size_t unit_num = moo_state.units.size();
+  if (!active_units.empty() && size_t(active_units.back()) >= unit_num)
+    moo_state.resetActiveUnits();
+
   // envelope..
-  for (size_t u = 0; u < moo_state.units.size(); u++)
-    moo_state.units[u].Tone_Envelope();
+  for (int32_t u : active_units) moo_state.units[u].Tone_Envelope();
 
   int32_t clock = (int32_t)(moo_state.smp_count / moo_state.params.clock_rate);
 
@@ -217,6 +475,20 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
   // Handling arbitrary changes while playing is a bit more difficult. You'd
   // have to split by event type at least, since something near the beginning
   // could have lasting effects to now.
+  // After seeking from a checkpoint, first catch up on the notes that were on
+  // there.
+  for (const EVERECORD* p_on : moo_state.seek_replays) {
+    int32_t u = p_on->unit_no;
+    for (const EVERECORD* e = p_on;; e = e->next) {
+      if (e->unit_no == u)
+        moo_state.params.processEvent(&moo_state.units[u], e, clock, smp_end,
+                                      this);
+      if (e == moo_state.p_eve) break;
+    }
+    if (moo_state.units[u].is_sounding()) moo_state.activateUnit(u);
+  }
+  moo_state.seek_replays.clear();
+
   const EVERECORD* next =
       (moo_state.p_eve ? moo_state.p_eve->next : evels->get_Records());
   while (next && next->clock <= clock) {
@@ -225,87 +497,104 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
     // unit on the fly? (update: currently done by adding in the controller)
     moo_state.params.processEvent(&moo_state.units[u], next, clock, smp_end,
                                   this);
+    if (next->kind == EVENTKIND_ON && moo_state.units[u].is_sounding())
+      moo_state.activateUnit(u);
     moo_state.p_eve = next;
     next = moo_state.p_eve->next;
   }
 
+  // length of this run..
+  int32_t smp_run = std::min(smp_num, pxtnBUFSIZE_MOOBLOCK);
+  if (smp_end - moo_state.smp_count < smp_run)
+    smp_run = std::max(1, smp_end - moo_state.smp_count);
+  // A fade out ends on the sample after the fade count hits 0.
+  if (moo_state.fade_fade < 0 && moo_state.fade_count < smp_run)
+    smp_run = moo_state.fade_count + 1;
+  // Stop right before the sample where the next event's clock is reached.
+  if (next) {
+    auto reached = [&](int32_t i) {
+      return (int32_t)((moo_state.smp_count + i) /
+                       moo_state.params.clock_rate) >= next->clock;
+    };
+    if (reached(smp_run)) {
+      int32_t lo = 1, hi = smp_run;
+      while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (reached(mid))
+          hi = mid;
+        else
+          lo = mid + 1;
+      }
+      smp_run = lo;
+    }
+  }
+
   // sampling..
-  for (size_t u = 0; u < moo_state.units.size(); u++) {
+  constexpr int32_t block_size = pxtnBUFSIZE_MOOBLOCK * pxtnMAX_CHANNEL;
+  if (moo_state.unit_block_smps.size() < unit_num * block_size)
+    moo_state.unit_block_smps.resize(unit_num * block_size);
+  if (moo_state.group_block_smps.size() < size_t(_group_num) * block_size)
+    moo_state.group_block_smps.resize(size_t(_group_num) * block_size);
+
+  // Silent units would render zeros, so they only need their key moved along.
+  for (size_t u = 0, a = 0; u < unit_num; u++) {
+    if (a < active_units.size() && size_t(active_units[a]) == u)
+      a++;
+    else
+      moo_state.units[u].Tone_Skip(smp_run);
+  }
+
+  auto render_unit = [&](int32_t a) {
+    int32_t u = active_units[a];
     bool muted;
     if (moo_state.params.solo_unit.has_value())
-      muted = moo_state.params.solo_unit.value() != u;
+      muted = moo_state.params.solo_unit.value() != uint32_t(u);
     else
       muted = moo_state.params.b_mute_by_unit && !_units[u]->get_played();
-    moo_state.units[u].Tone_Sample(muted, _dst_ch_num, moo_state.time_pan_index,
-                                   moo_state.params.smp_smooth);
-  }
+    moo_state.units[u].Tone_Render(
+        muted, _dst_ch_num, moo_state.time_pan_index,
+        moo_state.params.smp_smooth, moo_state.params.resample,
+        moo_state.params.smp_stride, smp_run,
+        &moo_state.unit_block_smps[u * block_size]);
+  };
+  if (moo_state.thread_pool)
+    moo_state.thread_pool->For(int32_t(active_units.size()), render_unit);
+  else
+    for (size_t a = 0; a < active_units.size(); a++) render_unit(int32_t(a));
 
-  for (int32_t ch = 0; ch < _dst_ch_num; ch++) {
-    for (int32_t g = 0; g < _group_num; g++) moo_state.group_smps[g] = 0;
+  // fade..
+  int32_t fade_scales[pxtnBUFSIZE_MOOBLOCK];
+  bool b_fade_end = _moo_Fade(moo_state, smp_run, fade_scales);
+
+  if (p_stems)
+    _moo_Stems_Mix(p_stems, smp_run, fade_scales, moo_state);
+  else {
     /* Sample the units into a group buffer */
-    for (size_t u = 0; u < moo_state.units.size(); u++)
-      moo_state.units[u].Tone_Supple(moo_state.group_smps.data(), ch,
-                                     moo_state.time_pan_index);
+    int32_t* p_group_smps = moo_state.group_block_smps.data();
+    _moo_Groups_Mix(p_group_smps, moo_state, active_units.data(),
+                    active_units.size(), smp_run);
     /* Add overdrive, delay to group buffer */
-    for (size_t o = 0; o < _ovdrvs.size(); o++)
-      _ovdrvs[o].Tone_Supple(moo_state.group_smps.data());
-    for (size_t d = 0; d < _delays.size(); d++) {
-      // TODO: Be robust to if there's a new delay. Generate new delay on the
-      // fly?
-      moo_state.delays[d].Tone_Supple(_delays[d], ch,
-                                      moo_state.group_smps.data());
-    }
-
-    /* Add group samples together for final */
-    // collect.
-    int32_t work = 0;
-    for (int32_t g = 0; g < _group_num; g++) work += moo_state.group_smps[g];
-
-    /* Fading scale probably for rendering at the end */
-    // fade..
-    if (moo_state.fade_fade)
-      work = work * (moo_state.fade_count >> 8) / moo_state.fade_max;
-
-    // master volume
-    work = (int32_t)(work * moo_state.params.master_vol);
-
-    // to buffer..
-    if (work > moo_state.params.top) work = moo_state.params.top;
-    if (work < -moo_state.params.top) work = -moo_state.params.top;
-    *((int16_t*)p_data + ch) = (int16_t)(work);
+    _moo_Groups_Supple(p_group_smps, moo_state.delays, smp_run);
+    _moo_Groups_Store(p_group_smps, -1, fade_scales, moo_state, p_data,
+                      smp_run);
   }
 
+  // Units that went quiet during this run are skipped from now on.
+  active_units.erase(std::remove_if(active_units.begin(), active_units.end(),
+                                    [&](int32_t u) {
+                                      return !moo_state.units[u].is_sounding();
+                                    }),
+                     active_units.end());
+
   // --------------
   // increments..
 
-  moo_state.smp_count++;
+  moo_state.smp_count += smp_run;
   moo_state.time_pan_index =
-      (moo_state.time_pan_index + 1) & (pxtnBUFSIZE_TIMEPAN - 1);
-
-  for (size_t u = 0; u < moo_state.units.size(); u++) {
-    int32_t key_now = moo_state.units[u].Tone_Increment_Key();
-    moo_state.units[u].Tone_Increment_Sample(
-        pxtnPulse_Frequency::Get2(key_now) * moo_state.params.smp_stride);
-  }
-
-  // delay
-  for (size_t d = 0; d < moo_state.delays.size(); d++)
-    moo_state.delays[d].Tone_Increment();
+      (moo_state.time_pan_index + smp_run) & (pxtnBUFSIZE_TIMEPAN - 1);
 
-  // fade out
-  if (moo_state.fade_fade < 0) {
-    if (moo_state.fade_count > 0)
-      moo_state.fade_count--;
-    else
-      return false;
-  }
-  // fade in
-  else if (moo_state.fade_fade > 0) {
-    if (moo_state.fade_count < (moo_state.fade_max << 8))
-      moo_state.fade_count++;
-    else
-      moo_state.fade_fade = 0;
-  }
+  *p_smp_w = smp_run - 1;
+  if (b_fade_end) return false;
 
   while (moo_state.smp_count >= smp_end) {
     if (!moo_state.params.b_loop) return false;
@@ -314,9 +603,22 @@ bool pxtnService::_moo_PXTONE_SAMPLE(void* p_data, mooState& moo_state) const {
     moo_state.smp_count +=
         master->get_this_clock(master->get_repeat_meas(), 0, 0) *
         moo_state.params.clock_rate;
-    moo_state.p_eve = nullptr;
-    _moo_InitUnitTone(moo_state);
+    if (_moo_Repeat_IsReady(moo_state) &&
+        moo_state.smp_count / moo_state.params.clock_rate >=
+            moo_state.repeat_point.clock) {
+      const mooCheckpoint& rp = moo_state.repeat_point;
+      moo_state.units = rp.units;
+      moo_state.p_eve = rp.p_eve;
+      moo_state.seek_replays.clear();
+      for (const EVERECORD* p_on : rp.p_ons)
+        if (p_on) moo_state.seek_replays.push_back(p_on);
+      moo_state.active_units.clear();
+    } else {
+      moo_state.p_eve = nullptr;
+      _moo_InitUnitTone(moo_state);
+    }
   }
+  *p_smp_w = smp_run;
   return true;
 }
 
@@ -334,7 +636,8 @@ int32_t pxtnService::moo_tone_sample_multi(std::map<int, pxtnUnitTone*> p_us,
 
   for (auto& [id, p_u] : p_us) {
     if (!p_u) return 0;
-    p_u->Tone_Sample(false, _dst_ch_num, time_pan_index, moo_params.smp_smooth);
+    p_u->Tone_Sample(false, _dst_ch_num, time_pan_index, moo_params.smp_smooth,
+                     moo_params.resample, moo_params.smp_stride);
     int32_t key_now = p_u->Tone_Increment_Key();
     p_u->Tone_Increment_Sample(pxtnPulse_Frequency::Get2(key_now) *
                                moo_params.smp_stride);
@@ -383,13 +686,201 @@ bool pxtnService::moo_set_fade(int32_t fade, float sec,
   return true;
 }
 
+////////////////////////////
+// checkpoints
+////////////////////////////
+
+// Whether the note [e] is over by [clock], in which case processEvent just
+// silences the unit, no matter how much later than [clock] it's called.
+static bool _is_on_over(const EVERECORD* e, int32_t clock, float clock_rate) {
+  return (int32_t)((e->clock + e->value - clock) * clock_rate) <= 0;
+}
+
+// Makes checkpoints at each of [clocks] (ascending), starting from [p_from],
+// or from the start of the song if null. Notes are played as if already over,
+// so the unit states don't depend on where a seek lands. A unit with a note
+// that isn't over at a checkpoint is saved from before that note instead (see
+// mooCheckpoint).
+std::vector<mooCheckpoint> pxtnService::_moo_Checkpoints_Make(
+    const mooCheckpoint* p_from, const std::vector<int32_t>& clocks,
+    const mooParams& params, size_t unit_num) const {
+  std::vector<mooCheckpoint> made;
+  std::vector<pxtnUnitTone> units;
+  const EVERECORD* p_eve = nullptr;
+  // Per unit, the notes not over at the next checkpoint, and the state from
+  // before each.
+  std::vector<std::vector<std::pair<const EVERECORD*, pxtnUnitTone>>> ons(
+      unit_num);
+
+  auto process = [&](const EVERECORD* e, int32_t checkpoint_clock) {
+    pxtnUnitTone* p_u = &units[e->unit_no];
+    if (e->kind == EVENTKIND_ON &&
+        !_is_on_over(e, checkpoint_clock, params.clock_rate))
+      ons[e->unit_no].emplace_back(e, *p_u);
+    params.processEvent(p_u, e, e->clock + e->value, -1, this);
+  };
+
+  if (!p_from) {
+    for (size_t u = 0; u < unit_num; u++) {
+      units.emplace_back(Woice_Get(EVENTDEFAULT_VOICENO));
+      params.resetVoiceOn(&units.back());
+    }
+  } else {
+    units = p_from->units;
+    p_eve = p_from->p_eve;
+    for (size_t u = 0; u < unit_num; u++) {
+      if (!p_from->p_ons[u]) continue;
+      for (const EVERECORD* e = p_from->p_ons[u];; e = e->next) {
+        if (e->unit_no == u) process(e, p_from->clock);
+        if (e == p_eve) break;
+      }
+    }
+  }
+
+  for (int32_t clock : clocks) {
+    for (auto& u_ons : ons)
+      u_ons.erase(std::remove_if(u_ons.begin(), u_ons.end(),
+                                 [&](const auto& on) {
+                                   return _is_on_over(on.first, clock,
+                                                      params.clock_rate);
+                                 }),
+                  u_ons.end());
+
+    const EVERECORD* e = (p_eve ? p_eve->next : evels->get_Records());
+    for (; e && e->clock < clock; e = e->next) {
+      p_eve = e;
+      if (e->unit_no < unit_num) process(e, clock);
+    }
+
+    mooCheckpoint cp;
+    cp.clock = clock;
+    cp.p_eve = p_eve;
+    cp.p_ons.assign(unit_num, nullptr);
+    cp.units = units;
+    for (size_t u = 0; u < unit_num; u++) {
+      if (ons[u].empty()) continue;
+      cp.p_ons[u] = ons[u][0].first;
+      cp.units[u] = ons[u][0].second;
+    }
+    made.push_back(std::move(cp));
+  }
+  return made;
+}
+
+// Makes checkpoints up to the [checkpoint_num]th.
+void pxtnService::_moo_Checkpoints_Extend(mooCheckpoints& cps,
+                                          const mooParams& params,
+                                          size_t checkpoint_num) const {
+  if (cps.checkpoints.size() >= checkpoint_num) return;
+
+  std::vector<int32_t> clocks;
+  for (size_t n = cps.checkpoints.size() + 1; n <= checkpoint_num; n++)
+    clocks.push_back(int32_t(n) * cps.meas_clock);
+  const mooCheckpoint* p_from =
+      (cps.checkpoints.empty() ? nullptr : &cps.checkpoints.back());
+  for (mooCheckpoint& cp :
+       _moo_Checkpoints_Make(p_from, clocks, params, cps.unit_num))
+    cps.checkpoints.push_back(std::move(cp));
+}
+
+// Clears [cps] if it was made for different settings than [moo_state]'s, and
+// drops the checkpoints that edits since the last call have made out of date.
+// Returns false if there can't be any checkpoints.
+bool pxtnService::_moo_Checkpoints_Check(mooCheckpoints& cps,
+                                         const mooState& moo_state) const {
+  const mooParams& params = moo_state.params;
+  int32_t meas_clock =
+      cps.meas_interval * master->get_beat_num() * master->get_beat_clock();
+  if (!cps.edits || cps.clock_rate != params.clock_rate ||
+      cps.bt_tempo != params.bt_tempo || cps.meas_clock != meas_clock ||
+      cps.dst_ch_num != _dst_ch_num || cps.dst_sps != _dst_sps ||
+      cps.unit_num != moo_state.units.size()) {
+    cps.clear();
+    cps.edits = evels->Watch_Edits();
+    cps.clock_rate = params.clock_rate;
+    cps.bt_tempo = params.bt_tempo;
+    cps.meas_clock = meas_clock;
+    cps.dst_ch_num = _dst_ch_num;
+    cps.dst_sps = _dst_sps;
+    cps.unit_num = moo_state.units.size();
+  }
+  if (meas_clock <= 0) return false;
+
+  // Checkpoints after an edit are out of date.
+  int32_t edit_clock = cps.edits->exchange(INT32_MAX);
+  while (!cps.checkpoints.empty() && cps.checkpoints.back().clock > edit_clock)
+    cps.checkpoints.pop_back();
+  return true;
+}
+
+// Moves [moo_state] (just reset, at its start sample) to the nearest
+// checkpoint before it, making checkpoints on the way if needed.
+void pxtnService::_moo_Checkpoints_Seek(mooCheckpoints& cps,
+                                        mooState& moo_state) const {
+  if (!_moo_Checkpoints_Check(cps, moo_state)) return;
+
+  int32_t clock = (int32_t)(moo_state.smp_count / moo_state.params.clock_rate);
+  int32_t end_clock = master->get_this_clock(master->get_play_meas(), 0, 0);
+  size_t n = std::max(0, std::min(clock, end_clock) / cps.meas_clock);
+  if (n == 0) return;
+
+  _moo_Checkpoints_Extend(cps, moo_state.params, n);
+  const mooCheckpoint& cp = cps.checkpoints[n - 1];
+  moo_state.units = cp.units;
+  moo_state.p_eve = cp.p_eve;
+  for (const EVERECORD* p_on : cp.p_ons)
+    if (p_on) moo_state.seek_replays.push_back(p_on);
+}
+
+// The clock that looping back lands on. Because of rounding, this can be just
+// before the repeat measure.
+int32_t pxtnService::_moo_Repeat_Clock(const mooParams& params) const {
+  int32_t smp = master->get_this_clock(master->get_repeat_meas(), 0, 0) *
+                params.clock_rate;
+  return (int32_t)(smp / params.clock_rate);
+}
+
+// Whether [moo_state]'s repeat point is still right. Events at or after it
+// don't affect it.
+bool pxtnService::_moo_Repeat_IsReady(const mooState& moo_state) const {
+  const mooCheckpoint& rp = moo_state.repeat_point;
+  return moo_state.repeat_edits &&
+         moo_state.repeat_edits->load() >= rp.clock &&
+         moo_state.repeat_clock_rate == moo_state.params.clock_rate &&
+         rp.units.size() == size_t(_unit_num) &&
+         rp.units.size() == moo_state.units.size() &&
+         rp.clock == _moo_Repeat_Clock(moo_state.params);
+}
+
+void pxtnService::moo_prepare_repeat(mooState& moo_state,
+                                     mooCheckpoints* p_checkpoints) const {
+  if (!moo_state.params.b_loop || moo_state.end_vomit) return;
+  if (_moo_Repeat_IsReady(moo_state)) return;
+
+  int32_t clock = _moo_Repeat_Clock(moo_state.params);
+  const mooCheckpoint* p_from = nullptr;
+  if (p_checkpoints && _moo_Checkpoints_Check(*p_checkpoints, moo_state)) {
+    size_t n = std::max(0, clock / p_checkpoints->meas_clock);
+    if (n > 0) {
+      _moo_Checkpoints_Extend(*p_checkpoints, moo_state.params, n);
+      p_from = &p_checkpoints->checkpoints[n - 1];
+    }
+  }
+
+  moo_state.repeat_edits = evels->Watch_Edits();
+  moo_state.repeat_clock_rate = moo_state.params.clock_rate;
+  moo_state.repeat_point = std::move(_moo_Checkpoints_Make(
+      p_from, {clock}, moo_state.params, moo_state.units.size())[0]);
+}
+
 ////////////////////////////
 // preparation
 ////////////////////////////
 
 // preparation
 bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
-                                  mooState& moo_state) const {
+                                  mooState& moo_state,
+                                  mooCheckpoints* p_checkpoints) const {
   if (!_moo_b_valid_data || !_dst_ch_num || !_dst_sps || !_dst_byte_per_smp) {
     moo_state.end_vomit = true;
     return false;
@@ -399,6 +890,7 @@ bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
   int32_t start_meas = 0;
   int32_t start_sample = 0;
   float start_float = 0;
+  int32_t start_output = 0;
 
   float fadein_sec = 0;
 
@@ -406,6 +898,7 @@ bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
     start_meas = p_prep->start_pos_meas;
     start_sample = p_prep->start_pos_sample;
     start_float = p_prep->start_pos_float;
+    start_output = p_prep->start_pos_output;
 
     // TODO: Maybe put them to use?
     // if (p_prep->meas_end) meas_end = p_prep->meas_end;
@@ -420,9 +913,20 @@ bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
       moo_state.params.b_loop = true;
     else
       moo_state.params.b_loop = false;
+    moo_state.params.b_realtime = p_prep->flags & pxtnVOMITPREPFLAG_realtime;
 
     moo_state.params.master_vol = p_prep->master_volume;
     moo_state.params.solo_unit = p_prep->solo_unit;
+    moo_state.params.stems = p_prep->stems;
+    moo_state.params.format = p_prep->format;
+    moo_state.params.resample = p_prep->resample;
+
+    if (p_prep->thread_num <= 1)
+      moo_state.thread_pool.reset();
+    else if (!moo_state.thread_pool ||
+             moo_state.thread_pool->get_thread_num() != p_prep->thread_num)
+      moo_state.thread_pool =
+          std::make_unique<pxtnThreadPool>(p_prep->thread_num);
   }
 
   /* _dst_sps is like samples to seconds. it's set in pxtnService.cpp
@@ -440,7 +944,23 @@ bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
   moo_state.resetGroups(_group_num);
 
   int32_t smp_start;
-  if (start_float)
+  int32_t num_loop = 0;
+  if (start_output > 0) {
+    // Wrap around to the repeat measure the way playing there would.
+    int32_t smp_end = ((double)master->get_play_meas() *
+                       master->get_beat_num() * master->get_beat_clock() *
+                       moo_state.params.clock_rate);
+    smp_start = start_output;
+    while (moo_state.params.b_loop && smp_start >= smp_end) {
+      int32_t last = smp_start;
+      smp_start -= smp_end;
+      smp_start += master->get_this_clock(master->get_repeat_meas(), 0, 0) *
+                   moo_state.params.clock_rate;
+      ++num_loop;
+      if (smp_start >= last) break;
+    }
+    moo_state.time_pan_index = start_output & (pxtnBUFSIZE_TIMEPAN - 1);
+  } else if (start_float)
     smp_start = (int32_t)((float)moo_get_total_sample() * start_float);
   else if (start_sample)
     smp_start = start_sample;
@@ -457,14 +977,18 @@ bool pxtnService::moo_preparation(const pxtnVOMITPREPARATION* p_prep,
     moo_set_fade(0, 0, moo_state);
 
   moo_state.tones_clear();
+  moo_state.stem_delays.clear();
 
   moo_state.p_eve = nullptr;
-  moo_state.num_loop = 0;
+  moo_state.seek_replays.clear();
+  moo_state.num_loop = num_loop;
 
   _moo_InitUnitTone(moo_state);
+  if (p_checkpoints) _moo_Checkpoints_Seek(*p_checkpoints, moo_state);
 
   b_ret = true;
   moo_state.end_vomit = false;
+  moo_prepare_repeat(moo_state, p_checkpoints);
 
   return b_ret;
 }
@@ -503,29 +1027,38 @@ bool pxtnService::Moo(
   // if( size % _dst_byte_per_smp ) return false;
 
   /* Size/smp_num probably is used to sync the playback with the position */
-  int32_t smp_num = size / _dst_byte_per_smp;
+  int32_t byte_per_smp = get_byte_per_smp(moo_state.params.format);
+  int32_t smp_num = size / byte_per_smp;
 
   {
     /* Buffer is renamed here */
-    int16_t* p16 = (int16_t*)p_buf;
-    int16_t sample[2]; /* for left and right? */
-
-    /* Iterate thru samples [smp_num] times, fill buffer with this sample */
-    for (smp_w = 0; smp_w < smp_num; smp_w++) {
-      if (!_moo_PXTONE_SAMPLE(sample, moo_state)) {
+    char* p = (char*)p_buf;
+
+    /* Fill the buffer a block at a time */
+    while (smp_w < smp_num) {
+      int32_t smp_block = 0;
+      bool b_continue =
+          _moo_PXTONE_BLOCK(p, smp_num - smp_w, moo_state, &smp_block);
+      if (volume_meters) {
+        int32_t n = smp_block * _dst_ch_num;
+        if (moo_state.params.format == pxtnSAMPLEFORMAT_float32)
+          for (int32_t i = 0; i < n; i++)
+            (*volume_meters)[i % _dst_ch_num].insert(
+                int64_t(((float*)p)[i] * 32768.0f));
+        else
+          for (int32_t i = 0; i < n; i++)
+            (*volume_meters)[i % _dst_ch_num].insert(((int16_t*)p)[i]);
+      }
+      p += smp_block * byte_per_smp;
+      smp_w += smp_block;
+      if (!b_continue) {
         moo_state.end_vomit = true;
         break;
       }
-      for (int ch = 0; ch < _dst_ch_num; ch++, p16++) {
-        if (volume_meters) (*volume_meters)[ch].insert(sample[ch]);
-        *p16 = sample[ch];
-      }
-    }
-    for (; smp_w < smp_num; smp_w++) {
-      for (int ch = 0; ch < _dst_ch_num; ch++, p16++) *p16 = 0;
     }
+    std::fill(p, p + (smp_num - smp_w) * byte_per_smp, 0);
 
-    if (filled_size) *filled_size = smp_num * _dst_byte_per_smp;
+    if (filled_size) *filled_size = smp_num * byte_per_smp;
   }
 
   if (_sampled_proc) {
@@ -540,6 +1073,50 @@ term:
   return b_ret;
 }
 
+bool pxtnService::Moo_Stems(mooState& moo_state, void* const* p_bufs,
+                            int32_t size) const {
+  if (!_moo_b_valid_data) return false;
+  if (moo_state.end_vomit) return false;
+  if (moo_state.params.stems == pxtnSTEM_none) return false;
+
+  int32_t stem_num = moo_get_stem_num(moo_state);
+  int32_t byte_per_smp = get_byte_per_smp(moo_state.params.format);
+  int32_t smp_num = size / byte_per_smp;
+  std::vector<void*> ps(p_bufs, p_bufs + stem_num);
+
+  int32_t smp_w = 0;
+  while (smp_w < smp_num) {
+    int32_t smp_block = 0;
+    bool b_continue = _moo_PXTONE_BLOCK(nullptr, smp_num - smp_w, moo_state,
+                                        &smp_block, ps.data());
+    for (void*& p : ps) p = (char*)p + smp_block * byte_per_smp;
+    smp_w += smp_block;
+    if (!b_continue) {
+      moo_state.end_vomit = true;
+      break;
+    }
+  }
+  for (void* p : ps)
+    std::fill_n((char*)p, (smp_num - smp_w) * byte_per_smp, 0);
+
+  if (_sampled_proc && !_sampled_proc(_sampled_user, this)) {
+    moo_state.end_vomit = true;
+    return false;
+  }
+  return true;
+}
+
+int32_t pxtnService::moo_get_stem_num(const mooState& moo_state) const {
+  switch (moo_state.params.stems) {
+    case pxtnSTEM_unit:
+      return int32_t(moo_state.units.size());
+    case pxtnSTEM_group:
+      return _group_num;
+    default:
+      return 0;
+  }
+}
+
 int32_t pxtnService_moo_CalcSampleNum(int32_t meas_num, int32_t beat_num,
                                       int32_t sps, float beat_tempo) {
   uint32_t total_beat_num;
@@ -0,0 +1,125 @@
+
+#include "./pxtnThreadPool.h"
+
+// How long an idle thread polls for the next job before going to sleep. Jobs
+// typically come in quick succession (one per rendered block).
+#define _SPIN_NUM 2000
+
+static uint64_t _pack(uint32_t begin, uint32_t end) {
+  return uint64_t(begin) | (uint64_t(end) << 32);
+}
+static uint32_t _begin(uint64_t range) { return uint32_t(range); }
+static uint32_t _end(uint64_t range) { return uint32_t(range >> 32); }
+
+pxtnThreadPool::pxtnThreadPool(int32_t thread_num)
+    : _thread_num(thread_num < 1 ? 1 : thread_num),
+      _generation(0),
+      _generation_a(0),
+      _b_quit(false),
+      _p_func(nullptr),
+      _ranges(new std::atomic<uint64_t>[_thread_num]),
+      _done_num(0),
+      _active_num(0) {
+  for (int32_t i = 0; i < _thread_num; i++) _ranges[i].store(0);
+  for (int32_t i = 1; i < _thread_num; i++)
+    _threads.emplace_back(&pxtnThreadPool::_thread_main, this, i);
+}
+
+pxtnThreadPool::~pxtnThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _b_quit = true;
+  }
+  _cv.notify_all();
+  for (std::thread &t : _threads) t.join();
+}
+
+int32_t pxtnThreadPool::get_thread_num() const { return _thread_num; }
+
+// Takes the next item from the front of our own slice.
+int32_t pxtnThreadPool::_pop(int32_t participant) {
+  std::atomic<uint64_t> &range = _ranges[participant];
+  uint64_t r = range.load(std::memory_order_acquire);
+  while (_begin(r) < _end(r)) {
+    if (range.compare_exchange_weak(r, _pack(_begin(r) + 1, _end(r)),
+                                    std::memory_order_acq_rel))
+      return int32_t(_begin(r));
+  }
+  return -1;
+}
+
+// Takes the back half of somebody else's slice. The first stolen item is
+// returned, the rest becomes our slice.
+int32_t pxtnThreadPool::_steal(int32_t participant) {
+  for (int32_t k = 1; k < _thread_num; k++) {
+    std::atomic<uint64_t> &range = _ranges[(participant + k) % _thread_num];
+    uint64_t r = range.load(std::memory_order_acquire);
+    while (_begin(r) < _end(r)) {
+      uint32_t mid = _end(r) - (_end(r) - _begin(r) + 1) / 2;
+      if (range.compare_exchange_weak(r, _pack(_begin(r), mid),
+                                      std::memory_order_acq_rel)) {
+        _ranges[participant].store(_pack(mid + 1, _end(r)),
+                                   std::memory_order_release);
+        return int32_t(mid);
+      }
+    }
+  }
+  return -1;
+}
+
+void pxtnThreadPool::_work(int32_t participant) {
+  while (true) {
+    int32_t i = _pop(participant);
+    if (i < 0) i = _steal(participant);
+    if (i < 0) return;
+    (*_p_func)(i);
+    _done_num.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void pxtnThreadPool::_thread_main(int32_t participant) {
+  uint64_t seen = 0;
+  while (true) {
+    for (int32_t i = 0; i < _SPIN_NUM; i++) {
+      if (_generation_a.load(std::memory_order_acquire) != seen) break;
+      std::this_thread::yield();
+    }
+    {
+      std::unique_lock<std::mutex> lock(_mtx);
+      _cv.wait(lock, [&] { return _b_quit || _generation != seen; });
+      if (_b_quit) return;
+      seen = _generation;
+      _active_num.fetch_add(1, std::memory_order_acq_rel);
+    }
+    _work(participant);
+    _active_num.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+void pxtnThreadPool::For(int32_t num,
+                         const std::function<void(int32_t)> &func) {
+  if (_thread_num <= 1 || num <= 1) {
+    for (int32_t i = 0; i < num; i++) func(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _p_func = &func;
+    _done_num.store(0, std::memory_order_relaxed);
+    for (int32_t p = 0; p < _thread_num; p++)
+      _ranges[p].store(_pack(uint32_t(int64_t(num) * p / _thread_num),
+                             uint32_t(int64_t(num) * (p + 1) / _thread_num)),
+                       std::memory_order_release);
+    _generation_a.store(++_generation, std::memory_order_release);
+  }
+  _cv.notify_all();
+
+  _work(0);
+  // Wait for the items other threads are still on, and for every thread to be
+  // out of this job before the next one reuses [_p_func] / [_ranges].
+  while (_done_num.load(std::memory_order_acquire) < num)
+    std::this_thread::yield();
+  while (_active_num.load(std::memory_order_acquire) > 0)
+    std::this_thread::yield();
+}
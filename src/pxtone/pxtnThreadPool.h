@@ -0,0 +1,56 @@
+#ifndef pxtnThreadPool_H
+#define pxtnThreadPool_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./pxtn.h"
+
+// A small work-stealing pool for splitting a loop over independent items
+// (e.g. units) across threads. Each participant starts with a contiguous slice
+// of the items and steals half of somebody else's remaining slice once its own
+// runs out. The calling thread takes part too, so a pool of [thread_num]
+// threads only starts [thread_num] - 1 of its own.
+class pxtnThreadPool {
+ private:
+  void operator=(const pxtnThreadPool &src) = delete;
+  pxtnThreadPool(const pxtnThreadPool &src) = delete;
+
+  int32_t _thread_num;
+  std::vector<std::thread> _threads;
+
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  uint64_t _generation;
+  std::atomic<uint64_t> _generation_a;
+  bool _b_quit;
+
+  const std::function<void(int32_t)> *_p_func;
+  // [begin, end) of the items left for each participant, packed as
+  // begin | (end << 32).
+  std::unique_ptr<std::atomic<uint64_t>[]> _ranges;
+  std::atomic<int32_t> _done_num;
+  std::atomic<int32_t> _active_num;
+
+  int32_t _pop(int32_t participant);
+  int32_t _steal(int32_t participant);
+  void _work(int32_t participant);
+  void _thread_main(int32_t participant);
+
+ public:
+  pxtnThreadPool(int32_t thread_num);
+  ~pxtnThreadPool();
+
+  int32_t get_thread_num() const;
+
+  // Calls func(i) for every i in [0, num) and returns once all are done.
+  // Calls may run in any order and on any thread.
+  void For(int32_t num, const std::function<void(int32_t)> &func);
+};
+
+#endif
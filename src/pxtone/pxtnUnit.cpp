@@ -2,8 +2,12 @@
 
 #include "./pxtnUnit.h"
 
+#include <algorithm>
+
 #include "./pxtn.h"
 #include "./pxtnEvelist.h"
+#include "./pxtnMix.h"
+#include "./pxtnResample.h"
 
 pxtnUnit::pxtnUnit() {
   _bPlayed = true;
@@ -22,6 +26,7 @@ pxtnUnitTone::pxtnUnitTone(std::shared_ptr<const pxtnWoice> p_woice) {
   _v_TUNING = EVENTDEFAULT_TUNING;
   _portament_sample_num = 0;
   _portament_sample_pos = 0;
+  _b_reset_unready = false;
   Tone_Clear();
 
   for (int32_t i = 0; i < pxtnMAX_CHANNEL; i++) {
@@ -35,6 +40,7 @@ pxtnUnitTone::pxtnUnitTone(std::shared_ptr<const pxtnWoice> p_woice) {
 void pxtnUnitTone::Tone_Clear() {
   memset(_pan_time_bufs, 0,
          sizeof(int) * pxtnBUFSIZE_TIMEPAN * pxtnMAX_CHANNEL);
+  _silent_smp_num = pxtnBUFSIZE_TIMEPAN;
 }
 
 void pxtnUnitTone::Tone_Reset_and_2prm(int32_t voice_idx, int32_t env_rls_clock,
@@ -76,11 +82,18 @@ void pxtnUnitTone::Tone_Reset_Custom(float tempo, float clock_rate,
 
 void pxtnUnitTone::Tone_Reset(float tempo, float clock_rate) {
   Tone_Reset_Custom(tempo, clock_rate, _vts);
+  _b_reset_unready = _p_woice && !_p_woice->is_tone_ready();
 }
 
+bool pxtnUnitTone::was_reset_unready() const { return _b_reset_unready; }
+
 bool pxtnUnitTone::set_woice(std::shared_ptr<const pxtnWoice> p_woice,
                              bool resetKey) {
   if (!p_woice) return false;
+  // A stream left open on the old woice could outlive what it's reading.
+  if (p_woice != _p_woice)
+    for (int32_t v = 0; v < pxtnMAX_UNITCONTROLVOICE; v++)
+      _vts[v].stream.Close();
   _p_woice = p_woice;
   if (resetKey) {
     _key_now = EVENTDEFAULT_KEY;
@@ -121,6 +134,15 @@ void pxtnUnitTone::Tone_ZeroLives() {
   for (int32_t i = 0; i < pxtnMAX_CHANNEL; i++) _vts[i].life_count = 0;
 }
 
+void pxtnUnitTone::Tone_Open_Streams(bool b_prefetch) {
+  if (!_p_woice) return;
+  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++)
+    if (_vts[v].life_count > 0)
+      pxtnResample::Open(_p_woice->get_instance(v), &_vts[v].stream,
+                         _vts[v].smp_pos,
+                         b_prefetch ? _p_woice : nullptr);
+}
+
 void pxtnUnitTone::Tone_KeyOn() {
   _key_now = _key_start + _key_margin;
   _key_start = _key_now;
@@ -200,7 +222,10 @@ void pxtnUnitTone::Tone_Envelope() { Tone_Envelope_Custom(_vts); }
 /* added [Tone_sample_custom] because [Tone_sample] by default modifies the
  * pxtnVOICETONE associated with the actual unit during playback. */
 void pxtnUnitTone::Tone_Sample_Custom(int32_t ch_num, int32_t smooth_smp,
+                                      pxtnRESAMPLE resample, float smp_stride,
                                       pxtnVOICETONE *vts, int32_t *bufs) const {
+  // How far the voices move per sample, before their own offsets.
+  float freq = pxtnPulse_Frequency::Get2(_key_now) * smp_stride * _v_TUNING;
   for (int32_t ch = 0; ch < pxtnMAX_CHANNEL; ch++) {
     int32_t time_pan_buf = 0;
 
@@ -214,18 +239,14 @@ void pxtnUnitTone::Tone_Sample_Custom(int32_t ch_num, int32_t smooth_smp,
       int32_t work = 0;
 
       if (p_vt->life_count > 0) {
-        /* this smp_pos buffer alternates between left and right amps */
-        /* Bytes: LLRRLLRR, increasing in time, I think. */
-        int32_t pos = (int32_t)p_vt->smp_pos * 4 + ch * 2;
-        work += *((short *)&p_vi->p_smp_w[pos]); /* syntax just means read the
-                                                    thing at pos as short */
-
         /* if we're outputing to mono, get both L and R and avg */
-        /* since this block will only be called to fill one buffer I think? */
-        if (ch_num == 1) {
-          work += *((short *)&p_vi->p_smp_w[pos + 2]);
-          work = work / 2;
-        }
+        int32_t smps[pxtnMAX_CHANNEL];
+        bool b_loop =
+            _p_woice->get_voice(v)->voice_flags & PTV_VOICEFLAG_WAVELOOP;
+        pxtnResample::Read(p_vi, &p_vt->stream, p_vt->smp_pos,
+                           p_vt->offset_freq * freq, b_loop, resample, ch_num,
+                           smps);
+        work += smps[ch_num == 1 ? 0 : ch];
 
         /* scaling filters */
         work = (work * _v_VELOCITY) / 128;
@@ -248,7 +269,8 @@ void pxtnUnitTone::Tone_Sample_Custom(int32_t ch_num, int32_t smooth_smp,
 }
 
 void pxtnUnitTone::Tone_Sample(bool b_mute, int32_t ch_num,
-                               int32_t time_pan_index, int32_t smooth_smp) {
+                               int32_t time_pan_index, int32_t smooth_smp,
+                               pxtnRESAMPLE resample, float smp_stride) {
   if (!_p_woice) return;
 
   if (b_mute) {
@@ -257,7 +279,9 @@ void pxtnUnitTone::Tone_Sample(bool b_mute, int32_t ch_num,
     return;
   }
 
-  Tone_Sample_Custom(ch_num, smooth_smp, _vts, _pan_time_bufs[time_pan_index]);
+  _silent_smp_num = 0;
+  Tone_Sample_Custom(ch_num, smooth_smp, resample, smp_stride, _vts,
+                     _pan_time_bufs[time_pan_index]);
 }
 
 int32_t pxtnUnitTone::Tone_Supple_get(int32_t ch,
@@ -265,11 +289,6 @@ int32_t pxtnUnitTone::Tone_Supple_get(int32_t ch,
   int32_t idx = (time_pan_index - _pan_times[ch]) & (pxtnBUFSIZE_TIMEPAN - 1);
   return _pan_time_bufs[idx][ch];
 }
-/* This dumps the time pan buffers into the group buffers */
-void pxtnUnitTone::Tone_Supple(int32_t *group_smps, int32_t ch,
-                               int32_t time_pan_index) const {
-  group_smps[_v_GROUPNO] += Tone_Supple_get(ch, time_pan_index);
-}
 
 int pxtnUnitTone::Tone_Increment_Key() {
   // prtament..
@@ -314,6 +333,9 @@ void pxtnUnitTone::Tone_Increment_Sample_Custom(float freq,
           if (p_vt->smp_pos >= p_vi->smp_body_w)
             p_vt->smp_pos -= p_vi->smp_body_w;
           if (p_vt->smp_pos >= p_vi->smp_body_w) p_vt->smp_pos = 0;
+          // So that the stream is ready by the time the resident start's
+          // been played again.
+          pxtnResample::Seek(p_vi, &p_vt->stream, p_vt->smp_pos);
         } else {
           p_vt->life_count = 0;
         }
@@ -332,10 +354,182 @@ void pxtnUnitTone::Tone_Increment_Sample(float freq) {
   Tone_Increment_Sample_Custom(freq, _vts);
 }
 
+/* Renders [smp_num] (up to pxtnBUFSIZE_MOOBLOCK) consecutive samples of this
+ * unit after time pan into [bufs], one channel every pxtnBUFSIZE_MOOBLOCK. This
+ * is Tone_Sample / Tone_Supple_get / Tone_Increment_* for a run of samples, so
+ * that a unit can be rendered a run at a time between events. The envelope of
+ * the first sample is expected to have been applied already, since that has to
+ * happen before the events at that sample. */
+void pxtnUnitTone::Tone_Render(bool b_mute, int32_t ch_num,
+                               int32_t time_pan_index, int32_t smooth_smp,
+                               pxtnRESAMPLE resample, float smp_stride,
+                               int32_t smp_num, int32_t *bufs) {
+  int32_t voice_num = _p_woice->get_voice_num();
+  int32_t raws[pxtnMAX_UNITCONTROLVOICE][pxtnMAX_CHANNEL][pxtnBUFSIZE_MOOBLOCK];
+  int32_t envs[pxtnMAX_UNITCONTROLVOICE][pxtnBUFSIZE_MOOBLOCK];
+  int32_t lives[pxtnMAX_UNITCONTROLVOICE][pxtnBUFSIZE_MOOBLOCK];
+  bool b_lives[pxtnMAX_UNITCONTROLVOICE] = {};
+  bool b_loops[pxtnMAX_UNITCONTROLVOICE];
+  for (int32_t v = 0; v < voice_num; v++)
+    b_loops[v] = _p_woice->get_voice(v)->voice_flags & PTV_VOICEFLAG_WAVELOOP;
+  int32_t last_live = -1;
+
+  // Step through the voices sample by sample, keeping the raw sample values
+  // and envelope so that the gains can be applied to the whole run at once.
+  for (int32_t i = 0; i < smp_num; i++) {
+    if (i) Tone_Envelope();
+    if (!b_mute) {
+      float freq = pxtnPulse_Frequency::Get2(_key_now) * smp_stride * _v_TUNING;
+      for (int32_t v = 0; v < voice_num; v++) {
+        pxtnVOICETONE *p_vt = &_vts[v];
+        if (p_vt->life_count > 0) {
+          const pxtnVOICEINSTANCE *p_vi = _p_woice->get_instance(v);
+          int32_t smps[pxtnMAX_CHANNEL];
+          pxtnResample::Read(p_vi, &p_vt->stream, p_vt->smp_pos,
+                             p_vt->offset_freq * freq, b_loops[v], resample,
+                             ch_num, smps);
+          for (int32_t ch = 0; ch < ch_num; ch++) raws[v][ch][i] = smps[ch];
+          envs[v][i] = p_vt->env_volume;
+          lives[v][i] = p_vt->life_count;
+          b_lives[v] = true;
+          last_live = i;
+        } else {
+          for (int32_t ch = 0; ch < ch_num; ch++) raws[v][ch][i] = 0;
+          envs[v][i] = 0;
+          lives[v][i] = 0;
+        }
+      }
+    }
+    int32_t key_now = Tone_Increment_Key();
+    Tone_Increment_Sample(pxtnPulse_Frequency::Get2(key_now) * smp_stride);
+  }
+  if (last_live >= 0)
+    _silent_smp_num = smp_num - 1 - last_live;
+  else
+    _silent_smp_num = std::min(_silent_smp_num + smp_num, pxtnBUFSIZE_TIMEPAN);
+
+  for (int32_t ch = 0; ch < ch_num; ch++) {
+    int32_t smps[pxtnBUFSIZE_MOOBLOCK];
+    memset(smps, 0, sizeof(int32_t) * smp_num);
+
+    for (int32_t v = 0; v < voice_num; v++) {
+      if (!b_lives[v]) continue;
+      const pxtnVOICEINSTANCE *p_vi = _p_woice->get_instance(v);
+      int32_t *p_raw = raws[v][ch];
+
+      /* scaling filters */
+      pxtnMix::Gain(p_raw, smp_num, _v_VELOCITY, _v_VOLUME, _pan_vols[ch]);
+      if (p_vi->env_size) pxtnMix::Envelope(p_raw, envs[v], smp_num);
+
+      // smooth tail
+      if (_p_woice->get_voice(v)->voice_flags & PTV_VOICEFLAG_SMOOTH) {
+        for (int32_t i = 0; i < smp_num; i++)
+          if (lives[v][i] < smooth_smp)
+            p_raw[i] = p_raw[i] * lives[v][i] / smooth_smp;
+      }
+      pxtnMix::Add(smps, p_raw, smp_num);
+    }
+
+    // time pan. The first [pan_time] samples come from previous runs.
+    int32_t pan_time = _pan_times[ch] & (pxtnBUFSIZE_TIMEPAN - 1);
+    int32_t *p_buf = &bufs[ch * pxtnBUFSIZE_MOOBLOCK];
+    int32_t i = 0;
+    for (; i < smp_num && i < pan_time; i++)
+      p_buf[i] = _pan_time_bufs[(time_pan_index + i - pan_time) &
+                                (pxtnBUFSIZE_TIMEPAN - 1)][ch];
+    memcpy(&p_buf[i], smps, sizeof(int32_t) * (smp_num - i));
+
+    i = (smp_num > pxtnBUFSIZE_TIMEPAN ? smp_num - pxtnBUFSIZE_TIMEPAN : 0);
+    for (; i < smp_num; i++)
+      _pan_time_bufs[(time_pan_index + i) & (pxtnBUFSIZE_TIMEPAN - 1)][ch] =
+          smps[i];
+  }
+}
+
+/* Moves a unit that isn't sounding (see [is_sounding]) along by [smp_num]
+ * samples. Rendering it would only give zeros and the voices don't change
+ * without a life count, so all that's left is the portamento of
+ * Tone_Increment_Key, which can be done in one step. */
+void pxtnUnitTone::Tone_Skip(int32_t smp_num) {
+  if (smp_num <= 0) return;
+  if (_portament_sample_num && _key_margin) {
+    int32_t left = _portament_sample_num - 1 - _portament_sample_pos;
+    if (smp_num <= left) {
+      _portament_sample_pos += smp_num;
+      _key_now =
+          (int32_t)(_key_start + (double)_key_margin * _portament_sample_pos /
+                                     _portament_sample_num);
+      return;
+    }
+    if (left > 0) _portament_sample_pos += left;
+    _key_start += _key_margin;
+    _key_margin = 0;
+  }
+  _key_now = _key_start + _key_margin;
+}
+
 std::shared_ptr<const pxtnWoice> pxtnUnitTone::get_woice() const {
   return _p_woice;
 }
 
+int32_t pxtnUnitTone::get_group_no() const { return _v_GROUPNO; }
+
+// Whether a voice is playing or the time pan buffer still has some of one.
+bool pxtnUnitTone::is_sounding() const {
+  if (_silent_smp_num < pxtnBUFSIZE_TIMEPAN) return true;
+  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++)
+    if (_vts[v].life_count > 0) return true;
+  return false;
+}
+
+// Whether this unit will sound the same as [other] from here on, if its next
+// key or portamento event is a portamento or not as [b_portament_next]. The
+// parts of the state that a note on resets are only compared for voices that
+// are playing, and the time pan buffer only if it isn't all zeros.
+bool pxtnUnitTone::sounds_like(const pxtnUnitTone &other,
+                               bool b_portament_next) const {
+  if (_p_woice != other._p_woice) return false;
+  if (_key_now != other._key_now ||
+      _key_start + _key_margin != other._key_start + other._key_margin ||
+      _portament_sample_num != other._portament_sample_num)
+    return false;
+  // Without a portamento, the key start and margin only matter through the key
+  // they add up to, until a key event sets them from there. Tone_Key also
+  // resets the portamento position when it sets a margin.
+  if (_portament_sample_num || b_portament_next) {
+    if (_key_start != other._key_start || _key_margin != other._key_margin ||
+        (_key_margin && _portament_sample_pos != other._portament_sample_pos))
+      return false;
+  }
+  if (_v_VOLUME != other._v_VOLUME || _v_VELOCITY != other._v_VELOCITY ||
+      _v_GROUPNO != other._v_GROUPNO || _v_TUNING != other._v_TUNING)
+    return false;
+  for (int32_t ch = 0; ch < pxtnMAX_CHANNEL; ch++)
+    if (_pan_vols[ch] != other._pan_vols[ch] ||
+        _pan_times[ch] != other._pan_times[ch])
+      return false;
+
+  if (_silent_smp_num < pxtnBUFSIZE_TIMEPAN ||
+      other._silent_smp_num < pxtnBUFSIZE_TIMEPAN) {
+    if (_silent_smp_num != other._silent_smp_num) return false;
+    if (memcmp(_pan_time_bufs, other._pan_time_bufs, sizeof(_pan_time_bufs)))
+      return false;
+  }
+
+  for (int32_t v = 0; v < _p_woice->get_voice_num(); v++) {
+    const pxtnVOICETONE &a = _vts[v], &b = other._vts[v];
+    if (a.offset_freq != b.offset_freq ||
+        a.env_release_clock != b.env_release_clock)
+      return false;
+    if (a.life_count <= 0 && b.life_count <= 0) continue;
+    if (a.life_count != b.life_count || a.on_count != b.on_count ||
+        a.smp_pos != b.smp_pos || a.env_volume != b.env_volume ||
+        a.env_start != b.env_start || a.env_pos != b.env_pos)
+      return false;
+  }
+  return true;
+}
+
 pxtnVOICETONE *pxtnUnitTone::get_tone(int32_t voice_idx) {
   return &_vts[voice_idx];
 }
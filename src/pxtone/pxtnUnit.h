@@ -23,12 +23,18 @@ class pxtnUnitTone {
 
   /* Flipped the row-col order here so that Tone_Sample_Custom is easier */
   int32_t _pan_time_bufs[pxtnBUFSIZE_TIMEPAN][pxtnMAX_CHANNEL];
+  // Samples since a voice last wrote to [_pan_time_bufs]. Once this reaches
+  // pxtnBUFSIZE_TIMEPAN the time pan buffer is all zeros.
+  int32_t _silent_smp_num;
   int32_t _v_VOLUME;
   int32_t _v_VELOCITY;
   int32_t _v_GROUPNO;
   float _v_TUNING;
 
   std::shared_ptr<const pxtnWoice> _p_woice;
+  // Whether the voices were last reset before the woice was ready, so with
+  // none of its lengths.
+  bool _b_reset_unready;
 
   pxtnVOICETONE _vts[pxtnMAX_UNITCONTROLVOICE];
 
@@ -42,10 +48,15 @@ class pxtnUnitTone {
   void Tone_Reset_Custom(float tempo, float clock_rate,
                          pxtnVOICETONE *vts) const;
   void Tone_Reset(float tempo, float clock_rate);
+  bool was_reset_unready() const;
   void Tone_Envelope_Custom(pxtnVOICETONE *vts) const;
   void Tone_Envelope();
   void Tone_KeyOn();
   void Tone_ZeroLives();
+  // Opens the streams of the sounding voices where they are, which has to be
+  // done whenever they start sounding or are copied. With [b_prefetch],
+  // they're opened and decoded on a background thread.
+  void Tone_Open_Streams(bool b_prefetch);
   void Tone_Key(int32_t key);
   void Tone_Pan_Volume(int32_t ch, int32_t pan);
   void Tone_Pan_Time(int32_t ch, int32_t pan, int32_t sps);
@@ -57,18 +68,25 @@ class pxtnUnitTone {
   void Tone_Tuning(float val);
 
   void Tone_Sample_Custom(int32_t ch_num, int32_t smooth_smp,
+                          pxtnRESAMPLE resample, float smp_stride,
                           pxtnVOICETONE *vts, int32_t *bufs) const;
   void Tone_Sample(bool b_mute, int32_t ch_num, int32_t time_pan_index,
-                   int32_t smooth_smp);
+                   int32_t smooth_smp, pxtnRESAMPLE resample,
+                   float smp_stride);
   int32_t Tone_Supple_get(int32_t ch, int32_t time_pan_index) const;
-  void Tone_Supple(int32_t *group_smps, int32_t ch_num,
-                   int32_t time_pan_index) const;
   int32_t Tone_Increment_Key();
   void Tone_Increment_Sample_Custom(float freq, pxtnVOICETONE *vts) const;
   void Tone_Increment_Sample(float freq);
+  void Tone_Render(bool b_mute, int32_t ch_num, int32_t time_pan_index,
+                   int32_t smooth_smp, pxtnRESAMPLE resample, float smp_stride,
+                   int32_t smp_num, int32_t *bufs);
+  void Tone_Skip(int32_t smp_num);
 
   bool set_woice(std::shared_ptr<const pxtnWoice> p_woice, bool resetKey);
   std::shared_ptr<const pxtnWoice> get_woice() const;
+  int32_t get_group_no() const;
+  bool is_sounding() const;
+  bool sounds_like(const pxtnUnitTone &other, bool b_portament_next) const;
 
   pxtnVOICETONE *get_tone(int32_t voice_idx);
 };
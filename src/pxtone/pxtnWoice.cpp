@@ -2,6 +2,8 @@
 
 #include "./pxtnWoice.h"
 
+#include <algorithm>
+
 #include "./pxtn.h"
 #include "./pxtnEvelist.h"
 #include "./pxtnMem.h"
@@ -14,6 +16,7 @@ pxtnWoice::pxtnWoice() {
   _type = pxtnWOICE_None;
   _voices = NULL;
   _voinsts = NULL;
+  _b_tone_ready = false;
 }
 
 pxtnWoice::~pxtnWoice() { Voice_Release(); }
@@ -54,6 +57,100 @@ bool pxtnWoice::is_name_buf() const {
   return false;
 }
 
+pxtnVOICESTREAM::pxtnVOICESTREAM() {
+  _p_stream = NULL;
+  _p_prefetch = NULL;
+}
+pxtnVOICESTREAM::pxtnVOICESTREAM(const pxtnVOICESTREAM&) {
+  _p_stream = NULL;
+  _p_prefetch = NULL;
+}
+pxtnVOICESTREAM::pxtnVOICESTREAM(pxtnVOICESTREAM&& src) noexcept {
+  _p_stream = src._p_stream;
+  _p_prefetch = src._p_prefetch;
+  src._p_stream = NULL;
+  src._p_prefetch = NULL;
+}
+pxtnVOICESTREAM& pxtnVOICESTREAM::operator=(const pxtnVOICESTREAM&) {
+  Close();
+  return *this;
+}
+pxtnVOICESTREAM& pxtnVOICESTREAM::operator=(pxtnVOICESTREAM&& src) noexcept {
+  if (this != &src) {
+    Close();
+    _p_stream = src._p_stream;
+    _p_prefetch = src._p_prefetch;
+    src._p_stream = NULL;
+    src._p_prefetch = NULL;
+  }
+  return *this;
+}
+pxtnVOICESTREAM::~pxtnVOICESTREAM() { Close(); }
+
+void pxtnVOICESTREAM::Open(const pxtnVOICEINSTANCE* p_vi, int32_t smp_pos,
+                           std::shared_ptr<const void> p_keep) {
+#ifdef pxINCLUDE_OGGVORBIS
+  if (!p_vi->p_stream) return;
+  if (p_keep) {
+    if (_p_stream || (_p_prefetch && !_p_prefetch->is_of(p_vi->p_stream)))
+      Close();
+    if (!_p_prefetch)
+      _p_prefetch =
+          pxtnPulse_OggvPrefetch::Start(p_vi->p_stream, p_keep, smp_pos);
+    else
+      _p_prefetch->Seek(smp_pos);
+    return;
+  }
+  if (_p_prefetch || (_p_stream && !_p_stream->is_of(p_vi->p_stream)))
+    Close();
+  if (!_p_stream) _p_stream = new pxtnPulse_OggvStream(p_vi->p_stream);
+  _p_stream->Seek(smp_pos);
+#else
+  (void)p_vi;
+  (void)smp_pos;
+  (void)p_keep;
+#endif
+}
+
+void pxtnVOICESTREAM::Seek(const pxtnVOICEINSTANCE* p_vi, int32_t smp_pos) {
+#ifdef pxINCLUDE_OGGVORBIS
+  if (!p_vi->p_stream) return;
+  if (_p_prefetch && _p_prefetch->is_of(p_vi->p_stream))
+    _p_prefetch->Seek(smp_pos);
+  else if (_p_stream && _p_stream->is_of(p_vi->p_stream))
+    _p_stream->Seek(smp_pos);
+#else
+  (void)p_vi;
+  (void)smp_pos;
+#endif
+}
+
+void pxtnVOICESTREAM::Close() {
+#ifdef pxINCLUDE_OGGVORBIS
+  SAFE_DELETE(_p_stream);
+  if (_p_prefetch) _p_prefetch->Release();
+  _p_prefetch = NULL;
+#endif
+}
+
+const int16_t* pxtnVOICESTREAM::Read(const pxtnVOICEINSTANCE* p_vi,
+                                     int32_t smp_pos, int32_t smp_num) {
+#ifdef pxINCLUDE_OGGVORBIS
+  if (!p_vi->p_stream) return NULL;
+  if (_p_prefetch)
+    return _p_prefetch->is_of(p_vi->p_stream)
+               ? _p_prefetch->Read(smp_pos, smp_num)
+               : NULL;
+  if (!_p_stream || !_p_stream->is_of(p_vi->p_stream)) return NULL;
+  return _p_stream->Read(smp_pos, smp_num);
+#else
+  (void)p_vi;
+  (void)smp_pos;
+  (void)smp_num;
+  return NULL;
+#endif
+}
+
 static void _Voice_Release(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi) {
   if (p_vc) {
     SAFE_DELETE(p_vc->p_pcm);
@@ -74,6 +171,7 @@ static void _Voice_Release(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi) {
 }
 
 void pxtnWoice::Voice_Release() {
+  _b_tone_ready = false;
   for (int32_t v = 0; v < _voice_num; v++)
     _Voice_Release(&_voices[v], &_voinsts[v]);
   pxtnMem_free((void**)&_voices);
@@ -325,11 +423,157 @@ static void _UpdateWavePTV(pxtnVOICEUNIT* p_vc, pxtnVOICEINSTANCE* p_vi,
   }
 }
 
-pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
+// How long [smp_num] samples at [sps] were once converted to 44.1kHz stereo,
+// with the same rounding as pxtnPulse_PCM::Convert.
+static int32_t _smp_num_44k(int32_t smp_num, int32_t sps) {
+  if (sps == 44100) return smp_num;
+  int32_t size = smp_num * 4;
+  size = (int32_t)(((double)size * 44100 + (double)sps - 1) / sps);
+  return size / 4;
+}
+
+// Takes [pcm]'s samples as they are, apart from being made 16-bit.
+static bool _Instance_Set_PCM(pxtnVOICEINSTANCE* p_vi, pxtnPulse_PCM* pcm) {
+  if (pcm->get_sps() <= 0 || !pcm->Convert(pcm->get_ch(), pcm->get_sps(), 16))
+    return false;
+  p_vi->ch_num = pcm->get_ch();
+  p_vi->sps = pcm->get_sps();
+  p_vi->smp_num =
+      pcm->get_smp_head() + pcm->get_smp_body() + pcm->get_smp_tail();
+  p_vi->smp_resident = p_vi->smp_num;
+  p_vi->smp_head_w = _smp_num_44k(pcm->get_smp_head(), p_vi->sps);
+  p_vi->smp_body_w = _smp_num_44k(pcm->get_smp_body(), p_vi->sps);
+  p_vi->smp_tail_w = _smp_num_44k(pcm->get_smp_tail(), p_vi->sps);
+  p_vi->p_smp_w = (uint8_t*)pcm->Devolve_SamplingBuffer();
+  return true;
+}
+
+#ifdef pxINCLUDE_OGGVORBIS
+// Ogg voices that would take more than this decoded are streamed instead.
+#define _OGGV_STREAM_MIN_SIZE 0x200000
+
+// Whether [p_oggv] is long enough to stream. The decoder keeps up with any
+// channel count it could be, but only mono and stereo can be read.
+static bool _Oggv_Is_Long(pxtnPulse_Oggv* p_oggv) {
+  int32_t ch, sps, smp_num;
+  if (!p_oggv->GetInfo(&ch, &sps, &smp_num)) return false;
+  if ((ch != 1 && ch != 2) || sps <= 0) return false;
+  return (int64_t)smp_num * ch * 2 > _OGGV_STREAM_MIN_SIZE;
+}
+
+// Decodes just the start and end of [p_oggv], leaving the rest to be streamed.
+static pxtnERR _Instance_Set_Oggv_Stream(pxtnVOICEINSTANCE* p_vi,
+                                         pxtnPulse_Oggv* p_oggv) {
+  int32_t ch, sps, smp_num;
+  if (!p_oggv->GetInfo(&ch, &sps, &smp_num)) return pxtnERR_ogg;
+
+  int32_t head_num = std::min(smp_num, pxtnPulse_OggvStream::WINDOW_SMP_NUM);
+  int32_t tail_num = std::min(smp_num, pxtnSTREAM_TAIL_NUM);
+  pxtnPulse_OggvStream stream(p_oggv);
+  int32_t head_size = head_num * ch * sizeof(int16_t);
+  int32_t tail_size = tail_num * ch * sizeof(int16_t);
+  if (!(p_vi->p_smp_w = (uint8_t*)malloc(head_size + tail_size)))
+    return pxtnERR_memory;
+  const int16_t* p = stream.Read(0, head_num);
+  if (p) {
+    memcpy(p_vi->p_smp_w, p, head_size);
+    p = stream.Read(smp_num - tail_num, tail_num);
+  }
+  if (!p) {
+    pxtnMem_free((void**)&p_vi->p_smp_w);
+    return pxtnERR_ogg;
+  }
+  memcpy(p_vi->p_smp_w + head_size, p, tail_size);
+  p_vi->ch_num = ch;
+  p_vi->sps = sps;
+  p_vi->smp_num = smp_num;
+  p_vi->smp_resident = head_num;
+  p_vi->p_stream = p_oggv;
+  p_vi->smp_head_w = 0;
+  p_vi->smp_body_w = _smp_num_44k(smp_num, sps);
+  p_vi->smp_tail_w = 0;
+  return pxtnOK;
+}
+#endif
+
+// Tone cache keys: what a voice is readied from, and how.
+template <typename T>
+static void _Key_Add(std::vector<uint8_t>* p_key, const T& value) {
+  const uint8_t* p = (const uint8_t*)&value;
+  p_key->insert(p_key->end(), p, p + sizeof(T));
+}
+
+static std::vector<uint8_t> _Key_Begin(pxtnVOICETYPE type) {
+  std::vector<uint8_t> key;
+  _Key_Add(&key, pxtnToneCache::VERSION);
+  _Key_Add(&key, (int32_t)type);
+  return key;
+}
+
+#ifdef pxINCLUDE_OGGVORBIS
+static std::vector<uint8_t> _Key_Oggv(const pxtnPulse_Oggv* p_oggv) {
+  std::vector<uint8_t> key = _Key_Begin(pxtnVOICE_OggVorbis);
+  int32_t size;
+  const char* p_data = p_oggv->GetData(&size);
+  if (p_data) key.insert(key.end(), p_data, p_data + size);
+  return key;
+}
+#endif
+
+static void _Key_Add_Osc(std::vector<uint8_t>* p_key,
+                         const pxNOISEDESIGN_OSCILLATOR& osc) {
+  _Key_Add(p_key, (int32_t)osc.type);
+  _Key_Add(p_key, osc.freq);
+  _Key_Add(p_key, osc.volume);
+  _Key_Add(p_key, osc.offset);
+  _Key_Add(p_key, (int32_t)osc.b_rev);
+}
+
+static std::vector<uint8_t> _Key_Noise(pxtnPulse_Noise* p_ptn, int32_t ch,
+                                       int32_t sps, int32_t bps) {
+  std::vector<uint8_t> key = _Key_Begin(pxtnVOICE_Noise);
+  _Key_Add(&key, ch);
+  _Key_Add(&key, sps);
+  _Key_Add(&key, bps);
+  _Key_Add(&key, p_ptn->get_smp_num_44k());
+  _Key_Add(&key, p_ptn->get_unit_num());
+  for (int32_t u = 0; u < p_ptn->get_unit_num(); u++) {
+    const pxNOISEDESIGN_UNIT* p_unit = p_ptn->get_unit(u);
+    _Key_Add(&key, (int32_t)p_unit->bEnable);
+    _Key_Add(&key, p_unit->enve_num);
+    for (int32_t e = 0; e < p_unit->enve_num; e++) {
+      _Key_Add(&key, p_unit->enves[e].x);
+      _Key_Add(&key, p_unit->enves[e].y);
+    }
+    _Key_Add(&key, p_unit->pan);
+    _Key_Add_Osc(&key, p_unit->main);
+    _Key_Add_Osc(&key, p_unit->freq);
+    _Key_Add_Osc(&key, p_unit->volu);
+  }
+  return key;
+}
+
+// Sets [p_vi] from [cache], if it's there and sensible.
+static bool _Instance_Load(pxtnToneCache* cache,
+                           const std::vector<uint8_t>& key,
+                           pxtnVOICEINSTANCE* p_vi) {
+  if (!cache->Load(key, p_vi)) return false;
+  if ((p_vi->ch_num != 1 && p_vi->ch_num != 2) || p_vi->sps <= 0 ||
+      p_vi->smp_num <= 0 || !p_vi->p_smp_w) {
+    pxtnMem_free((void**)&p_vi->p_smp_w);
+    return false;
+  }
+  p_vi->smp_resident = p_vi->smp_num;
+  return true;
+}
+
+pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr,
+                                     pxtnToneCache* cache) {
   pxtnERR res = pxtnERR_VOID;
   pxtnVOICEINSTANCE* p_vi = NULL;
   pxtnVOICEUNIT* p_vc = NULL;
   pxtnPulse_PCM pcm_work;
+  std::vector<uint8_t> key;
 
   int32_t ch = 2;
   int32_t sps = 44100;
@@ -341,6 +585,11 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
     p_vi->smp_head_w = 0;
     p_vi->smp_body_w = 0;
     p_vi->smp_tail_w = 0;
+    p_vi->smp_num = 0;
+    p_vi->smp_resident = 0;
+#ifdef pxINCLUDE_OGGVORBIS
+    p_vi->p_stream = NULL;
+#endif
   }
 
   for (int32_t v = 0; v < _voice_num; v++) {
@@ -351,13 +600,19 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
       case pxtnVOICE_OggVorbis:
 
 #ifdef pxINCLUDE_OGGVORBIS
+        if (_Oggv_Is_Long(p_vc->p_oggv)) {
+          res = _Instance_Set_Oggv_Stream(p_vi, p_vc->p_oggv);
+          if (res != pxtnOK) goto term;
+          break;
+        }
+        if (cache) {
+          key = _Key_Oggv(p_vc->p_oggv);
+          if (_Instance_Load(cache, key, p_vi)) break;
+        }
         res = p_vc->p_oggv->Decode(&pcm_work);
         if (res != pxtnOK) goto term;
-        if (!pcm_work.Convert(ch, sps, bps)) goto term;
-        p_vi->smp_head_w = pcm_work.get_smp_head();
-        p_vi->smp_body_w = pcm_work.get_smp_body();
-        p_vi->smp_tail_w = pcm_work.get_smp_tail();
-        p_vi->p_smp_w = (uint8_t*)pcm_work.Devolve_SamplingBuffer();
+        if (!_Instance_Set_PCM(p_vi, &pcm_work)) goto term;
+        if (cache) cache->Save(key, p_vi);
 #else
         res = pxtnERR_ogg_no_supported;
         goto term;
@@ -368,14 +623,10 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
 
         res = p_vc->p_pcm->Copy(&pcm_work);
         if (res != pxtnOK) goto term;
-        if (!pcm_work.Convert(ch, sps, bps)) {
+        if (!_Instance_Set_PCM(p_vi, &pcm_work)) {
           res = pxtnERR_pcm_convert;
           goto term;
         }
-        p_vi->smp_head_w = pcm_work.get_smp_head();
-        p_vi->smp_body_w = pcm_work.get_smp_body();
-        p_vi->smp_tail_w = pcm_work.get_smp_tail();
-        p_vi->p_smp_w = (uint8_t*)pcm_work.Devolve_SamplingBuffer();
         break;
 
       case pxtnVOICE_Overtone:
@@ -387,12 +638,20 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
           goto term;
         }
         memset(p_vi->p_smp_w, 0x00, size);
+        p_vi->ch_num = ch;
+        p_vi->sps = sps;
+        p_vi->smp_num = p_vi->smp_body_w;
+        p_vi->smp_resident = p_vi->smp_num;
         _UpdateWavePTV(p_vc, p_vi, ch, sps, bps);
         break;
       }
 
       case pxtnVOICE_Noise: {
         pxtnPulse_PCM* p_pcm = NULL;
+        if (cache) {
+          key = _Key_Noise(p_vc->p_ptn, ch, sps, bps);
+          if (_Instance_Load(cache, key, p_vi)) break;
+        }
         if (!ptn_bldr) {
           res = pxtnERR_ptn_init;
           goto term;
@@ -402,7 +661,12 @@ pxtnERR pxtnWoice::Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr) {
           goto term;
         }
         p_vi->p_smp_w = (uint8_t*)p_pcm->Devolve_SamplingBuffer();
+        p_vi->ch_num = ch;
+        p_vi->sps = sps;
         p_vi->smp_body_w = p_vc->p_ptn->get_smp_num_44k();
+        p_vi->smp_num = p_vi->smp_body_w;
+        p_vi->smp_resident = p_vi->smp_num;
+        if (cache) cache->Save(key, p_vi);
         break;
       }
     }
@@ -417,6 +681,11 @@ term:
       p_vi->smp_head_w = 0;
       p_vi->smp_body_w = 0;
       p_vi->smp_tail_w = 0;
+      p_vi->smp_num = 0;
+      p_vi->smp_resident = 0;
+#ifdef pxINCLUDE_OGGVORBIS
+      p_vi->p_stream = NULL;
+#endif
     }
   }
 
@@ -506,11 +775,28 @@ term:
 }
 
 pxtnERR pxtnWoice::Tone_Ready(const pxtnPulse_NoiseBuilder* ptn_bldr,
-                              int32_t sps) {
+                              int32_t sps, pxtnToneCache* cache) {
   pxtnERR res = pxtnERR_VOID;
-  res = Tone_Ready_sample(ptn_bldr);
+  _b_tone_ready = false;
+  res = Tone_Ready_sample(ptn_bldr, cache);
   if (res != pxtnOK) return res;
   res = Tone_Ready_envelope(sps);
   if (res != pxtnOK) return res;
+  _b_tone_ready = true;
   return pxtnOK;
 }
+
+bool pxtnWoice::is_tone_ready() const { return _b_tone_ready; }
+
+bool pxtnWoice::Tone_Take(pxtnWoice* p_src) {
+  if (!p_src->_b_tone_ready || p_src->_voice_num != _voice_num) return false;
+  std::swap(_voinsts, p_src->_voinsts);
+#ifdef pxINCLUDE_OGGVORBIS
+  // Streams read the Ogg data they were readied from, which goes with [p_src].
+  for (int32_t v = 0; v < _voice_num; v++)
+    if (_voinsts[v].p_stream) _voinsts[v].p_stream = _voices[v].p_oggv;
+#endif
+  p_src->_b_tone_ready = false;
+  _b_tone_ready = true;
+  return true;
+}
@@ -3,6 +3,10 @@
 #ifndef pxtnWoice_H
 #define pxtnWoice_H
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "./pxtn.h"
 #include "./pxtnDescriptor.h"
 #include "./pxtnPulse_Noise.h"
@@ -15,7 +19,9 @@
 #define pxtnMAX_UNITCONTROLVOICE 2  // max-woice per unit
 
 #define pxtnBUFSIZE_TIMEPAN 0x40
+#define pxtnBUFSIZE_MOOBLOCK 0x100  // max samples rendered between events
 #define pxtnBITPERSAMPLE 16
+#define pxtnSTREAM_TAIL_NUM 0x40
 
 #define PTV_VOICEFLAG_WAVELOOP 0x00000001
 #define PTV_VOICEFLAG_SMOOTH 0x00000002
@@ -34,6 +40,12 @@ enum pxtnWOICETYPE : int8_t {
   pxtnWOICE_OGGV,
 };
 
+// How voices are read between the samples they're stored with.
+enum pxtnRESAMPLE : int8_t {
+  pxtnRESAMPLE_nearest = 0,  // As pxtone does.
+  pxtnRESAMPLE_sinc,
+};
+
 enum pxtnVOICETYPE {
   pxtnVOICE_Coodinate = 0,
   pxtnVOICE_Overtone,
@@ -44,16 +56,50 @@ enum pxtnVOICETYPE {
 
 /* Contains parameters for how to play this voice - release, pcm data, etc. */
 typedef struct {
+  // In 44.1kHz samples, as are playback positions, whatever [sps] is.
   int32_t smp_head_w;
   int32_t smp_body_w;
   int32_t smp_tail_w;
+  // 16-bit samples, kept at the channel count and rate the voice came with.
+  // Read them with pxtnResample.
   uint8_t* p_smp_w;
+  int32_t ch_num;
+  int32_t sps;
+  int32_t smp_num;
+  // How many of [smp_num] are in [p_smp_w]. Long Ogg voices only keep their
+  // start there, and the rest is decoded from [p_stream] as it plays. They
+  // keep their last pxtnSTREAM_TAIL_NUM samples after the start too, for
+  // reading across the loop.
+  int32_t smp_resident;
+#ifdef pxINCLUDE_OGGVORBIS
+  const pxtnPulse_Oggv* p_stream;
+#endif
 
   uint8_t* p_env;
   int32_t env_size;
   int32_t env_release;
 } pxtnVOICEINSTANCE;
 
+// Somewhere to keep the samples of voices that are slow to ready (decoded Ogg
+// and built noise), so the same voice needn't be readied again, e.g. the next
+// time a project is opened. Woices are readied from several threads at once,
+// so both calls have to be thread-safe.
+class pxtnToneCache {
+ public:
+  // Goes into every key. Bump it when readying changes what comes out.
+  static constexpr int32_t VERSION = 1;
+
+  virtual ~pxtnToneCache() {}
+
+  // Sets the samples and sizes of [p_vi] (all but smp_resident) to what was
+  // saved for [key], with p_smp_w from malloc. Returns false if nothing was.
+  virtual bool Load(const std::vector<uint8_t>& key,
+                    pxtnVOICEINSTANCE* p_vi) = 0;
+  // Keeps the samples of [p_vi] for [key]. They're all resident.
+  virtual void Save(const std::vector<uint8_t>& key,
+                    const pxtnVOICEINSTANCE* p_vi) = 0;
+};
+
 typedef struct {
   int32_t fps;
   int32_t head_num;
@@ -87,6 +133,44 @@ typedef struct {
   pxtnVOICEENVELOPE envelope;
 } pxtnVOICEUNIT;
 
+class pxtnPulse_OggvStream;
+class pxtnPulse_OggvPrefetch;
+
+// Where a streamed voice is being decoded for one tone. Opening and seeking a
+// decoder is too slow to do while rendering, so it's done by Open when a note
+// starts, and reading a stream that isn't open gives nothing. For rendering on
+// the audio thread, Open can leave that to a background thread instead (see
+// pxtnPulse_OggvPrefetch), and what it hasn't decoded yet is silent. Copies
+// start out closed so that copies of a moo state can play on different
+// threads, and need opening again; moves keep the decoder.
+class pxtnVOICESTREAM {
+ private:
+  pxtnPulse_OggvStream* _p_stream;
+  pxtnPulse_OggvPrefetch* _p_prefetch;
+
+ public:
+  pxtnVOICESTREAM();
+  pxtnVOICESTREAM(const pxtnVOICESTREAM& src);
+  pxtnVOICESTREAM(pxtnVOICESTREAM&& src) noexcept;
+  pxtnVOICESTREAM& operator=(const pxtnVOICESTREAM& src);
+  pxtnVOICESTREAM& operator=(pxtnVOICESTREAM&& src) noexcept;
+  ~pxtnVOICESTREAM();
+
+  // Gets ready to read [p_vi] from stored sample [smp_pos] on, opening a
+  // decoder if there isn't one for it. With [p_keep], that's done on the
+  // background thread, which holds [p_keep] (whatever keeps [p_vi] alive)
+  // until it's done with it. Does nothing if [p_vi] isn't streamed.
+  void Open(const pxtnVOICEINSTANCE* p_vi, int32_t smp_pos,
+            std::shared_ptr<const void> p_keep = nullptr);
+  // Moves an open stream to read from [smp_pos] on, however it was opened.
+  void Seek(const pxtnVOICEINSTANCE* p_vi, int32_t smp_pos);
+  void Close();
+  // Samples [smp_pos, smp_pos + smp_num) of [p_vi] as interleaved 16-bit, or
+  // NULL if they can't be decoded (or aren't yet) or the stream isn't open.
+  const int16_t* Read(const pxtnVOICEINSTANCE* p_vi, int32_t smp_pos,
+                      int32_t smp_num);
+};
+
 /* A dynamic structure during playback that tracks offset into the sampling
  * data, remaining duration fo the note, etc. */
 
@@ -104,6 +188,8 @@ struct pxtnVOICETONE {
 
   // int32_t smooth_volume; /* Likewise, seems unused. So commented. */
 
+  pxtnVOICESTREAM stream;
+
   pxtnVOICETONE() {}
   pxtnVOICETONE(int32_t env_release_clock, float offset_freq,
                 bool woice_has_envelope)
@@ -130,6 +216,7 @@ class pxtnWoice {
   pxtnWOICETYPE _type;
   pxtnVOICEUNIT* _voices;
   pxtnVOICEINSTANCE* _voinsts;
+  std::atomic<bool> _b_tone_ready;
 
   float _x3x_tuning;
   int32_t _x3x_basic_key;  // tuning old-fmt when key-event
@@ -175,9 +262,18 @@ class pxtnWoice {
   pxtnERR io_mateOGGV_r(pxtnDescriptor* p_doc);
 #endif
 
-  pxtnERR Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr);
+  pxtnERR Tone_Ready_sample(const pxtnPulse_NoiseBuilder* ptn_bldr,
+                            pxtnToneCache* cache = NULL);
   pxtnERR Tone_Ready_envelope(int32_t sps);
-  pxtnERR Tone_Ready(const pxtnPulse_NoiseBuilder* ptn_bldr, int32_t sps);
+  // Samples that are slow to ready are looked up in and kept in [cache].
+  pxtnERR Tone_Ready(const pxtnPulse_NoiseBuilder* ptn_bldr, int32_t sps,
+                     pxtnToneCache* cache = NULL);
+  // Whether the last Tone_Ready went through. Until it has, the instances are
+  // empty and units playing this woice stay silent.
+  bool is_tone_ready() const;
+  // Takes the tones of [p_src], a Copy of this woice that's been readied, so
+  // that the readying can be done off to the side. Returns false if it wasn't.
+  bool Tone_Take(pxtnWoice* p_src);
 };
 
 #endif